@@ -0,0 +1,350 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Local calculation of sun and moon rise/set times, solar noon and
+ * midnight elevations and the moon phase, using the low precision
+ * formulas from the Astronomical Almanac and Meeus, "Astronomical
+ * Algorithms". Times are accurate to a minute or two, which is more
+ * than enough for deciding whether it is day or night and for
+ * displaying the values in the summary window.
+ */
+
+#include <math.h>
+
+#include "weather-astro.h"
+#include "weather-data.h"
+#include "weather-debug.h"
+
+#define RAD (G_PI / 180)
+#define J2000 946728000                 /* 2000-01-01 12:00 UTC */
+#define HORIZON_ALTITUDE (-0.833 * RAD) /* refraction and semi-diameter */
+#define EARTH_RADIUS_KM 6378.14
+#define SAMPLE_INTERVAL 600             /* seconds */
+
+
+typedef gdouble (*AltitudeFunc) (time_t t, gdouble lat, gdouble lon);
+
+
+static gdouble
+days_since_j2000(time_t t)
+{
+    return (gdouble) (t - J2000) / 86400.0;
+}
+
+
+/* obliquity of the ecliptic in radians */
+static gdouble
+obliquity(gdouble d)
+{
+    return (23.439 - 0.00000036 * d) * RAD;
+}
+
+
+/* mean anomaly of the sun in radians */
+static gdouble
+sun_mean_anomaly(gdouble d)
+{
+    return (357.529 + 0.98560028 * d) * RAD;
+}
+
+
+/* apparent ecliptic longitude of the sun in radians */
+static gdouble
+sun_ecliptic_longitude(gdouble d)
+{
+    gdouble g = sun_mean_anomaly(d);
+
+    return (280.459 + 0.98564736 * d
+            + 1.915 * sin(g) + 0.020 * sin(2 * g)) * RAD;
+}
+
+
+/*
+ * Ecliptic longitude and latitude in radians and distance in km of
+ * the moon, including the largest periodic terms.
+ */
+static void
+moon_ecliptic_position(gdouble d,
+                       gdouble *lambda,
+                       gdouble *beta,
+                       gdouble *dist)
+{
+    gdouble L, M, F, D, Ms;
+
+    L = (218.316 + 13.176396 * d) * RAD;
+    M = (134.963 + 13.064993 * d) * RAD;
+    F = (93.272 + 13.229350 * d) * RAD;
+    D = (297.850 + 12.190749 * d) * RAD;
+    Ms = sun_mean_anomaly(d);
+
+    *lambda = L + (6.289 * sin(M)
+                   + 1.274 * sin(2 * D - M)
+                   + 0.658 * sin(2 * D)
+                   - 0.186 * sin(Ms)
+                   - 0.114 * sin(2 * F)) * RAD;
+    *beta = 5.128 * RAD * sin(F);
+    *dist = 385001 - 20905 * cos(M);
+}
+
+
+/* convert ecliptic to equatorial coordinates */
+static void
+ecliptic_to_equatorial(gdouble d,
+                       gdouble lambda,
+                       gdouble beta,
+                       gdouble *ra,
+                       gdouble *dec)
+{
+    gdouble e = obliquity(d);
+
+    *ra = atan2(sin(lambda) * cos(e) - tan(beta) * sin(e), cos(lambda));
+    *dec = asin(sin(beta) * cos(e) + cos(beta) * sin(e) * sin(lambda));
+}
+
+
+/* geometric altitude in radians of an object at the given position */
+static gdouble
+altitude(gdouble d,
+         gdouble lat,
+         gdouble lon,
+         gdouble ra,
+         gdouble dec)
+{
+    gdouble sidereal, ha;
+
+    sidereal = (280.46061837 + 360.98564736629 * d + lon) * RAD;
+    ha = sidereal - ra;
+    lat *= RAD;
+    return asin(sin(lat) * sin(dec) + cos(lat) * cos(dec) * cos(ha));
+}
+
+
+static gdouble
+sun_altitude(time_t t,
+             gdouble lat,
+             gdouble lon)
+{
+    gdouble d = days_since_j2000(t), ra, dec;
+
+    ecliptic_to_equatorial(d, sun_ecliptic_longitude(d), 0, &ra, &dec);
+    return altitude(d, lat, lon, ra, dec);
+}
+
+
+/* topocentric altitude of the moon, corrected for parallax */
+static gdouble
+moon_altitude(time_t t,
+              gdouble lat,
+              gdouble lon)
+{
+    gdouble d = days_since_j2000(t), lambda, beta, dist, ra, dec, h;
+
+    moon_ecliptic_position(d, &lambda, &beta, &dist);
+    ecliptic_to_equatorial(d, lambda, beta, &ra, &dec);
+    h = altitude(d, lat, lon, ra, dec);
+    return h - asin(EARTH_RADIUS_KM / dist) * cos(h);
+}
+
+
+/*
+ * Moon phase as the elongation of the moon from the sun in degrees,
+ * with 0 for new moon and 180 for full moon, like the met.no API.
+ */
+static gdouble
+moon_phase_angle(time_t t)
+{
+    gdouble d = days_since_j2000(t), lambda, beta, dist, phase;
+
+    moon_ecliptic_position(d, &lambda, &beta, &dist);
+    phase = fmod((lambda - sun_ecliptic_longitude(d)) / RAD, 360.0);
+    return phase < 0 ? phase + 360.0 : phase;
+}
+
+
+/* narrow down the time the altitude crosses the horizon to a second */
+static time_t
+refine_crossing(AltitudeFunc altitude_func,
+                time_t lo_t,
+                time_t hi_t,
+                gdouble lat,
+                gdouble lon)
+{
+    gboolean rising;
+    time_t mid_t;
+
+    rising = altitude_func(lo_t, lat, lon) < HORIZON_ALTITUDE;
+    while (hi_t - lo_t > 1) {
+        mid_t = lo_t + (hi_t - lo_t) / 2;
+        if ((altitude_func(mid_t, lat, lon) < HORIZON_ALTITUDE) == rising)
+            lo_t = mid_t;
+        else
+            hi_t = mid_t;
+    }
+    return hi_t;
+}
+
+
+/* narrow down the altitude of a maximum (sign = 1) or minimum (-1) */
+static gdouble
+refine_extremum(AltitudeFunc altitude_func,
+                time_t lo_t,
+                time_t hi_t,
+                gdouble lat,
+                gdouble lon,
+                gint sign)
+{
+    time_t m1_t, m2_t;
+
+    while (hi_t - lo_t > 2) {
+        m1_t = lo_t + (hi_t - lo_t) / 3;
+        m2_t = hi_t - (hi_t - lo_t) / 3;
+        if (sign * altitude_func(m1_t, lat, lon)
+            < sign * altitude_func(m2_t, lat, lon))
+            lo_t = m1_t;
+        else
+            hi_t = m2_t;
+    }
+    return altitude_func(lo_t + (hi_t - lo_t) / 2, lat, lon);
+}
+
+
+/*
+ * Sample the altitude of a body over [start_t, end_t) and find the
+ * first rise and set, which are left at 0 if there is none. The
+ * highest and lowest altitudes are returned in degrees if requested.
+ */
+static void
+find_events(AltitudeFunc altitude_func,
+            time_t start_t,
+            time_t end_t,
+            gdouble lat,
+            gdouble lon,
+            time_t *rise_t,
+            time_t *set_t,
+            gdouble *max_alt,
+            gdouble *min_alt)
+{
+    gdouble h, prev_h, max_h = -G_MAXDOUBLE, min_h = G_MAXDOUBLE;
+    time_t t, prev_t, max_t = start_t, min_t = start_t;
+
+    *rise_t = *set_t = 0;
+    prev_t = start_t;
+    prev_h = altitude_func(prev_t, lat, lon);
+    for (t = start_t; t <= end_t; t += SAMPLE_INTERVAL) {
+        h = altitude_func(t, lat, lon);
+        if (t > start_t) {
+            if (*rise_t == 0 && prev_h < HORIZON_ALTITUDE
+                && h >= HORIZON_ALTITUDE)
+                *rise_t = refine_crossing(altitude_func, prev_t, t, lat, lon);
+            else if (*set_t == 0 && prev_h >= HORIZON_ALTITUDE
+                     && h < HORIZON_ALTITUDE)
+                *set_t = refine_crossing(altitude_func, prev_t, t, lat, lon);
+        }
+        if (h > max_h) {
+            max_h = h;
+            max_t = t;
+        }
+        if (h < min_h) {
+            min_h = h;
+            min_t = t;
+        }
+        prev_h = h;
+        prev_t = t;
+    }
+
+    /* events exactly at the end belong to the next day */
+    if (*rise_t >= end_t)
+        *rise_t = 0;
+    if (*set_t >= end_t)
+        *set_t = 0;
+
+    if (max_alt)
+        *max_alt = refine_extremum(altitude_func,
+                                   MAX(start_t, max_t - SAMPLE_INTERVAL),
+                                   MIN(end_t, max_t + SAMPLE_INTERVAL),
+                                   lat, lon, 1) / RAD;
+    if (min_alt)
+        *min_alt = refine_extremum(altitude_func,
+                                   MAX(start_t, min_t - SAMPLE_INTERVAL),
+                                   MIN(end_t, min_t + SAMPLE_INTERVAL),
+                                   lat, lon, -1) / RAD;
+}
+
+
+/*
+ * Calculate astronomical data for the local day starting at day_t,
+ * which needs to be midnight in the timezone of the location.
+ */
+xml_astro *
+calc_astro_data(time_t day_t,
+                gdouble lat,
+                gdouble lon)
+{
+    xml_astro *astro;
+    time_t end_t;
+
+    astro = g_slice_new0(xml_astro);
+    astro->day = day_t;
+    end_t = day_at_midnight(day_t, 1);
+
+    find_events(sun_altitude, day_t, end_t, lat, lon,
+                &astro->sunrise, &astro->sunset,
+                &astro->solarnoon_elevation,
+                &astro->solarmidnight_elevation);
+    astro->sun_never_rises = (astro->sunrise == 0);
+    astro->sun_never_sets = (astro->sunset == 0);
+
+    find_events(moon_altitude, day_t, end_t, lat, lon,
+                &astro->moonrise, &astro->moonset, NULL, NULL);
+    astro->moon_never_rises = (astro->moonrise == 0);
+    astro->moon_never_sets = (astro->moonset == 0);
+
+    astro->moon_phase =
+        g_strdup(parse_moonposition(moon_phase_angle(day_t + (end_t - day_t) / 2)));
+
+    weather_debug_date("calculated astro data for day=%s",
+                       astro->day, NULL, TRUE);
+    return astro;
+}
+
+
+/*
+ * Calculate astronomical data for the given days, each of them
+ * starting at midnight, and merge it into astrodata.
+ */
+void
+calc_astrodata(GArray *astrodata,
+               const time_t *days,
+               guint num_days,
+               gdouble lat,
+               gdouble lon)
+{
+    xml_astro *astro;
+    guint i;
+
+    g_assert(astrodata != NULL);
+    if (G_UNLIKELY(astrodata == NULL))
+        return;
+
+    for (i = 0; i < num_days; i++) {
+        astro = calc_astro_data(days[i], lat, lon);
+        merge_astro(astrodata, astro);
+        xml_astro_free(astro);
+    }
+}
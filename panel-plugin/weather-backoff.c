@@ -0,0 +1,208 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Retry policy for downloads that failed. Instead of retrying after
+ * fixed intervals, which makes all installations that saw the same
+ * outage retry at the same time, the delay grows exponentially with
+ * decorrelated jitter: each delay is picked at random between the
+ * base delay and three times the previous one, up to a cap. Base and
+ * cap depend on the kind of failure.
+ *
+ * A circuit breaker on top of that stops requests to an endpoint for
+ * a longer time after several failures in a row, or right away for
+ * failures that retrying will not fix. Once that time is over, the
+ * next request probes whether the endpoint is back; if it fails too,
+ * the breaker stays open for even longer.
+ *
+ * All functions take the current time as argument and keep no state
+ * besides the weather_backoff struct, so they do not depend on the
+ * system clock.
+ */
+
+#include <string.h>
+#include <libsoup/soup.h>
+
+#include "weather-backoff.h"
+#include "weather-debug.h"
+
+
+static const struct {
+    const gchar *name;
+    guint base;                     /* seconds */
+    guint cap;
+} backoff_policies[WEATHER_FAILURE_NUM] = {
+    [WEATHER_FAILURE_NONE] = { "none", 0, 0 },
+    [WEATHER_FAILURE_TRANSIENT] = { "transient", BACKOFF_TRANSIENT_BASE,
+                                     BACKOFF_TRANSIENT_CAP },
+    [WEATHER_FAILURE_SERVER] = { "server error", BACKOFF_SERVER_BASE,
+                                 BACKOFF_SERVER_CAP },
+    [WEATHER_FAILURE_RATE_LIMITED] = { "rate limited",
+                                       BACKOFF_RATE_LIMITED_BASE,
+                                       BACKOFF_RATE_LIMITED_CAP },
+    [WEATHER_FAILURE_PERMANENT] = { "permanent", BACKOFF_PERMANENT_BASE,
+                                    BACKOFF_PERMANENT_CAP },
+};
+
+
+/* classify the status of a request that failed */
+weather_failure
+weather_backoff_classify(guint status)
+{
+    /* 429 Too Many Requests */
+    if (status == 429)
+        return WEATHER_FAILURE_RATE_LIMITED;
+    if (SOUP_STATUS_IS_SERVER_ERROR(status))
+        return WEATHER_FAILURE_SERVER;
+    /* a timeout may well work out next time */
+    if (SOUP_STATUS_IS_CLIENT_ERROR(status) &&
+        status != SOUP_STATUS_REQUEST_TIMEOUT)
+        return WEATHER_FAILURE_PERMANENT;
+    /* transport errors, or a successful status with unusable data */
+    return WEATHER_FAILURE_TRANSIENT;
+}
+
+
+/*
+ * Pick a delay between base and three times the previous delay, but
+ * not more than cap.
+ */
+guint
+weather_backoff_jitter(guint base,
+                       guint cap,
+                       guint previous)
+{
+    guint upper;
+
+    upper = MIN(MAX(previous, base) * 3, cap);
+    if (upper <= base)
+        return MIN(base, cap);
+    return g_random_int_range(base, upper + 1);
+}
+
+
+void
+weather_backoff_failed(weather_backoff *backoff,
+                       guint status,
+                       time_t now_t)
+{
+    weather_failure failure;
+    gboolean open;
+
+    g_assert(backoff != NULL);
+    failure = weather_backoff_classify(status);
+    backoff->failure = failure;
+    backoff->failures++;
+    backoff->delay = weather_backoff_jitter(backoff_policies[failure].base,
+                                            backoff_policies[failure].cap,
+                                            backoff->delay);
+
+    /* a failed probe opens the breaker again */
+    open = (backoff->breaker == WEATHER_BREAKER_HALF_OPEN ||
+            backoff->failures >= BACKOFF_BREAKER_THRESHOLD ||
+            failure == WEATHER_FAILURE_PERMANENT);
+    if (open) {
+        backoff->open_interval =
+            weather_backoff_jitter(BACKOFF_BREAKER_OPEN,
+                                   BACKOFF_BREAKER_MAX_OPEN,
+                                   backoff->open_interval);
+        backoff->open_until = now_t + backoff->open_interval;
+        backoff->breaker = WEATHER_BREAKER_OPEN;
+    }
+    weather_debug("Request failed with status %u (%s), %u failures in a row, "
+                  "retrying in %u seconds, breaker %s.",
+                  status, backoff_policies[failure].name, backoff->failures,
+                  backoff->delay, weather_backoff_breaker_name(backoff));
+}
+
+
+void
+weather_backoff_succeeded(weather_backoff *backoff)
+{
+    g_assert(backoff != NULL);
+    if (backoff->breaker != WEATHER_BREAKER_CLOSED)
+        weather_debug("Request succeeded, closing breaker.");
+    memset(backoff, 0, sizeof(weather_backoff));
+}
+
+
+/*
+ * Check whether a request may be sent now. Once an open breaker
+ * times out, it lets requests through again, but the next failure
+ * opens it right away.
+ */
+gboolean
+weather_backoff_allow(weather_backoff *backoff,
+                      time_t now_t)
+{
+    g_assert(backoff != NULL);
+    switch (backoff->breaker) {
+    case WEATHER_BREAKER_OPEN:
+        if (difftime(backoff->open_until, now_t) > 0)
+            return FALSE;
+        weather_debug("Breaker timed out, probing endpoint.");
+        backoff->breaker = WEATHER_BREAKER_HALF_OPEN;
+        return TRUE;
+    case WEATHER_BREAKER_HALF_OPEN:
+    case WEATHER_BREAKER_CLOSED:
+    default:
+        return TRUE;
+    }
+}
+
+
+/*
+ * Return when to retry after a failure. The backoff delay is limited
+ * by max_delay, the time the breaker stays open is not.
+ */
+time_t
+weather_backoff_next(const weather_backoff *backoff,
+                     time_t now_t,
+                     guint max_delay)
+{
+    time_t next_t;
+
+    g_assert(backoff != NULL);
+    next_t = now_t + MIN(backoff->delay, max_delay);
+    if (backoff->breaker == WEATHER_BREAKER_OPEN &&
+        difftime(backoff->open_until, next_t) > 0)
+        next_t = backoff->open_until;
+    return next_t;
+}
+
+
+const gchar *
+weather_backoff_policy_name(const weather_backoff *backoff)
+{
+    return backoff_policies[backoff->failure].name;
+}
+
+
+const gchar *
+weather_backoff_breaker_name(const weather_backoff *backoff)
+{
+    switch (backoff->breaker) {
+    case WEATHER_BREAKER_OPEN:
+        return "open";
+    case WEATHER_BREAKER_HALF_OPEN:
+        return "half-open";
+    case WEATHER_BREAKER_CLOSED:
+    default:
+        return "closed";
+    }
+}
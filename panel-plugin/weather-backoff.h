@@ -0,0 +1,93 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __WEATHER_BACKOFF_H__
+#define __WEATHER_BACKOFF_H__
+
+#include <glib.h>
+#include <time.h>
+
+G_BEGIN_DECLS
+
+/* first and largest delay of each retry policy, in seconds */
+#define BACKOFF_TRANSIENT_BASE (10)
+#define BACKOFF_TRANSIENT_CAP (10 * 60)
+#define BACKOFF_SERVER_BASE (30)
+#define BACKOFF_SERVER_CAP (30 * 60)
+#define BACKOFF_RATE_LIMITED_BASE (60)
+#define BACKOFF_RATE_LIMITED_CAP (60 * 60)
+#define BACKOFF_PERMANENT_BASE (60 * 60)
+#define BACKOFF_PERMANENT_CAP (6 * 3600)
+
+#define BACKOFF_BREAKER_THRESHOLD (5)   /* failures in a row */
+#define BACKOFF_BREAKER_OPEN (15 * 60)  /* seconds */
+#define BACKOFF_BREAKER_MAX_OPEN (6 * 3600)
+
+/* what went wrong with a request, deciding how long to wait */
+typedef enum {
+    WEATHER_FAILURE_NONE,
+    WEATHER_FAILURE_TRANSIENT,      /* network trouble, broken response */
+    WEATHER_FAILURE_SERVER,         /* 5xx */
+    WEATHER_FAILURE_RATE_LIMITED,   /* 429 */
+    WEATHER_FAILURE_PERMANENT,      /* other 4xx, retrying will not help */
+    WEATHER_FAILURE_NUM
+} weather_failure;
+
+typedef enum {
+    WEATHER_BREAKER_CLOSED,         /* requests are sent as usual */
+    WEATHER_BREAKER_OPEN,           /* no requests until open_until */
+    WEATHER_BREAKER_HALF_OPEN       /* probing whether the endpoint is back */
+} weather_breaker_state;
+
+/* retry state of an endpoint, all zero means no failures */
+typedef struct {
+    weather_failure failure;        /* of the last failed request */
+    guint failures;                 /* in a row */
+    guint delay;                    /* seconds, last backoff delay */
+    weather_breaker_state breaker;
+    guint open_interval;            /* seconds the breaker was opened for */
+    time_t open_until;
+} weather_backoff;
+
+
+weather_failure weather_backoff_classify(guint status);
+
+guint weather_backoff_jitter(guint base,
+                             guint cap,
+                             guint previous);
+
+void weather_backoff_failed(weather_backoff *backoff,
+                            guint status,
+                            time_t now_t);
+
+void weather_backoff_succeeded(weather_backoff *backoff);
+
+gboolean weather_backoff_allow(weather_backoff *backoff,
+                               time_t now_t);
+
+time_t weather_backoff_next(const weather_backoff *backoff,
+                            time_t now_t,
+                            guint max_delay);
+
+const gchar *weather_backoff_policy_name(const weather_backoff *backoff);
+
+const gchar *weather_backoff_breaker_name(const weather_backoff *backoff);
+
+G_END_DECLS
+
+#endif
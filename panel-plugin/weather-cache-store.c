@@ -0,0 +1,747 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Management of the cache directory. Every location has its own cache
+ * files, named after a key. The key is derived from the geohash of the
+ * location, so that places close to each other share a key and the
+ * same place is always found, no matter how the coordinates have been
+ * written. An index file in the directory records when each key has
+ * last been used and how much space its files take.
+ * Whenever cache files have been written, the least recently used
+ * keys are evicted until the total size is below the limit again.
+ * Keys that are in use by another plugin instance are never removed,
+ * that is those with a download lease, or those the other instance
+ * has used within the maximum age of the cache files, even if the
+ * cache stays larger than the limit.
+ *
+ * The index is shared by all plugin instances, so it is merged with
+ * the one on disk on each update. All file operations happen in the
+ * thread writing the cache files, the main thread only records hits
+ * and misses, and takes and releases download leases.
+ *
+ * A download lease is an empty file that tells the other plugin
+ * instances that the data of a key is being downloaded, so that they
+ * can wait for the cache files instead of downloading it too.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "weather-cache-store.h"
+#include "weather-cache.h"
+#include "weather-data.h"
+#include "weather-debug.h"
+
+#define CACHE_STORE_INDEX "weatherdata.index"
+#define CACHE_STORE_PREFIX "weatherdata_"
+#define CACHE_STORE_KEY_LAST_USED "last-used"
+#define CACHE_STORE_KEY_SIZE "size"
+#define CACHE_STORE_KEY_USER "user"
+
+/* at 6 characters a geohash cell is about 1.2 x 0.6 km at the equator */
+#define CACHE_STORE_GEOHASH_LEN 6
+#define CACHE_STORE_LON_BITS ((CACHE_STORE_GEOHASH_LEN * 5 + 1) / 2)
+#define CACHE_STORE_LAT_BITS (CACHE_STORE_GEOHASH_LEN * 5 / 2)
+
+
+typedef struct {
+    gdouble distance;
+    gchar *key;
+} cache_store_cell;
+
+typedef struct {
+    gint64 last_used;
+    guint32 user;                   /* instance that used it last */
+    guint64 size;
+} cache_store_entry;
+
+struct _weather_cache_store {
+    gint ref_count;
+    gchar *dir;
+    gchar *index_file;
+    guint32 id;                     /* identifies this plugin instance */
+
+    /* shared between the threads */
+    GMutex mutex;
+    GHashTable *used;               /* keys used since the last commit */
+    weather_cache_store_stats stats;
+    guint max_age;
+
+    /* only used by the thread writing the cache files */
+    GHashTable *entries;            /* key -> cache_store_entry */
+};
+
+/* files belonging to a key, the first one is the old text cache */
+static const gchar *cache_store_suffixes[] = {
+    "",
+    WEATHER_CACHE_FILE_SUFFIX,
+    WEATHER_CACHE_FILE_SUFFIX WEATHER_CACHE_JOURNAL_SUFFIX,
+    WEATHER_CACHE_ASTRO_SUFFIX,
+    WEATHER_CACHE_LEASE_SUFFIX,
+};
+
+
+static void
+cache_store_geohash(gdouble lat,
+                    gdouble lon,
+                    gchar *hash)
+{
+    static const gchar base32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+    gdouble lat_min = -90, lat_max = 90, lon_min = -180, lon_max = 180;
+    gdouble mid;
+    guint i = 0, bits = 0, ch = 0;
+    gboolean even = TRUE;
+
+    /* the bits alternate between longitude and latitude */
+    while (i < CACHE_STORE_GEOHASH_LEN) {
+        ch <<= 1;
+        if (even) {
+            mid = (lon_min + lon_max) / 2;
+            if (lon >= mid) {
+                ch |= 1;
+                lon_min = mid;
+            } else
+                lon_max = mid;
+        } else {
+            mid = (lat_min + lat_max) / 2;
+            if (lat >= mid) {
+                ch |= 1;
+                lat_min = mid;
+            } else
+                lat_max = mid;
+        }
+        even = !even;
+        if (++bits == 5) {
+            hash[i++] = base32[ch];
+            bits = 0;
+            ch = 0;
+        }
+    }
+    hash[i] = '\0';
+}
+
+
+static cache_store_entry *
+cache_store_get_entry(weather_cache_store *store,
+                      const gchar *key)
+{
+    cache_store_entry *entry;
+
+    entry = g_hash_table_lookup(store->entries, key);
+    if (entry == NULL) {
+        entry = g_slice_new0(cache_store_entry);
+        g_hash_table_insert(store->entries, g_strdup(key), entry);
+    }
+    return entry;
+}
+
+
+static void
+cache_store_entry_free(gpointer entry)
+{
+    g_slice_free(cache_store_entry, entry);
+}
+
+
+/*
+ * Find the key of a file in the cache directory. Files of earlier
+ * versions of the plugin are included, so that they are evicted too.
+ */
+static gchar *
+cache_store_key_from_filename(const gchar *name)
+{
+    gsize len, slen;
+    gint i;
+
+    if (!g_str_has_prefix(name, CACHE_STORE_PREFIX))
+        return NULL;
+
+    len = strlen(name);
+    for (i = G_N_ELEMENTS(cache_store_suffixes) - 1; i > 0; i--) {
+        slen = strlen(cache_store_suffixes[i]);
+        if (len > slen && g_str_has_suffix(name, cache_store_suffixes[i]))
+            return g_strndup(name, len - slen);
+    }
+    return g_strdup(name);
+}
+
+
+/*
+ * Add all cache files in the directory, used if there is no index.
+ * The time of last use is not known, so the modification time of the
+ * files is taken instead.
+ */
+static void
+cache_store_scan(weather_cache_store *store)
+{
+    GDir *dir;
+    GStatBuf st;
+    cache_store_entry *entry;
+    const gchar *name;
+    gchar *key, *file;
+
+    dir = g_dir_open(store->dir, 0, NULL);
+    if (dir == NULL)
+        return;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        key = cache_store_key_from_filename(name);
+        if (key == NULL)
+            continue;
+        entry = cache_store_get_entry(store, key);
+        file = g_build_filename(store->dir, name, NULL);
+        if (g_stat(file, &st) == 0)
+            entry->last_used = MAX(entry->last_used, (gint64) st.st_mtime);
+        g_free(file);
+        g_free(key);
+    }
+    g_dir_close(dir);
+    weather_debug("Found %u keys in cache directory %s.",
+                  g_hash_table_size(store->entries), store->dir);
+}
+
+
+/* merge the index on disk, which other plugin instances may have updated */
+static void
+cache_store_load_index(weather_cache_store *store)
+{
+    GKeyFile *keyfile;
+    gchar **groups;
+    cache_store_entry *entry;
+    gint64 last_used;
+    guint32 user;
+    gsize i, len;
+
+    keyfile = g_key_file_new();
+    if (!g_key_file_load_from_file(keyfile, store->index_file,
+                                   G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(keyfile);
+        cache_store_scan(store);
+        return;
+    }
+
+    groups = g_key_file_get_groups(keyfile, &len);
+    for (i = 0; i < len; i++) {
+        /* keys are file names, never accept anything else */
+        if (!g_str_has_prefix(groups[i], CACHE_STORE_PREFIX) ||
+            strchr(groups[i], G_DIR_SEPARATOR) != NULL)
+            continue;
+        last_used = g_key_file_get_int64(keyfile, groups[i],
+                                         CACHE_STORE_KEY_LAST_USED, NULL);
+        user = (guint32) g_key_file_get_uint64(keyfile, groups[i],
+                                               CACHE_STORE_KEY_USER, NULL);
+        entry = cache_store_get_entry(store, groups[i]);
+        if (last_used > entry->last_used) {
+            entry->last_used = last_used;
+            entry->user = user;
+        }
+    }
+    g_strfreev(groups);
+    g_key_file_free(keyfile);
+}
+
+
+static void
+cache_store_save_index(weather_cache_store *store)
+{
+    GKeyFile *keyfile;
+    GHashTableIter iter;
+    const gchar *key;
+    cache_store_entry *entry;
+    GError *error = NULL;
+
+    keyfile = g_key_file_new();
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &key,
+                                  (gpointer *) &entry)) {
+        g_key_file_set_int64(keyfile, key, CACHE_STORE_KEY_LAST_USED,
+                             entry->last_used);
+        g_key_file_set_uint64(keyfile, key, CACHE_STORE_KEY_USER,
+                              entry->user);
+        g_key_file_set_uint64(keyfile, key, CACHE_STORE_KEY_SIZE,
+                              entry->size);
+    }
+    if (!g_key_file_save_to_file(keyfile, store->index_file, &error)) {
+        g_warning("Error writing cache index %s: %s",
+                  store->index_file, error->message);
+        g_error_free(error);
+    }
+    g_key_file_free(keyfile);
+}
+
+
+/* sum up the size of the files of a key, 0 if there are none left */
+static guint64
+cache_store_stat_key(const weather_cache_store *store,
+                     const gchar *key)
+{
+    GStatBuf st;
+    gchar *file;
+    guint64 size = 0;
+    gboolean found = FALSE;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(cache_store_suffixes); i++) {
+        file = weather_cache_store_get_filename(store, key,
+                                                cache_store_suffixes[i]);
+        if (g_stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+            size += st.st_size;
+            found = TRUE;
+        }
+        g_free(file);
+    }
+    return found ? MAX(size, 1) : 0;
+}
+
+
+/*
+ * Check whether another plugin instance is using the files of a key,
+ * because it holds the download lease or has used them recently. A
+ * lease older than max_age has been abandoned.
+ */
+static gboolean
+cache_store_in_use(const weather_cache_store *store,
+                   const gchar *key,
+                   gint64 now,
+                   guint max_age)
+{
+    const cache_store_entry *entry;
+    GStatBuf st;
+    gchar *file;
+    gboolean leased;
+
+    file = weather_cache_store_get_filename(store, key,
+                                            WEATHER_CACHE_LEASE_SUFFIX);
+    leased = g_stat(file, &st) == 0 && now - st.st_mtime < max_age;
+    g_free(file);
+    if (leased)
+        return TRUE;
+
+    entry = g_hash_table_lookup(store->entries, key);
+    return entry != NULL && entry->user != store->id &&
+        now - entry->last_used < max_age;
+}
+
+
+static void
+cache_store_remove_files(const weather_cache_store *store,
+                         const gchar *key)
+{
+    gchar *file;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(cache_store_suffixes); i++) {
+        file = weather_cache_store_get_filename(store, key,
+                                                cache_store_suffixes[i]);
+        g_unlink(file);
+        g_free(file);
+    }
+}
+
+
+/*
+ * Remove all files of a key, unless another plugin instance is still
+ * using them. This does file I/O and is meant to be called from the
+ * thread writing the cache files.
+ */
+void
+weather_cache_store_remove(weather_cache_store *store,
+                           const gchar *key)
+{
+    guint max_age;
+
+    g_assert(store != NULL && key != NULL);
+    g_mutex_lock(&store->mutex);
+    max_age = store->max_age;
+    g_mutex_unlock(&store->mutex);
+
+    cache_store_load_index(store);
+    if (cache_store_in_use(store, key, g_get_real_time() / G_USEC_PER_SEC,
+                           max_age)) {
+        weather_debug("Keeping cache files of key %s, which another "
+                      "plugin instance is using.", key);
+        return;
+    }
+    cache_store_remove_files(store, key);
+}
+
+
+static gboolean
+cache_store_create_lease(const gchar *file)
+{
+    gint fd;
+
+    fd = g_open(file, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return FALSE;
+    g_close(fd, NULL);
+    return TRUE;
+}
+
+
+/*
+ * Take the download lease of a key. Returns FALSE if another plugin
+ * instance holds it, a lease older than max_age seconds has been
+ * abandoned though. If the lease file cannot be created for another
+ * reason, there is nothing to coordinate with and TRUE is returned.
+ */
+gboolean
+weather_cache_store_take_lease(const weather_cache_store *store,
+                               const gchar *key,
+                               guint max_age)
+{
+    GStatBuf st;
+    gchar *file;
+    gboolean taken = TRUE;
+
+    g_assert(store != NULL && key != NULL);
+    file = weather_cache_store_get_filename(store, key,
+                                            WEATHER_CACHE_LEASE_SUFFIX);
+    if (!cache_store_create_lease(file) && errno == EEXIST) {
+        if (g_stat(file, &st) == 0 &&
+            difftime(time(NULL), st.st_mtime) < max_age)
+            taken = FALSE;
+        else {
+            weather_debug("Removing abandoned lease of cache key %s.", key);
+            g_unlink(file);
+            /* another instance may have been faster */
+            if (!cache_store_create_lease(file) && errno == EEXIST)
+                taken = FALSE;
+        }
+    }
+    g_free(file);
+    return taken;
+}
+
+
+/*
+ * Tell other plugin instances that the lease is still in use, so that
+ * it is not taken as abandoned while a download takes long.
+ */
+void
+weather_cache_store_refresh_lease(const weather_cache_store *store,
+                                  const gchar *key)
+{
+    gchar *file;
+
+    g_assert(store != NULL && key != NULL);
+    file = weather_cache_store_get_filename(store, key,
+                                            WEATHER_CACHE_LEASE_SUFFIX);
+    if (g_utime(file, NULL) != 0)
+        weather_debug("Could not refresh the lease of cache key %s: %s",
+                      key, g_strerror(errno));
+    g_free(file);
+}
+
+
+void
+weather_cache_store_release_lease(const weather_cache_store *store,
+                                  const gchar *key)
+{
+    gchar *file;
+
+    g_assert(store != NULL && key != NULL);
+    file = weather_cache_store_get_filename(store, key,
+                                            WEATHER_CACHE_LEASE_SUFFIX);
+    g_unlink(file);
+    g_free(file);
+}
+
+
+weather_cache_store *
+weather_cache_store_new(const gchar *dir,
+                        guint64 max_size)
+{
+    weather_cache_store *store;
+
+    g_assert(dir != NULL);
+    store = g_slice_new0(weather_cache_store);
+    store->ref_count = 1;
+    store->dir = g_strdup(dir);
+    store->index_file = g_build_filename(dir, CACHE_STORE_INDEX, NULL);
+    store->id = g_random_int();
+    g_mutex_init(&store->mutex);
+    store->used = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    store->entries = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                           g_free, cache_store_entry_free);
+    store->stats.max_size = max_size;
+    return store;
+}
+
+
+gchar *
+weather_cache_store_make_key(gdouble lat,
+                             gdouble lon)
+{
+    gchar hash[CACHE_STORE_GEOHASH_LEN + 1];
+
+    cache_store_geohash(lat, lon, hash);
+    return g_strconcat(CACHE_STORE_PREFIX, hash, NULL);
+}
+
+
+static gint
+cache_store_cell_compare(gconstpointer a,
+                         gconstpointer b)
+{
+    const cache_store_cell *ca = a, *cb = b;
+
+    return (ca->distance > cb->distance) - (ca->distance < cb->distance);
+}
+
+
+/*
+ * Return the keys of all cells that are at most max_distance meters
+ * away from the location, nearest first, as the data of a place within
+ * reach might be stored in any of them. The number of cells to look at
+ * in each direction follows from the size of a cell at the latitude of
+ * the location.
+ */
+gchar **
+weather_cache_store_get_nearby_keys(gdouble lat,
+                                    gdouble lon,
+                                    guint max_distance)
+{
+    const gint num_lat = 1 << CACHE_STORE_LAT_BITS;
+    const gint num_lon = 1 << CACHE_STORE_LON_BITS;
+    const gdouble dlat = 180.0 / num_lat;
+    const gdouble dlon = 360.0 / num_lon;
+    GArray *cells;
+    GPtrArray *keys;
+    cache_store_cell cell;
+    gdouble cell_height, cell_width, lat_min, lon_min;
+    gint ilat, ilon, rlat, rlon, i, j;
+    guint k;
+
+    lat = CLAMP(lat, -90, 90);
+    ilat = MIN((gint) floor((lat + 90) / dlat), num_lat - 1);
+    ilon = (gint) floor((lon + 180) / dlon);
+
+    /* cells get narrower towards the poles, where all of them may be
+       within reach, but each must only be found once */
+    cell_height = calc_distance(0, 0, dlat, 0);
+    cell_width = calc_distance(lat, 0, lat, dlon);
+    rlat = (gint) ceil(max_distance / cell_height);
+    rlon = (num_lon - 1) / 2;
+    if (cell_width > 0 && max_distance / cell_width < rlon)
+        rlon = (gint) ceil(max_distance / cell_width);
+
+    cells = g_array_new(FALSE, FALSE, sizeof(cache_store_cell));
+    for (i = MAX(ilat - rlat, 0); i <= MIN(ilat + rlat, num_lat - 1); i++)
+        for (j = ilon - rlon; j <= ilon + rlon; j++) {
+            /* the point of the cell that is nearest to the location */
+            lat_min = -90 + i * dlat;
+            lon_min = -180 + j * dlon;
+            cell.distance = calc_distance(lat, lon,
+                                          CLAMP(lat, lat_min, lat_min + dlat),
+                                          CLAMP(lon, lon_min, lon_min + dlon));
+            if (cell.distance > max_distance)
+                continue;
+            lon_min = fmod(lon_min + 540, 360) - 180;
+            cell.key = weather_cache_store_make_key(lat_min + dlat / 2,
+                                                    lon_min + dlon / 2);
+            g_array_append_val(cells, cell);
+        }
+    g_array_sort(cells, cache_store_cell_compare);
+
+    keys = g_ptr_array_sized_new(cells->len + 1);
+    for (k = 0; k < cells->len; k++)
+        g_ptr_array_add(keys, g_array_index(cells, cache_store_cell, k).key);
+    g_ptr_array_add(keys, NULL);
+    g_array_free(cells, TRUE);
+    return (gchar **) g_ptr_array_free(keys, FALSE);
+}
+
+
+gchar *
+weather_cache_store_get_filename(const weather_cache_store *store,
+                                 const gchar *key,
+                                 const gchar *suffix)
+{
+    g_assert(store != NULL && key != NULL);
+    return g_strconcat(store->dir, G_DIR_SEPARATOR_S, key, suffix, NULL);
+}
+
+
+/* a maximum size of 0 means no limit */
+void
+weather_cache_store_set_max_size(weather_cache_store *store,
+                                 guint64 max_size)
+{
+    g_assert(store != NULL);
+    g_mutex_lock(&store->mutex);
+    store->stats.max_size = max_size;
+    g_mutex_unlock(&store->mutex);
+}
+
+
+/* keys another instance has used within max_age seconds are kept */
+void
+weather_cache_store_set_max_age(weather_cache_store *store,
+                                guint max_age)
+{
+    g_assert(store != NULL);
+    g_mutex_lock(&store->mutex);
+    store->max_age = max_age;
+    g_mutex_unlock(&store->mutex);
+}
+
+
+void
+weather_cache_store_hit(weather_cache_store *store,
+                        const gchar *key)
+{
+    g_assert(store != NULL && key != NULL);
+    g_mutex_lock(&store->mutex);
+    store->stats.hits++;
+    g_hash_table_add(store->used, g_strdup(key));
+    g_mutex_unlock(&store->mutex);
+}
+
+
+void
+weather_cache_store_miss(weather_cache_store *store)
+{
+    g_assert(store != NULL);
+    g_mutex_lock(&store->mutex);
+    store->stats.misses++;
+    g_mutex_unlock(&store->mutex);
+}
+
+
+/*
+ * Record that the cache files of the key have just been written,
+ * update the index and evict the least recently used keys if the
+ * cache has grown too large. This does file I/O and is meant to be
+ * called from the thread writing the cache files.
+ */
+void
+weather_cache_store_commit(weather_cache_store *store,
+                           const gchar *key)
+{
+    GHashTableIter iter;
+    GHashTable *used;
+    cache_store_entry *entry, *oldest;
+    const gchar *k, *oldest_key;
+    guint64 max_size, total = 0;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+    guint max_age, evictions = 0;
+
+    g_assert(store != NULL && key != NULL);
+
+    g_mutex_lock(&store->mutex);
+    used = store->used;
+    store->used = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                        g_free, NULL);
+    max_size = store->stats.max_size;
+    max_age = store->max_age;
+    g_mutex_unlock(&store->mutex);
+
+    cache_store_load_index(store);
+    g_hash_table_add(used, g_strdup(key));
+    g_hash_table_iter_init(&iter, used);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &k, NULL)) {
+        entry = cache_store_get_entry(store, k);
+        entry->last_used = now;
+        entry->user = store->id;
+    }
+    g_hash_table_destroy(used);
+
+    /* forget keys whose files have been removed in the meantime */
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &k,
+                                  (gpointer *) &entry)) {
+        entry->size = cache_store_stat_key(store, k);
+        if (entry->size == 0)
+            g_hash_table_iter_remove(&iter);
+        else
+            total += entry->size;
+    }
+
+    while (max_size > 0 && total > max_size) {
+        oldest = NULL;
+        oldest_key = NULL;
+        g_hash_table_iter_init(&iter, store->entries);
+        while (g_hash_table_iter_next(&iter, (gpointer *) &k,
+                                      (gpointer *) &entry))
+            if (strcmp(k, key) != 0 &&
+                (oldest == NULL || entry->last_used < oldest->last_used) &&
+                !cache_store_in_use(store, k, now, max_age)) {
+                oldest = entry;
+                oldest_key = k;
+            }
+        if (oldest == NULL)
+            break;
+
+        weather_debug("Evicting cache key %s (%lu bytes).",
+                      oldest_key, (gulong) oldest->size);
+        total -= oldest->size;
+        cache_store_remove_files(store, oldest_key);
+        g_hash_table_remove(store->entries, oldest_key);
+        evictions++;
+    }
+
+    cache_store_save_index(store);
+
+    g_mutex_lock(&store->mutex);
+    store->stats.evictions += evictions;
+    store->stats.entries = g_hash_table_size(store->entries);
+    store->stats.size = total;
+    g_mutex_unlock(&store->mutex);
+}
+
+
+void
+weather_cache_store_get_stats(weather_cache_store *store,
+                              weather_cache_store_stats *stats)
+{
+    g_assert(store != NULL && stats != NULL);
+    g_mutex_lock(&store->mutex);
+    *stats = store->stats;
+    g_mutex_unlock(&store->mutex);
+}
+
+
+/* workers checking for shared data keep the store alive */
+weather_cache_store *
+weather_cache_store_ref(weather_cache_store *store)
+{
+    g_assert(store != NULL);
+    g_atomic_int_inc(&store->ref_count);
+    return store;
+}
+
+
+void
+weather_cache_store_unref(weather_cache_store *store)
+{
+    if (G_UNLIKELY(store == NULL))
+        return;
+    if (!g_atomic_int_dec_and_test(&store->ref_count))
+        return;
+    g_hash_table_destroy(store->used);
+    g_hash_table_destroy(store->entries);
+    g_mutex_clear(&store->mutex);
+    g_free(store->index_file);
+    g_free(store->dir);
+    g_slice_free(weather_cache_store, store);
+}
@@ -0,0 +1,88 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __WEATHER_CACHE_STORE_H__
+#define __WEATHER_CACHE_STORE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _weather_cache_store weather_cache_store;
+
+typedef struct {
+    guint hits;
+    guint misses;
+    guint evictions;
+    guint entries;
+    guint64 size;
+    guint64 max_size;
+} weather_cache_store_stats;
+
+
+weather_cache_store *weather_cache_store_new(const gchar *dir,
+                                             guint64 max_size);
+
+gchar *weather_cache_store_make_key(gdouble lat,
+                                    gdouble lon);
+
+gchar **weather_cache_store_get_nearby_keys(gdouble lat,
+                                            gdouble lon,
+                                            guint max_distance);
+
+gchar *weather_cache_store_get_filename(const weather_cache_store *store,
+                                        const gchar *key,
+                                        const gchar *suffix);
+
+void weather_cache_store_set_max_size(weather_cache_store *store,
+                                      guint64 max_size);
+
+void weather_cache_store_set_max_age(weather_cache_store *store,
+                                     guint max_age);
+
+void weather_cache_store_hit(weather_cache_store *store,
+                             const gchar *key);
+
+void weather_cache_store_miss(weather_cache_store *store);
+
+void weather_cache_store_remove(weather_cache_store *store,
+                                const gchar *key);
+
+void weather_cache_store_commit(weather_cache_store *store,
+                                const gchar *key);
+
+gboolean weather_cache_store_take_lease(const weather_cache_store *store,
+                                        const gchar *key,
+                                        guint max_age);
+
+void weather_cache_store_refresh_lease(const weather_cache_store *store,
+                                       const gchar *key);
+
+void weather_cache_store_release_lease(const weather_cache_store *store,
+                                       const gchar *key);
+
+void weather_cache_store_get_stats(weather_cache_store *store,
+                                   weather_cache_store_stats *stats);
+
+weather_cache_store *weather_cache_store_ref(weather_cache_store *store);
+
+void weather_cache_store_unref(weather_cache_store *store);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1660 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Binary cache file format. The file is a fixed size header followed
+ * by the timeslice records, the astrodata records and a block of
+ * NUL-terminated strings, which are referenced by their offset. All
+ * values are stored in host byte order, as the cache is local to the
+ * machine, and records are 8 byte aligned so that they can be used
+ * right from the mapped file.
+ *
+ * The header holds two checksums: one of the header itself and the
+ * strings, which is verified when the file is opened, and one of the
+ * records, which is only verified when the records are first needed.
+ * Opening a cache file to look at its download times or location thus
+ * does not read the records at all.
+ *
+ * Changes made after the cache file has been written are appended to
+ * a journal file next to it, so that writes are proportional to what
+ * has changed. The journal is a header naming the checksum of the
+ * cache file it belongs to, followed by records that each add, replace
+ * or remove a single timeslice or astrodata entry, or update the
+ * download times. A record that was not written completely ends the
+ * journal. When the journal has grown larger than the cache file, both
+ * are compacted into a new cache file.
+ *
+ * Plugin instances showing the same place share the cache files. The
+ * journal header also holds a random generation chosen by the writer
+ * that compacted it, and a writer only appends to a journal carrying
+ * its own generation, as its changes are relative to what it wrote
+ * itself. If another instance has compacted the files in the meantime,
+ * the next write compacts them again instead.
+ *
+ * Astrodata of a day never changes, so it is also kept in an astro
+ * store next to the cache file. This is a key file with a group for
+ * each date, which is kept regardless of the age of the cache file
+ * and only loses days that have passed.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "weather-cache.h"
+#include "weather-data.h"
+#include "weather-translate.h"
+#include "weather-debug.h"
+
+#define CACHE_MAGIC "XFWCACHE"
+#define CACHE_MAGIC_LEN 8
+#define CACHE_VERSION 4
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_NO_STRING G_MAXUINT32
+#define CACHE_CHECKSUM_INIT 2166136261U
+
+#define CACHE_NUM_VALUES 16             /* the last one is spare */
+#define CACHE_SYMBOL_VALID (1U << 31)
+
+#define CACHE_SUN_NEVER_RISES (1 << 0)
+#define CACHE_SUN_NEVER_SETS (1 << 1)
+#define CACHE_MOON_NEVER_RISES (1 << 2)
+#define CACHE_MOON_NEVER_SETS (1 << 3)
+
+#define CACHE_JOURNAL_MAGIC "XFWJRNL"
+#define CACHE_JOURNAL_PAD(len) (((len) + 7) & ~((gsize) 7))
+
+/* prefixes of the keys identifying records when looking for changes */
+#define CACHE_KEY_TIMESLICE 't'
+#define CACHE_KEY_ASTRO 'a'
+
+#define ASTRO_STORE_DATE_FORMAT "%Y-%m-%d"
+
+enum {
+    CACHE_JOURNAL_INFO = 1,
+    CACHE_JOURNAL_TIMESLICE,
+    CACHE_JOURNAL_TIMESLICE_EXPIRED,
+    CACHE_JOURNAL_ASTRO,
+    CACHE_JOURNAL_ASTRO_EXPIRED
+};
+
+
+typedef struct {
+    gchar magic[CACHE_MAGIC_LEN];
+    guint32 byte_order;
+    guint32 version;
+    guint32 checksum;               /* of the header and the strings */
+    guint32 num_timeslices;
+    guint32 num_astro;
+    guint32 strings_len;
+    gint32 msl;
+    guint32 location_name;          /* string offsets */
+    guint32 lat;
+    guint32 lon;
+    guint32 offset;
+    guint32 etag;
+    guint32 last_modified;
+    guint32 records_checksum;       /* of the timeslices and astrodata */
+    gint64 cache_date;
+    gint64 last_weather_download;
+    gint64 last_astro_download;
+    gint64 weather_expires;
+} cache_header;
+
+typedef struct {
+    gint64 start;
+    gint64 end;
+    gint64 point;
+    gdouble values[CACHE_NUM_VALUES];
+    guint32 valid;                  /* bit i is set if values[i] is valid */
+    gint32 symbol_id;
+} cache_timeslice;
+
+typedef struct {
+    gint64 day;
+    gint64 sunrise;
+    gint64 sunset;
+    gint64 moonrise;
+    gint64 moonset;
+    gdouble solarnoon_elevation;
+    gdouble solarmidnight_elevation;
+    guint32 flags;
+    guint32 moon_phase;             /* string offset */
+} cache_astro;
+
+typedef struct {
+    gchar magic[CACHE_MAGIC_LEN];
+    guint32 byte_order;
+    guint32 version;
+    guint32 base_checksum;          /* of the cache file it belongs to */
+    guint32 generation;             /* chosen by the compacting writer */
+} cache_journal_header;
+
+typedef struct {
+    guint32 type;
+    guint32 len;                    /* of the payload, without padding */
+    guint32 checksum;               /* of the payload */
+    guint32 reserved;
+} cache_journal_record;
+
+/* followed by the ETag and Last-Modified strings, empty if unset */
+typedef struct {
+    gint64 cache_date;
+    gint64 last_weather_download;
+    gint64 last_astro_download;
+    gint64 weather_expires;
+} cache_journal_info;
+
+struct _weather_cache_writer {
+    /* shared with the worker thread */
+    GMutex mutex;
+    GCond cond;
+    weather_cache_store *store;
+    gchar *key;                     /* pending write, if journal is set */
+    gchar *obsolete_key;
+    GBytes *contents;               /* new cache file, NULL to append */
+    GByteArray *journal;
+    GKeyFile *astro_records;        /* days to add to the astro store */
+    guint32 base_checksum;          /* of the journal appended to */
+    guint32 generation;
+    gboolean running;
+    gboolean failed;
+
+    /* what has been written, only used in the main thread */
+    gchar *written_key;
+    gchar *written_name;
+    gchar *written_lat;
+    gchar *written_lon;
+    gchar *written_offset;
+    gint written_msl;
+    GHashTable *written;            /* record key -> record payload */
+    gsize base_len;
+    gsize journal_len;
+};
+
+struct _weather_cache {
+    GMappedFile *mapped;
+    const cache_header *header;
+    const cache_timeslice *timeslices;
+    guint num_timeslices;
+    const cache_astro *astro;
+    guint num_astro;
+    const gchar *strings;
+    gsize strings_len;
+    weather_cache_info info;
+
+    /* records of the mapped file, checked when they are first needed */
+    const guint8 *records;
+    gsize records_len;
+    gboolean records_checked;
+    gboolean records_valid;
+
+    /* records and strings with the journal applied */
+    GArray *journal_timeslices;
+    GArray *journal_astro;
+    GString *journal_strings;
+    gchar *journal_etag;
+    gchar *journal_last_modified;
+
+    /* positions of the records above + 1, only set during the replay */
+    GHashTable *timeslice_index;    /* (start, end) -> position + 1 */
+    GHashTable *astro_index;        /* day -> position + 1 */
+};
+
+G_STATIC_ASSERT(sizeof(cache_header) % 8 == 0);
+G_STATIC_ASSERT(sizeof(cache_timeslice) % 8 == 0);
+G_STATIC_ASSERT(sizeof(cache_astro) % 8 == 0);
+G_STATIC_ASSERT(sizeof(cache_journal_header) % 8 == 0);
+G_STATIC_ASSERT(sizeof(cache_journal_record) % 8 == 0);
+G_STATIC_ASSERT(CLOUDS_PERC_NUM == 4);
+
+/* location values in the order they are stored in the records */
+static const gsize cache_value_offsets[] = {
+    G_STRUCT_OFFSET(xml_location, altitude),
+    G_STRUCT_OFFSET(xml_location, latitude),
+    G_STRUCT_OFFSET(xml_location, longitude),
+    G_STRUCT_OFFSET(xml_location, temperature),
+    G_STRUCT_OFFSET(xml_location, wind_dir_deg),
+    G_STRUCT_OFFSET(xml_location, wind_speed_mps),
+    G_STRUCT_OFFSET(xml_location, wind_speed_beaufort),
+    G_STRUCT_OFFSET(xml_location, humidity),
+    G_STRUCT_OFFSET(xml_location, pressure),
+    G_STRUCT_OFFSET(xml_location, clouds_percent) +
+    CLOUDS_PERC_LOW * sizeof(xml_value),
+    G_STRUCT_OFFSET(xml_location, clouds_percent) +
+    CLOUDS_PERC_MID * sizeof(xml_value),
+    G_STRUCT_OFFSET(xml_location, clouds_percent) +
+    CLOUDS_PERC_HIGH * sizeof(xml_value),
+    G_STRUCT_OFFSET(xml_location, clouds_percent) +
+    CLOUDS_PERC_CLOUDINESS * sizeof(xml_value),
+    G_STRUCT_OFFSET(xml_location, fog_percent),
+    G_STRUCT_OFFSET(xml_location, precipitation),
+};
+
+G_STATIC_ASSERT(G_N_ELEMENTS(cache_value_offsets) <= CACHE_NUM_VALUES);
+
+#define CACHE_VALUE(loc, i)                                     \
+    ((xml_value *) G_STRUCT_MEMBER_P(loc, cache_value_offsets[i]))
+
+
+/* FNV-1a hash, good enough to detect truncated or damaged files */
+static guint32
+cache_checksum_update(guint32 hash,
+                      const guint8 *data,
+                      gsize len)
+{
+    gsize i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+static guint32
+cache_checksum(const guint8 *data,
+               gsize len)
+{
+    return cache_checksum_update(CACHE_CHECKSUM_INIT, data, len);
+}
+
+
+/* checksum of the header, with the checksum field cleared, and strings */
+static guint32
+cache_header_checksum(const cache_header *header,
+                      const gchar *strings)
+{
+    cache_header copy;
+
+    memcpy(&copy, header, sizeof(copy));
+    copy.checksum = 0;
+    return cache_checksum_update(cache_checksum((const guint8 *) &copy,
+                                                sizeof(copy)),
+                                 (const guint8 *) strings,
+                                 header->strings_len);
+}
+
+
+static const gchar *
+cache_get_string(const weather_cache *cache,
+                 guint32 offset)
+{
+    if (offset == CACHE_NO_STRING || offset >= cache->strings_len)
+        return NULL;
+    return cache->strings + offset;
+}
+
+
+static gchar *
+cache_journal_filename(const gchar *filename)
+{
+    return g_strconcat(filename, WEATHER_CACHE_JOURNAL_SUFFIX, NULL);
+}
+
+
+static guint
+cache_interval_hash(gconstpointer key)
+{
+    const gint64 *interval = key;
+
+    return (guint) interval[0] * 2654435761u ^ (guint) interval[1];
+}
+
+
+static gboolean
+cache_interval_equal(gconstpointer a,
+                     gconstpointer b)
+{
+    const gint64 *interval1 = a, *interval2 = b;
+
+    return interval1[0] == interval2[0] && interval1[1] == interval2[1];
+}
+
+
+static void
+cache_index_timeslice(weather_cache *cache,
+                      guint i)
+{
+    const cache_timeslice *rec;
+    gint64 *key;
+
+    rec = &g_array_index(cache->journal_timeslices, cache_timeslice, i);
+    key = g_new(gint64, 2);
+    key[0] = rec->start;
+    key[1] = rec->end;
+    g_hash_table_replace(cache->timeslice_index, key, GUINT_TO_POINTER(i + 1));
+}
+
+
+static void
+cache_index_astro(weather_cache *cache,
+                  guint i)
+{
+    gint64 *key;
+
+    key = g_new(gint64, 1);
+    *key = g_array_index(cache->journal_astro, cache_astro, i).day;
+    g_hash_table_replace(cache->astro_index, key, GUINT_TO_POINTER(i + 1));
+}
+
+
+static gint
+cache_find_timeslice(weather_cache *cache,
+                     gint64 start,
+                     gint64 end)
+{
+    gint64 key[2];
+
+    key[0] = start;
+    key[1] = end;
+    return (gint) GPOINTER_TO_UINT(g_hash_table_lookup(cache->timeslice_index,
+                                                       key)) - 1;
+}
+
+
+static gint
+cache_find_astro(weather_cache *cache,
+                 gint64 day)
+{
+    return (gint) GPOINTER_TO_UINT(g_hash_table_lookup(cache->astro_index,
+                                                       &day)) - 1;
+}
+
+
+/* the last record takes the place of the removed one */
+static void
+cache_remove_timeslice(weather_cache *cache,
+                       guint i)
+{
+    const cache_timeslice *rec;
+    gint64 key[2];
+
+    rec = &g_array_index(cache->journal_timeslices, cache_timeslice, i);
+    key[0] = rec->start;
+    key[1] = rec->end;
+    g_hash_table_remove(cache->timeslice_index, key);
+    g_array_remove_index_fast(cache->journal_timeslices, i);
+    if (i < cache->journal_timeslices->len)
+        cache_index_timeslice(cache, i);
+}
+
+
+static void
+cache_remove_astro(weather_cache *cache,
+                   guint i)
+{
+    gint64 day;
+
+    day = g_array_index(cache->journal_astro, cache_astro, i).day;
+    g_hash_table_remove(cache->astro_index, &day);
+    g_array_remove_index_fast(cache->journal_astro, i);
+    if (i < cache->journal_astro->len)
+        cache_index_astro(cache, i);
+}
+
+
+static gboolean
+cache_apply_record(weather_cache *cache,
+                   guint32 type,
+                   const guint8 *payload,
+                   gsize len)
+{
+    cache_journal_info info;
+    cache_timeslice rec;
+    cache_astro arec;
+    const gchar *etag, *last_modified;
+    gint64 key[2];
+    gint i;
+
+    switch (type) {
+    case CACHE_JOURNAL_INFO:
+        if (len < sizeof(info) + 2 || payload[len - 1] != '\0')
+            return FALSE;
+        memcpy(&info, payload, sizeof(info));
+        etag = (const gchar *) payload + sizeof(info);
+        last_modified = etag + strlen(etag) + 1;
+        if ((const guint8 *) last_modified >= payload + len)
+            return FALSE;
+        cache->info.cache_date = (time_t) info.cache_date;
+        cache->info.last_weather_download =
+            (time_t) info.last_weather_download;
+        cache->info.last_astro_download = (time_t) info.last_astro_download;
+        cache->info.weather_expires = (time_t) info.weather_expires;
+        g_free(cache->journal_etag);
+        g_free(cache->journal_last_modified);
+        cache->journal_etag = *etag ? g_strdup(etag) : NULL;
+        cache->journal_last_modified =
+            *last_modified ? g_strdup(last_modified) : NULL;
+        cache->info.etag = cache->journal_etag;
+        cache->info.last_modified = cache->journal_last_modified;
+        return TRUE;
+
+    case CACHE_JOURNAL_TIMESLICE:
+        if (len != sizeof(rec))
+            return FALSE;
+        memcpy(&rec, payload, len);
+        i = cache_find_timeslice(cache, rec.start, rec.end);
+        if (i >= 0)
+            g_array_index(cache->journal_timeslices, cache_timeslice, i) = rec;
+        else {
+            g_array_append_val(cache->journal_timeslices, rec);
+            cache_index_timeslice(cache, cache->journal_timeslices->len - 1);
+        }
+        return TRUE;
+
+    case CACHE_JOURNAL_TIMESLICE_EXPIRED:
+        if (len != sizeof(key))
+            return FALSE;
+        memcpy(key, payload, len);
+        i = cache_find_timeslice(cache, key[0], key[1]);
+        if (i >= 0)
+            cache_remove_timeslice(cache, i);
+        return TRUE;
+
+    case CACHE_JOURNAL_ASTRO:
+        if (len < sizeof(arec))
+            return FALSE;
+        memcpy(&arec, payload, sizeof(arec));
+        /* the moon phase string follows the record */
+        if (arec.moon_phase != CACHE_NO_STRING) {
+            if (len == sizeof(arec) || payload[len - 1] != '\0')
+                return FALSE;
+            arec.moon_phase = cache->journal_strings->len;
+            g_string_append_len(cache->journal_strings,
+                                (const gchar *) payload + sizeof(arec),
+                                len - sizeof(arec));
+        }
+        i = cache_find_astro(cache, arec.day);
+        if (i >= 0)
+            g_array_index(cache->journal_astro, cache_astro, i) = arec;
+        else {
+            g_array_append_val(cache->journal_astro, arec);
+            cache_index_astro(cache, cache->journal_astro->len - 1);
+        }
+        return TRUE;
+
+    case CACHE_JOURNAL_ASTRO_EXPIRED:
+        if (len != sizeof(key[0]))
+            return FALSE;
+        memcpy(key, payload, len);
+        i = cache_find_astro(cache, key[0]);
+        if (i >= 0)
+            cache_remove_astro(cache, i);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+
+/*
+ * Apply the journal belonging to the cache file, if there is one. The
+ * records are copied out of the mapped file for this, as they change.
+ */
+static void
+cache_replay_journal(weather_cache *cache,
+                     const gchar *filename)
+{
+    cache_journal_header header;
+    cache_journal_record rec;
+    gchar *journal, *contents;
+    const guint8 *payload;
+    gsize len, pos;
+    guint i, count = 0;
+
+    journal = cache_journal_filename(filename);
+    if (!g_file_get_contents(journal, &contents, &len, NULL)) {
+        g_free(journal);
+        return;
+    }
+
+    if (len < sizeof(header)) {
+        weather_debug("Journal %s is damaged, ignoring it.", journal);
+        g_free(contents);
+        g_free(journal);
+        return;
+    }
+    memcpy(&header, contents, sizeof(header));
+    if (memcmp(header.magic, CACHE_JOURNAL_MAGIC, CACHE_MAGIC_LEN) != 0 ||
+        header.byte_order != CACHE_BYTE_ORDER ||
+        header.version != CACHE_VERSION ||
+        header.base_checksum != cache->header->checksum) {
+        weather_debug("Journal %s does not belong to the cache file, "
+                      "ignoring it.", journal);
+        g_free(contents);
+        g_free(journal);
+        return;
+    }
+
+    cache->journal_timeslices =
+        g_array_sized_new(FALSE, FALSE, sizeof(cache_timeslice),
+                          cache->num_timeslices + 16);
+    g_array_append_vals(cache->journal_timeslices, cache->timeslices,
+                        cache->num_timeslices);
+    cache->journal_astro =
+        g_array_sized_new(FALSE, FALSE, sizeof(cache_astro),
+                          cache->num_astro + 4);
+    g_array_append_vals(cache->journal_astro, cache->astro, cache->num_astro);
+    cache->journal_strings = g_string_new_len(cache->strings,
+                                              cache->strings_len);
+
+    /* records are looked up by their interval or day while replaying */
+    cache->timeslice_index =
+        g_hash_table_new_full(cache_interval_hash, cache_interval_equal,
+                              g_free, NULL);
+    for (i = 0; i < cache->journal_timeslices->len; i++)
+        cache_index_timeslice(cache, i);
+    cache->astro_index =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    for (i = 0; i < cache->journal_astro->len; i++)
+        cache_index_astro(cache, i);
+
+    for (pos = sizeof(header); pos + sizeof(rec) <= len;
+         pos += sizeof(rec) + CACHE_JOURNAL_PAD(rec.len)) {
+        memcpy(&rec, contents + pos, sizeof(rec));
+        payload = (const guint8 *) contents + pos + sizeof(rec);
+        if (rec.len > len - pos - sizeof(rec) ||
+            cache_checksum(payload, rec.len) != rec.checksum ||
+            !cache_apply_record(cache, rec.type, payload, rec.len)) {
+            weather_debug("Journal %s ends with an incomplete record at "
+                          "offset %lu.", journal, (gulong) pos);
+            break;
+        }
+        count++;
+    }
+
+    cache->timeslices =
+        (const cache_timeslice *) cache->journal_timeslices->data;
+    cache->num_timeslices = cache->journal_timeslices->len;
+    cache->astro = (const cache_astro *) cache->journal_astro->data;
+    cache->num_astro = cache->journal_astro->len;
+    cache->strings = cache->journal_strings->str;
+    cache->strings_len = cache->journal_strings->len;
+    g_hash_table_destroy(cache->timeslice_index);
+    g_hash_table_destroy(cache->astro_index);
+    cache->timeslice_index = NULL;
+    cache->astro_index = NULL;
+    weather_debug("Applied %u records from journal %s.", count, journal);
+    g_free(contents);
+    g_free(journal);
+}
+
+
+/*
+ * Map a cache file and check that it is complete and that its header
+ * and strings are undamaged. The size of the file is known from the
+ * header, so the records are not looked at until they are loaded.
+ */
+weather_cache *
+weather_cache_open(const gchar *filename)
+{
+    weather_cache *cache;
+    GMappedFile *mapped;
+    GError *error = NULL;
+    const cache_header *header;
+    const gchar *contents;
+    guint64 expected;
+    gsize len;
+
+    mapped = g_mapped_file_new(filename, FALSE, &error);
+    if (mapped == NULL) {
+        weather_debug("Could not map cache file %s: %s",
+                      filename, error->message);
+        g_error_free(error);
+        return NULL;
+    }
+
+    contents = g_mapped_file_get_contents(mapped);
+    len = g_mapped_file_get_length(mapped);
+    header = (const cache_header *) contents;
+    if (len < sizeof(cache_header) ||
+        memcmp(header->magic, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0 ||
+        header->byte_order != CACHE_BYTE_ORDER ||
+        header->version != CACHE_VERSION) {
+        weather_debug("Cache file %s has an unknown format.", filename);
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+
+    expected = sizeof(cache_header)
+        + (guint64) header->num_timeslices * sizeof(cache_timeslice)
+        + (guint64) header->num_astro * sizeof(cache_astro)
+        + header->strings_len;
+    if (expected != len || header->strings_len == 0 ||
+        contents[len - 1] != '\0' ||
+        cache_header_checksum(header, contents + len - header->strings_len)
+        != header->checksum) {
+        weather_debug("Cache file %s is damaged.", filename);
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+
+    cache = g_slice_new0(weather_cache);
+    cache->mapped = mapped;
+    cache->header = header;
+    cache->timeslices =
+        (const cache_timeslice *) (contents + sizeof(cache_header));
+    cache->astro =
+        (const cache_astro *) (cache->timeslices + header->num_timeslices);
+    cache->strings = (const gchar *) (cache->astro + header->num_astro);
+    cache->num_timeslices = header->num_timeslices;
+    cache->num_astro = header->num_astro;
+    cache->strings_len = header->strings_len;
+    cache->records = (const guint8 *) contents + sizeof(cache_header);
+    cache->records_len = len - sizeof(cache_header) - header->strings_len;
+
+    cache->info.location_name =
+        cache_get_string(cache, header->location_name);
+    cache->info.lat = cache_get_string(cache, header->lat);
+    cache->info.lon = cache_get_string(cache, header->lon);
+    cache->info.offset = cache_get_string(cache, header->offset);
+    cache->info.etag = cache_get_string(cache, header->etag);
+    cache->info.last_modified = cache_get_string(cache, header->last_modified);
+    cache->info.msl = header->msl;
+    cache->info.cache_date = (time_t) header->cache_date;
+    cache->info.last_weather_download =
+        (time_t) header->last_weather_download;
+    cache->info.last_astro_download = (time_t) header->last_astro_download;
+    cache->info.weather_expires = (time_t) header->weather_expires;
+
+    cache_replay_journal(cache, filename);
+    weather_debug("Opened cache file %s with %u timeslices and %u astrodata "
+                  "entries.", filename, cache->num_timeslices,
+                  cache->num_astro);
+    return cache;
+}
+
+
+const weather_cache_info *
+weather_cache_get_info(const weather_cache *cache)
+{
+    g_assert(cache != NULL);
+    return &cache->info;
+}
+
+
+guint
+weather_cache_get_num_timeslices(const weather_cache *cache)
+{
+    g_assert(cache != NULL);
+    return cache->num_timeslices;
+}
+
+
+/*
+ * Verify the checksum of the records of the cache file, which is only
+ * done once. The records of the journal have their own checksums and
+ * were verified when it was applied.
+ */
+gboolean
+weather_cache_check_records(weather_cache *cache)
+{
+    g_assert(cache != NULL);
+    if (G_UNLIKELY(cache == NULL))
+        return FALSE;
+
+    if (!cache->records_checked) {
+        cache->records_valid =
+            cache_checksum(cache->records, cache->records_len)
+            == cache->header->records_checksum;
+        cache->records_checked = TRUE;
+        if (!cache->records_valid)
+            weather_debug("Cache file records are damaged.");
+    }
+    return cache->records_valid;
+}
+
+
+void
+weather_cache_load_astrodata(const weather_cache *cache,
+                             GArray *astrodata)
+{
+    const cache_astro *rec;
+    xml_astro astro;
+    guint i;
+
+    g_assert(cache != NULL && astrodata != NULL);
+    if (G_UNLIKELY(cache == NULL || astrodata == NULL))
+        return;
+
+    for (i = 0; i < cache->num_astro; i++) {
+        rec = &cache->astro[i];
+        memset(&astro, 0, sizeof(astro));
+        astro.day = (time_t) rec->day;
+        astro.sunrise = (time_t) rec->sunrise;
+        astro.sunset = (time_t) rec->sunset;
+        astro.moonrise = (time_t) rec->moonrise;
+        astro.moonset = (time_t) rec->moonset;
+        astro.solarnoon_elevation = rec->solarnoon_elevation;
+        astro.solarmidnight_elevation = rec->solarmidnight_elevation;
+        astro.sun_never_rises = (rec->flags & CACHE_SUN_NEVER_RISES) != 0;
+        astro.sun_never_sets = (rec->flags & CACHE_SUN_NEVER_SETS) != 0;
+        astro.moon_never_rises = (rec->flags & CACHE_MOON_NEVER_RISES) != 0;
+        astro.moon_never_sets = (rec->flags & CACHE_MOON_NEVER_SETS) != 0;
+        /* merge_astro copies the string */
+        astro.moon_phase = (gchar *) cache_get_string(cache, rec->moon_phase);
+        merge_astro(astrodata, &astro);
+    }
+}
+
+
+/* group of the astro store holding the data of a day */
+static gchar *
+astro_store_group(time_t day_t)
+{
+    GDateTime *dt;
+    gchar *group;
+
+    dt = g_date_time_new_from_unix_local(day_t);
+    group = g_date_time_format(dt, ASTRO_STORE_DATE_FORMAT);
+    g_date_time_unref(dt);
+    return group;
+}
+
+
+/*
+ * Load the days that have not passed yet from the astro store. This is
+ * independent of the cache file, so the astrodata is available even if
+ * the weather data is too old to be used.
+ */
+void
+weather_cache_load_astro_store(const gchar *filename,
+                               GArray *astrodata)
+{
+    GKeyFile *keyfile;
+    xml_astro astro;
+    gchar **groups, *oldest;
+    gsize i, len;
+    guint count = 0;
+
+    g_assert(filename != NULL && astrodata != NULL);
+    if (G_UNLIKELY(filename == NULL || astrodata == NULL))
+        return;
+
+    keyfile = g_key_file_new();
+    if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(keyfile);
+        return;
+    }
+
+    oldest = astro_store_group(time(NULL) - 24 * 3600);
+    groups = g_key_file_get_groups(keyfile, &len);
+    for (i = 0; i < len; i++) {
+        if (strcmp(groups[i], oldest) < 0)
+            continue;
+        memset(&astro, 0, sizeof(astro));
+        astro.day = g_key_file_get_int64(keyfile, groups[i], "day", NULL);
+        astro.moon_phase = g_key_file_get_string(keyfile, groups[i],
+                                                 "moon_phase", NULL);
+        if (astro.day == 0 || astro.moon_phase == NULL) {
+            g_free(astro.moon_phase);
+            continue;
+        }
+        astro.sunrise = g_key_file_get_int64(keyfile, groups[i],
+                                             "sunrise", NULL);
+        astro.sunset = g_key_file_get_int64(keyfile, groups[i],
+                                            "sunset", NULL);
+        astro.sun_never_rises =
+            g_key_file_get_boolean(keyfile, groups[i], "sun_never_rises", NULL);
+        astro.sun_never_sets =
+            g_key_file_get_boolean(keyfile, groups[i], "sun_never_sets", NULL);
+        astro.solarnoon_elevation =
+            g_key_file_get_double(keyfile, groups[i],
+                                  "solarnoon_elevation", NULL);
+        astro.solarmidnight_elevation =
+            g_key_file_get_double(keyfile, groups[i],
+                                  "solarmidnight_elevation", NULL);
+        astro.moonrise = g_key_file_get_int64(keyfile, groups[i],
+                                              "moonrise", NULL);
+        astro.moonset = g_key_file_get_int64(keyfile, groups[i],
+                                             "moonset", NULL);
+        astro.moon_never_rises =
+            g_key_file_get_boolean(keyfile, groups[i], "moon_never_rises", NULL);
+        astro.moon_never_sets =
+            g_key_file_get_boolean(keyfile, groups[i], "moon_never_sets", NULL);
+        merge_astro(astrodata, &astro);
+        g_free(astro.moon_phase);
+        count++;
+    }
+    weather_debug("Loaded %u days from astro store %s.", count, filename);
+    g_strfreev(groups);
+    g_free(oldest);
+    g_key_file_free(keyfile);
+}
+
+
+void
+weather_cache_load_weatherdata(const weather_cache *cache,
+                               xml_weather *wd)
+{
+    const cache_timeslice *rec;
+    xml_time timeslice;
+    xml_location loc;
+    guint i, j;
+
+    g_assert(cache != NULL && wd != NULL);
+    if (G_UNLIKELY(cache == NULL || wd == NULL))
+        return;
+
+    timeslice.location = &loc;
+    for (i = 0; i < cache->num_timeslices; i++) {
+        rec = &cache->timeslices[i];
+        timeslice.start = (time_t) rec->start;
+        timeslice.end = (time_t) rec->end;
+        timeslice.point = (time_t) rec->point;
+
+        memset(&loc, 0, sizeof(loc));
+        for (j = 0; j < G_N_ELEMENTS(cache_value_offsets); j++)
+            if (rec->valid & (1U << j))
+                XML_VALUE_SET(*CACHE_VALUE(&loc, j), rec->values[j]);
+        if (rec->valid & CACHE_SYMBOL_VALID) {
+            loc.symbol_id = rec->symbol_id;
+            loc.symbol = get_symbol_for_id(loc.symbol_id);
+        }
+
+        /* merge_timeslice copies the timeslice */
+        merge_timeslice(wd, &timeslice);
+    }
+}
+
+
+void
+weather_cache_close(weather_cache *cache)
+{
+    if (G_UNLIKELY(cache == NULL))
+        return;
+    if (cache->journal_timeslices)
+        g_array_free(cache->journal_timeslices, TRUE);
+    if (cache->journal_astro)
+        g_array_free(cache->journal_astro, TRUE);
+    if (cache->journal_strings)
+        g_string_free(cache->journal_strings, TRUE);
+    g_free(cache->journal_etag);
+    g_free(cache->journal_last_modified);
+    g_mapped_file_unref(cache->mapped);
+    g_slice_free(weather_cache, cache);
+}
+
+
+/*
+ * Open the cache file of the key if another plugin instance has
+ * written weather data for the place described by want to it, which
+ * is newer than our last download and has not expired yet.
+ */
+weather_cache *
+weather_cache_open_shared(const weather_cache_store *store,
+                          const gchar *key,
+                          const weather_cache_info *want,
+                          time_t now_t)
+{
+    weather_cache *cache;
+    const weather_cache_info *info;
+    gchar *file;
+
+    g_assert(store != NULL && key != NULL && want != NULL);
+    file = weather_cache_store_get_filename(store, key,
+                                            WEATHER_CACHE_FILE_SUFFIX);
+    cache = weather_cache_open(file);
+    g_free(file);
+    if (cache == NULL)
+        return NULL;
+
+    info = &cache->info;
+    if (info->location_name != NULL &&
+        g_strcmp0(info->lat, want->lat) == 0 &&
+        g_strcmp0(info->lon, want->lon) == 0 &&
+        info->offset != NULL &&
+        g_strcmp0(info->offset, want->offset) == 0 &&
+        info->msl == want->msl &&
+        difftime(info->last_weather_download,
+                 want->last_weather_download) > 0 &&
+        difftime(info->weather_expires, now_t) > 0 &&
+        cache->num_timeslices > 0 &&
+        weather_cache_check_records(cache))
+        return cache;
+
+    weather_cache_close(cache);
+    return NULL;
+}
+
+
+static guint32
+cache_add_string(GString *strings,
+                 const gchar *str)
+{
+    guint32 offset;
+
+    if (str == NULL)
+        return CACHE_NO_STRING;
+    offset = strings->len;
+    g_string_append_len(strings, str, strlen(str) + 1);
+    return offset;
+}
+
+
+static gboolean
+cache_pack_timeslice(cache_timeslice *rec,
+                     const xml_time *timeslice)
+{
+    const xml_location *loc;
+    const xml_value *value;
+    guint j;
+
+    if (G_UNLIKELY(timeslice == NULL || timeslice->location == NULL))
+        return FALSE;
+    loc = timeslice->location;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->start = timeslice->start;
+    rec->end = timeslice->end;
+    rec->point = timeslice->point;
+    for (j = 0; j < G_N_ELEMENTS(cache_value_offsets); j++) {
+        value = G_STRUCT_MEMBER_P(loc, cache_value_offsets[j]);
+        if (value->valid) {
+            rec->values[j] = value->value;
+            rec->valid |= 1U << j;
+        }
+    }
+    if (loc->symbol) {
+        rec->symbol_id = loc->symbol_id;
+        rec->valid |= CACHE_SYMBOL_VALID;
+    }
+    return TRUE;
+}
+
+
+/* the moon phase string is left to the caller */
+static void
+cache_pack_astro(cache_astro *arec,
+                 const xml_astro *astro)
+{
+    memset(arec, 0, sizeof(*arec));
+    arec->day = astro->day;
+    arec->sunrise = astro->sunrise;
+    arec->sunset = astro->sunset;
+    arec->moonrise = astro->moonrise;
+    arec->moonset = astro->moonset;
+    arec->solarnoon_elevation = astro->solarnoon_elevation;
+    arec->solarmidnight_elevation = astro->solarmidnight_elevation;
+    if (astro->sun_never_rises)
+        arec->flags |= CACHE_SUN_NEVER_RISES;
+    if (astro->sun_never_sets)
+        arec->flags |= CACHE_SUN_NEVER_SETS;
+    if (astro->moon_never_rises)
+        arec->flags |= CACHE_MOON_NEVER_RISES;
+    if (astro->moon_never_sets)
+        arec->flags |= CACHE_MOON_NEVER_SETS;
+}
+
+
+/*
+ * Serialize weather data and astrodata into the contents of a cache
+ * file. This only copies data in memory and is cheap compared to
+ * writing the file.
+ */
+static GBytes *
+cache_serialize(const weather_cache_info *info,
+                const xml_weather *wd,
+                const GArray *astrodata)
+{
+    GByteArray *out;
+    GString *strings;
+    cache_header header;
+    cache_timeslice rec;
+    cache_astro arec;
+    const xml_astro *astro;
+    guint i;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, CACHE_MAGIC_LEN);
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.version = CACHE_VERSION;
+    header.msl = info->msl;
+    header.cache_date = info->cache_date;
+    header.last_weather_download = info->last_weather_download;
+    header.last_astro_download = info->last_astro_download;
+    header.weather_expires = info->weather_expires;
+
+    /* offset 0 is the empty string, so the block is never empty */
+    strings = g_string_sized_new(256);
+    g_string_append_c(strings, '\0');
+    header.location_name = cache_add_string(strings, info->location_name);
+    header.lat = cache_add_string(strings, info->lat);
+    header.lon = cache_add_string(strings, info->lon);
+    header.offset = cache_add_string(strings, info->offset);
+    header.etag = cache_add_string(strings, info->etag);
+    header.last_modified = cache_add_string(strings, info->last_modified);
+
+    out = g_byte_array_sized_new(sizeof(header) +
+                                 wd->timeslices->len * sizeof(rec) + 4096);
+    g_byte_array_append(out, (const guint8 *) &header, sizeof(header));
+
+    for (i = 0; i < wd->timeslices->len; i++)
+        if (cache_pack_timeslice(&rec, g_array_index(wd->timeslices,
+                                                     xml_time *, i))) {
+            g_byte_array_append(out, (const guint8 *) &rec, sizeof(rec));
+            header.num_timeslices++;
+        }
+
+    for (i = 0; astrodata && i < astrodata->len; i++) {
+        astro = g_array_index(astrodata, xml_astro *, i);
+        if (G_UNLIKELY(astro == NULL))
+            continue;
+        cache_pack_astro(&arec, astro);
+        arec.moon_phase = cache_add_string(strings, astro->moon_phase);
+        g_byte_array_append(out, (const guint8 *) &arec, sizeof(arec));
+        header.num_astro++;
+    }
+
+    g_byte_array_append(out, (const guint8 *) strings->str, strings->len);
+    header.strings_len = strings->len;
+
+    header.records_checksum =
+        cache_checksum(out->data + sizeof(header),
+                       out->len - sizeof(header) - strings->len);
+    header.checksum = cache_header_checksum(&header, strings->str);
+    g_string_free(strings, TRUE);
+    memcpy(out->data, &header, sizeof(header));
+    return g_byte_array_free_to_bytes(out);
+}
+
+
+/*
+ * Collect the records that would be written to the journal for the
+ * current data, keyed by what they describe, so that they can be
+ * compared with what has been written before.
+ */
+static GHashTable *
+cache_collect_records(const xml_weather *wd,
+                      const GArray *astrodata)
+{
+    GHashTable *records;
+    GByteArray *buf;
+    cache_timeslice rec;
+    cache_astro arec;
+    const xml_astro *astro;
+    gchar *key;
+    guint i;
+
+    records = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify) g_bytes_unref);
+
+    for (i = 0; i < wd->timeslices->len; i++) {
+        if (!cache_pack_timeslice(&rec, g_array_index(wd->timeslices,
+                                                      xml_time *, i)))
+            continue;
+        key = g_strdup_printf("%c%" G_GINT64_FORMAT ":%" G_GINT64_FORMAT,
+                              CACHE_KEY_TIMESLICE, rec.start, rec.end);
+        g_hash_table_replace(records, key, g_bytes_new(&rec, sizeof(rec)));
+    }
+
+    for (i = 0; astrodata && i < astrodata->len; i++) {
+        astro = g_array_index(astrodata, xml_astro *, i);
+        if (G_UNLIKELY(astro == NULL))
+            continue;
+        cache_pack_astro(&arec, astro);
+        arec.moon_phase = astro->moon_phase ? 0 : CACHE_NO_STRING;
+        buf = g_byte_array_sized_new(sizeof(arec) + 32);
+        g_byte_array_append(buf, (const guint8 *) &arec, sizeof(arec));
+        if (astro->moon_phase)
+            g_byte_array_append(buf, (const guint8 *) astro->moon_phase,
+                                strlen(astro->moon_phase) + 1);
+        key = g_strdup_printf("%c%" G_GINT64_FORMAT,
+                              CACHE_KEY_ASTRO, arec.day);
+        g_hash_table_replace(records, key, g_byte_array_free_to_bytes(buf));
+    }
+    return records;
+}
+
+
+static void
+cache_journal_add(GByteArray *journal,
+                  guint32 type,
+                  gconstpointer payload,
+                  gsize len)
+{
+    static const guint8 padding[8] = { 0 };
+    cache_journal_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = type;
+    rec.len = len;
+    rec.checksum = cache_checksum(payload, len);
+    g_byte_array_append(journal, (const guint8 *) &rec, sizeof(rec));
+    g_byte_array_append(journal, payload, len);
+    g_byte_array_append(journal, padding, CACHE_JOURNAL_PAD(len) - len);
+}
+
+
+/* a new journal belonging to the given cache file contents */
+static GByteArray *
+cache_journal_new(GBytes *contents,
+                  guint32 generation)
+{
+    const cache_header *base = g_bytes_get_data(contents, NULL);
+    cache_journal_header header;
+    GByteArray *journal;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_JOURNAL_MAGIC, CACHE_MAGIC_LEN);
+    header.byte_order = CACHE_BYTE_ORDER;
+    header.version = CACHE_VERSION;
+    header.base_checksum = base->checksum;
+    header.generation = generation;
+
+    journal = g_byte_array_new();
+    g_byte_array_append(journal, (const guint8 *) &header, sizeof(header));
+    return journal;
+}
+
+
+static void
+cache_journal_add_string(GByteArray *buf,
+                         const gchar *str)
+{
+    if (str)
+        g_byte_array_append(buf, (const guint8 *) str, strlen(str));
+    g_byte_array_append(buf, (const guint8 *) "", 1);
+}
+
+
+/*
+ * Append records for everything that has been added, changed or
+ * removed since the last write to the journal.
+ */
+static void
+cache_journal_add_changes(GByteArray *journal,
+                          GHashTable *written,
+                          GHashTable *records,
+                          const weather_cache_info *info)
+{
+    GHashTableIter iter;
+    cache_journal_info jinfo;
+    GByteArray *buf;
+    const gchar *key;
+    GBytes *payload, *old;
+    gconstpointer data;
+    gsize len;
+
+    g_hash_table_iter_init(&iter, records);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &key,
+                                  (gpointer *) &payload)) {
+        old = g_hash_table_lookup(written, key);
+        if (old && g_bytes_equal(old, payload))
+            continue;
+        data = g_bytes_get_data(payload, &len);
+        cache_journal_add(journal, key[0] == CACHE_KEY_TIMESLICE
+                          ? CACHE_JOURNAL_TIMESLICE : CACHE_JOURNAL_ASTRO,
+                          data, len);
+    }
+
+    /* both record types start with the values identifying them */
+    g_hash_table_iter_init(&iter, written);
+    while (g_hash_table_iter_next(&iter, (gpointer *) &key,
+                                  (gpointer *) &old)) {
+        if (g_hash_table_contains(records, key))
+            continue;
+        if (key[0] == CACHE_KEY_TIMESLICE)
+            cache_journal_add(journal, CACHE_JOURNAL_TIMESLICE_EXPIRED,
+                              g_bytes_get_data(old, NULL),
+                              2 * sizeof(gint64));
+        else
+            cache_journal_add(journal, CACHE_JOURNAL_ASTRO_EXPIRED,
+                              g_bytes_get_data(old, NULL), sizeof(gint64));
+    }
+
+    jinfo.cache_date = info->cache_date;
+    jinfo.last_weather_download = info->last_weather_download;
+    jinfo.last_astro_download = info->last_astro_download;
+    jinfo.weather_expires = info->weather_expires;
+    buf = g_byte_array_sized_new(sizeof(jinfo) + 64);
+    g_byte_array_append(buf, (const guint8 *) &jinfo, sizeof(jinfo));
+    cache_journal_add_string(buf, info->etag);
+    cache_journal_add_string(buf, info->last_modified);
+    cache_journal_add(journal, CACHE_JOURNAL_INFO, buf->data, buf->len);
+    g_byte_array_free(buf, TRUE);
+}
+
+
+/*
+ * Append to an existing journal, which must have been started by this
+ * writer. The header is checked on the opened file, so a journal that
+ * another instance puts in place at the same time is never appended to.
+ */
+static gboolean
+cache_journal_append(const gchar *filename,
+                     const GByteArray *journal,
+                     guint32 base_checksum,
+                     guint32 generation)
+{
+    cache_journal_header header;
+    FILE *fp;
+    gboolean result;
+
+    /* not "a+b", which would create a journal without a header */
+    fp = g_fopen(filename, "r+b");
+    if (fp == NULL) {
+        if (errno == ENOENT)
+            weather_debug("Journal %s has been removed.", filename);
+        else
+            g_warning("Error opening journal %s: %s",
+                      filename, g_strerror(errno));
+        return FALSE;
+    }
+    if (fread(&header, sizeof(header), 1, fp) != 1) {
+        g_warning("Journal %s is missing its header.", filename);
+        fclose(fp);
+        return FALSE;
+    }
+    if (header.base_checksum != base_checksum ||
+        header.generation != generation) {
+        weather_debug("Journal %s has been replaced by another plugin "
+                      "instance.", filename);
+        fclose(fp);
+        return FALSE;
+    }
+    /* a seek is required between reading and writing */
+    result = fseek(fp, 0, SEEK_END) == 0 &&
+        fwrite(journal->data, 1, journal->len, fp) == journal->len;
+    if (fclose(fp) != 0)
+        result = FALSE;
+    if (!result)
+        g_warning("Error appending to journal %s: %s",
+                  filename, g_strerror(errno));
+    return result;
+}
+
+
+/* add the complete days of astrodata to a key file for the astro store */
+static GKeyFile *
+astro_store_records(const GArray *astrodata)
+{
+    GKeyFile *keyfile;
+    const xml_astro *astro;
+    gchar *group;
+    guint i;
+
+    keyfile = g_key_file_new();
+    for (i = 0; astrodata != NULL && i < astrodata->len; i++) {
+        astro = g_array_index(astrodata, xml_astro *, i);
+        /* the moon phase is missing if the moon data failed */
+        if (astro == NULL || astro->moon_phase == NULL)
+            continue;
+        group = astro_store_group(astro->day);
+        g_key_file_set_int64(keyfile, group, "day", astro->day);
+        g_key_file_set_int64(keyfile, group, "sunrise", astro->sunrise);
+        g_key_file_set_int64(keyfile, group, "sunset", astro->sunset);
+        g_key_file_set_boolean(keyfile, group, "sun_never_rises",
+                               astro->sun_never_rises);
+        g_key_file_set_boolean(keyfile, group, "sun_never_sets",
+                               astro->sun_never_sets);
+        g_key_file_set_double(keyfile, group, "solarnoon_elevation",
+                              astro->solarnoon_elevation);
+        g_key_file_set_double(keyfile, group, "solarmidnight_elevation",
+                              astro->solarmidnight_elevation);
+        g_key_file_set_int64(keyfile, group, "moonrise", astro->moonrise);
+        g_key_file_set_int64(keyfile, group, "moonset", astro->moonset);
+        g_key_file_set_boolean(keyfile, group, "moon_never_rises",
+                               astro->moon_never_rises);
+        g_key_file_set_boolean(keyfile, group, "moon_never_sets",
+                               astro->moon_never_sets);
+        g_key_file_set_string(keyfile, group, "moon_phase",
+                              astro->moon_phase);
+        g_free(group);
+    }
+    return keyfile;
+}
+
+
+/* copy all groups of src to dest, replacing groups of the same name */
+static void
+astro_store_merge(GKeyFile *dest,
+                  GKeyFile *src)
+{
+    gchar **groups, **keys, *value;
+    gsize i, j;
+
+    groups = g_key_file_get_groups(src, NULL);
+    for (i = 0; groups[i] != NULL; i++) {
+        g_key_file_remove_group(dest, groups[i], NULL);
+        keys = g_key_file_get_keys(src, groups[i], NULL, NULL);
+        for (j = 0; keys != NULL && keys[j] != NULL; j++) {
+            value = g_key_file_get_value(src, groups[i], keys[j], NULL);
+            g_key_file_set_value(dest, groups[i], keys[j], value);
+            g_free(value);
+        }
+        g_strfreev(keys);
+    }
+    g_strfreev(groups);
+}
+
+
+/*
+ * Add days to the astro store, dropping those that have passed. Other
+ * days are kept, so astrodata that is already known never needs to be
+ * downloaded again.
+ */
+static gboolean
+astro_store_write(const gchar *filename,
+                  GKeyFile *records)
+{
+    GKeyFile *keyfile;
+    GError *error = NULL;
+    gchar **groups, *oldest;
+    gsize i;
+    gboolean result;
+
+    keyfile = g_key_file_new();
+    g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL);
+    astro_store_merge(keyfile, records);
+
+    oldest = astro_store_group(time(NULL) - 24 * 3600);
+    groups = g_key_file_get_groups(keyfile, NULL);
+    for (i = 0; groups[i] != NULL; i++)
+        if (strcmp(groups[i], oldest) < 0)
+            g_key_file_remove_group(keyfile, groups[i], NULL);
+    g_strfreev(groups);
+    g_free(oldest);
+
+    result = g_key_file_save_to_file(keyfile, filename, &error);
+    if (!result) {
+        g_warning("Error writing astro store %s: %s",
+                  filename, error->message);
+        g_error_free(error);
+    }
+    g_key_file_free(keyfile);
+    return result;
+}
+
+
+static void
+cache_writer_thread(GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+    weather_cache_writer *writer = task_data;
+    GError *error = NULL;
+    GBytes *contents;
+    GByteArray *journal;
+    GKeyFile *astro_records;
+    gchar *key, *obsolete_key, *filename, *journal_file, *astro_file;
+    gconstpointer buf;
+    gsize len;
+    guint32 base_checksum, generation;
+    gboolean result;
+
+    for (;;) {
+        g_mutex_lock(&writer->mutex);
+        if (writer->journal == NULL) {
+            writer->running = FALSE;
+            g_cond_broadcast(&writer->cond);
+            g_mutex_unlock(&writer->mutex);
+            return;
+        }
+        key = g_steal_pointer(&writer->key);
+        obsolete_key = g_steal_pointer(&writer->obsolete_key);
+        contents = g_steal_pointer(&writer->contents);
+        journal = g_steal_pointer(&writer->journal);
+        astro_records = g_steal_pointer(&writer->astro_records);
+        base_checksum = writer->base_checksum;
+        generation = writer->generation;
+        g_mutex_unlock(&writer->mutex);
+
+        /* the astro store does not depend on the cache file */
+        astro_file = weather_cache_store_get_filename(writer->store, key,
+                                                      WEATHER_CACHE_ASTRO_SUFFIX);
+        if (astro_store_write(astro_file, astro_records))
+            weather_debug("Astro store %s has been written.", astro_file);
+        g_key_file_free(astro_records);
+        g_free(astro_file);
+
+        /* changes to a journal that could not be written are useless */
+        g_mutex_lock(&writer->mutex);
+        if (contents == NULL && writer->failed) {
+            g_mutex_unlock(&writer->mutex);
+            weather_debug("Dropping journal records for %s after an "
+                          "earlier error.", key);
+            g_byte_array_free(journal, TRUE);
+            g_free(key);
+            g_free(obsolete_key);
+            continue;
+        }
+        g_mutex_unlock(&writer->mutex);
+
+        filename = weather_cache_store_get_filename(writer->store, key,
+                                                    WEATHER_CACHE_FILE_SUFFIX);
+        journal_file = cache_journal_filename(filename);
+        if (contents) {
+            /* g_file_set_contents writes a temporary file and renames
+               it, so the old journal stays valid until the new cache
+               file is in place, and is ignored afterwards */
+            buf = g_bytes_get_data(contents, &len);
+            result = g_file_set_contents(filename, buf, len, &error) &&
+                g_file_set_contents(journal_file,
+                                    (const gchar *) journal->data,
+                                    journal->len, &error);
+            if (result)
+                weather_debug("Cache file %s has been written "
+                              "(%lu bytes).", filename, (gulong) len);
+            else {
+                g_warning("Error writing cache file %s: %s",
+                          filename, error->message);
+                g_clear_error(&error);
+            }
+        } else {
+            /* if the files are no longer those written last, they
+               hold newer data of another instance, so the changes are
+               dropped and the next write compacts them */
+            result = cache_journal_append(journal_file, journal,
+                                          base_checksum, generation);
+            if (result)
+                weather_debug("Appended %u bytes to journal %s.",
+                              journal->len, journal_file);
+        }
+        if (result) {
+            /* the files of the old key are superseded by the new ones */
+            if (obsolete_key && strcmp(obsolete_key, key) != 0) {
+                weather_debug("Removing old cache files of key %s.",
+                              obsolete_key);
+                weather_cache_store_remove(writer->store, obsolete_key);
+            }
+            weather_cache_store_commit(writer->store, key);
+        } else {
+            g_mutex_lock(&writer->mutex);
+            writer->failed = TRUE;
+            g_mutex_unlock(&writer->mutex);
+        }
+
+        if (contents)
+            g_bytes_unref(contents);
+        g_byte_array_free(journal, TRUE);
+        g_free(journal_file);
+        g_free(filename);
+        g_free(key);
+        g_free(obsolete_key);
+    }
+}
+
+
+weather_cache_writer *
+weather_cache_writer_new(weather_cache_store *store)
+{
+    weather_cache_writer *writer;
+
+    g_assert(store != NULL);
+    writer = g_slice_new0(weather_cache_writer);
+    writer->store = store;
+    g_mutex_init(&writer->mutex);
+    g_cond_init(&writer->cond);
+    return writer;
+}
+
+
+/*
+ * Write weather data and astrodata to the cache file of the key in a
+ * worker thread, removing the files of the obsolete key afterwards if
+ * given, and add the astrodata to the astro store. Usually only the
+ * changes since the last write are appended to the journal.
+ * The data is serialized right away, so it may change while the file
+ * is written. If a write is still pending, it is combined with this
+ * one.
+ */
+void
+weather_cache_write_async(weather_cache_writer *writer,
+                          const gchar *key,
+                          const gchar *obsolete_key,
+                          const weather_cache_info *info,
+                          const xml_weather *wd,
+                          const GArray *astrodata)
+{
+    GHashTable *records;
+    GBytes *contents = NULL;
+    GByteArray *journal;
+    GKeyFile *astro_records;
+    const cache_header *header;
+    GTask *task;
+    guint32 generation = 0;
+    gboolean compact, start;
+
+    g_assert(writer != NULL && key != NULL && info != NULL && wd != NULL);
+    if (G_UNLIKELY(writer == NULL || key == NULL ||
+                   info == NULL || wd == NULL))
+        return;
+
+    records = cache_collect_records(wd, astrodata);
+    astro_records = astro_store_records(astrodata);
+
+    g_mutex_lock(&writer->mutex);
+    compact = writer->failed;
+    g_mutex_unlock(&writer->mutex);
+
+    /* start over if the journal cannot be applied to what was written,
+       and compact it once it has grown larger than the cache file */
+    compact = compact || writer->written == NULL ||
+        g_strcmp0(writer->written_key, key) ||
+        g_strcmp0(writer->written_name, info->location_name) ||
+        g_strcmp0(writer->written_lat, info->lat) ||
+        g_strcmp0(writer->written_lon, info->lon) ||
+        writer->written_msl != info->msl ||
+        g_strcmp0(writer->written_offset, info->offset) ||
+        writer->journal_len > writer->base_len;
+
+    if (compact) {
+        contents = cache_serialize(info, wd, astrodata);
+        generation = g_random_int();
+        journal = cache_journal_new(contents, generation);
+        writer->base_len = g_bytes_get_size(contents);
+        writer->journal_len = journal->len;
+        g_free(writer->written_key);
+        g_free(writer->written_name);
+        g_free(writer->written_lat);
+        g_free(writer->written_lon);
+        g_free(writer->written_offset);
+        writer->written_key = g_strdup(key);
+        writer->written_name = g_strdup(info->location_name);
+        writer->written_lat = g_strdup(info->lat);
+        writer->written_lon = g_strdup(info->lon);
+        writer->written_msl = info->msl;
+        writer->written_offset = g_strdup(info->offset);
+    } else {
+        journal = g_byte_array_new();
+        cache_journal_add_changes(journal, writer->written, records, info);
+        writer->journal_len += journal->len;
+    }
+    if (writer->written)
+        g_hash_table_destroy(writer->written);
+    writer->written = records;
+
+    g_mutex_lock(&writer->mutex);
+    if (writer->journal && contents == NULL) {
+        /* append to the pending records, as they are not written yet */
+        g_byte_array_append(writer->journal, journal->data, journal->len);
+        g_byte_array_free(journal, TRUE);
+    } else {
+        if (writer->journal) {
+            weather_debug("Replacing pending write of cache key %s.",
+                          writer->key);
+            if (writer->contents)
+                g_bytes_unref(writer->contents);
+            g_byte_array_free(writer->journal, TRUE);
+        }
+        writer->contents = contents;
+        writer->journal = journal;
+    }
+    if (contents) {
+        header = g_bytes_get_data(contents, NULL);
+        writer->base_checksum = header->checksum;
+        writer->generation = generation;
+        writer->failed = FALSE;
+    }
+    /* keep pending days of the same location in the astro store */
+    if (writer->astro_records && g_strcmp0(writer->key, key) == 0) {
+        astro_store_merge(writer->astro_records, astro_records);
+        g_key_file_free(astro_records);
+    } else {
+        if (writer->astro_records)
+            g_key_file_free(writer->astro_records);
+        writer->astro_records = astro_records;
+    }
+    g_free(writer->key);
+    g_free(writer->obsolete_key);
+    writer->key = g_strdup(key);
+    writer->obsolete_key = g_strdup(obsolete_key);
+    start = !writer->running;
+    writer->running = TRUE;
+    g_mutex_unlock(&writer->mutex);
+
+    if (start) {
+        task = g_task_new(NULL, NULL, NULL, NULL);
+        g_task_set_task_data(task, writer, NULL);
+        g_task_run_in_thread(task, cache_writer_thread);
+        g_object_unref(task);
+    }
+}
+
+
+/*
+ * Wait for pending writes to finish, so that no data gets lost, and
+ * free the writer.
+ */
+void
+weather_cache_writer_free(weather_cache_writer *writer)
+{
+    if (G_UNLIKELY(writer == NULL))
+        return;
+
+    g_mutex_lock(&writer->mutex);
+    while (writer->running)
+        g_cond_wait(&writer->cond, &writer->mutex);
+    g_mutex_unlock(&writer->mutex);
+
+    if (writer->written)
+        g_hash_table_destroy(writer->written);
+    g_free(writer->written_key);
+    g_free(writer->written_name);
+    g_free(writer->written_lat);
+    g_free(writer->written_lon);
+    g_free(writer->written_offset);
+    g_mutex_clear(&writer->mutex);
+    g_cond_clear(&writer->cond);
+    g_slice_free(weather_cache_writer, writer);
+}
@@ -0,0 +1,91 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __WEATHER_CACHE_H__
+#define __WEATHER_CACHE_H__
+
+#include <glib.h>
+
+#include "weather-parsers.h"
+#include "weather-cache-store.h"
+
+G_BEGIN_DECLS
+
+#define WEATHER_CACHE_FILE_SUFFIX ".cache"
+#define WEATHER_CACHE_JOURNAL_SUFFIX ".journal" /* after the file suffix */
+#define WEATHER_CACHE_ASTRO_SUFFIX ".astro"
+#define WEATHER_CACHE_LEASE_SUFFIX ".lease"
+
+typedef struct _weather_cache weather_cache;
+
+typedef struct _weather_cache_writer weather_cache_writer;
+
+/* location and update times stored along with the cached data */
+typedef struct {
+    const gchar *location_name;
+    const gchar *lat;
+    const gchar *lon;
+    const gchar *offset;
+    const gchar *etag;              /* validators of the weather data */
+    const gchar *last_modified;
+    gint msl;
+    time_t cache_date;
+    time_t last_weather_download;
+    time_t last_astro_download;
+    time_t weather_expires;
+} weather_cache_info;
+
+
+weather_cache *weather_cache_open(const gchar *filename);
+
+const weather_cache_info *weather_cache_get_info(const weather_cache *cache);
+
+guint weather_cache_get_num_timeslices(const weather_cache *cache);
+
+gboolean weather_cache_check_records(weather_cache *cache);
+
+void weather_cache_load_astrodata(const weather_cache *cache,
+                                  GArray *astrodata);
+
+void weather_cache_load_astro_store(const gchar *filename,
+                                    GArray *astrodata);
+
+void weather_cache_load_weatherdata(const weather_cache *cache,
+                                    xml_weather *wd);
+
+void weather_cache_close(weather_cache *cache);
+
+weather_cache *weather_cache_open_shared(const weather_cache_store *store,
+                                         const gchar *key,
+                                         const weather_cache_info *want,
+                                         time_t now_t);
+
+weather_cache_writer *weather_cache_writer_new(weather_cache_store *store);
+
+void weather_cache_write_async(weather_cache_writer *writer,
+                               const gchar *key,
+                               const gchar *obsolete_key,
+                               const weather_cache_info *info,
+                               const xml_weather *wd,
+                               const GArray *astrodata);
+
+void weather_cache_writer_free(weather_cache_writer *writer);
+
+G_END_DECLS
+
+#endif
@@ -189,6 +189,9 @@ schedule_delayed_data_update(xfceweather_dialog *dialog)
         }
     }
 
+    /* downloads still in flight are for the old settings */
+    weather_cancel_requests(dialog->pd);
+
     gtk_widget_show(GTK_WIDGET(dialog->update_spinner));
     gtk_spinner_start(GTK_SPINNER(dialog->update_spinner));
     dialog->timer_id =
@@ -253,11 +256,20 @@ cb_lookup_altitude(SoupSession *session,
     GBytes *response =
         soup_session_send_and_read_finish(SOUP_SESSION(source), result, &error);
 
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        weather_debug("%s: lookup has been cancelled", G_STRFUNC);
+        g_error_free(error);
+        return;
+    }
     if (G_UNLIKELY(error))
         g_error_free(error);
     else
         body = g_bytes_get_data(response, &len);
 #else
+    if (msg->status_code == SOUP_STATUS_CANCELLED) {
+        weather_debug("%s: lookup has been cancelled", G_STRFUNC);
+        return;
+    }
     if (G_LIKELY(msg->response_body && msg->response_body->data)) {
         body = msg->response_body->data;
         len = msg->response_body->length;
@@ -307,11 +319,20 @@ cb_lookup_timezone(SoupSession *session,
     GBytes *response =
         soup_session_send_and_read_finish(SOUP_SESSION(source), result, &error);
 
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        weather_debug("%s: lookup has been cancelled", G_STRFUNC);
+        g_error_free(error);
+        return;
+    }
     if (G_UNLIKELY(error))
         g_error_free(error);
     else
         body = g_bytes_get_data(response, &len);
 #else
+    if (msg->status_code == SOUP_STATUS_CANCELLED) {
+        weather_debug("%s: lookup has been cancelled", G_STRFUNC);
+        return;
+    }
     if (G_LIKELY(msg->response_body && msg->response_body->data)) {
         body = msg->response_body->data;
         len = msg->response_body->length;
@@ -352,6 +373,13 @@ lookup_altitude_timezone(const gpointer user_data)
     latstr = double_to_string(lat, "%.6f");
     lonstr = double_to_string(lon, "%.6f");
 
+    /* results for previous coordinates are of no use anymore */
+    if (dialog->lookup_cancellable) {
+        g_cancellable_cancel(dialog->lookup_cancellable);
+        g_object_unref(dialog->lookup_cancellable);
+    }
+    dialog->lookup_cancellable = g_cancellable_new();
+
     /* lookup altitude */
     url = g_strdup_printf("https://secure.geonames.org"
                           "/srtm3XML?lat=%s&lng=%s&username=%s",
@@ -359,6 +387,8 @@ lookup_altitude_timezone(const gpointer user_data)
                           dialog->pd->geonames_username
                           ? dialog->pd->geonames_username : GEONAMES_USERNAME);
     weather_http_queue_request(dialog->pd->session, url,
+                               WEATHER_SCHEDULE_INTERACTIVE,
+                               dialog->lookup_cancellable,
                                cb_lookup_altitude, user_data);
     g_free(url);
 
@@ -369,6 +399,8 @@ lookup_altitude_timezone(const gpointer user_data)
                           dialog->pd->geonames_username
                           ? dialog->pd->geonames_username : GEONAMES_USERNAME);
     weather_http_queue_request(dialog->pd->session, url,
+                               WEATHER_SCHEDULE_INTERACTIVE,
+                               dialog->lookup_cancellable,
                                cb_lookup_timezone, user_data);
     g_free(url);
 
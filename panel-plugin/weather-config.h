@@ -31,6 +31,7 @@ typedef struct {
     GtkWidget *notebook;
     plugin_data *pd;
     guint timer_id;
+    GCancellable *lookup_cancellable;   /* of altitude/timezone lookups */
     GtkBuilder *builder;
 
     /* location page */
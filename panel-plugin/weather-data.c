@@ -28,14 +28,11 @@
 #define NIGHT_TIME_START 21
 #define NIGHT_TIME_END 5
 
-/* interval used for searching raw data relevant to a day */
-#define DAY_START 3
-#define DAY_END 33
-#define DAYTIME_LEN 6
-
 /* If some value is not present or cannot be computed, return this instead */
 #define INVALID_VALUE -9999
 
+#define EARTH_RADIUS 6371000            /* mean radius in meters */
+
 #define CHK_NULL(s) ((s) ? g_strdup(s) : g_strdup(""))
 
 #define ROUND_TO_INT(default_format) (round ? "%.0f" : default_format)
@@ -58,30 +55,38 @@ do {                                                     \
 } while (0)
 
 
-#define LOCALE_DOUBLE(value, format)                        \
-    (value                                                  \
-     ? g_strdup_printf(format, g_ascii_strtod(value, NULL)) \
+#define LOCALE_DOUBLE(var, format)              \
+    ((var).valid                                \
+     ? g_strdup_printf(format, (var).value)     \
      : g_strdup(""))
 
-#define INTERPOLATE_OR_COPY(var, radian)                    \
-    if (ipol)                                               \
-        comb->location->var =                               \
-            interpolate_gchar_value(start->location->var,   \
-                                    end->location->var,     \
-                                    comb->start, comb->end, \
-                                    comb->point, radian);   \
-    else                                                    \
-        comb->location->var = g_strdup(end->location->var);
+#define INTERPOLATE_OR_COPY(var, radian)                        \
+    if (ipol)                                                   \
+        comb->location->var =                                   \
+            interpolate_location_value(&start->location->var,   \
+                                       &end->location->var,     \
+                                       comb->start, comb->end,  \
+                                       comb->point, radian);    \
+    else                                                        \
+        comb->location->var = end->location->var;
 
-#define COMB_END_COPY(var)                              \
-    comb->location->var = g_strdup(end->location->var);
+#define COMB_END_COPY(var)                      \
+    comb->location->var = end->location->var;
 
 
-/* struct to store results from searches for point data */
+/* a range of entries in the point data series of xml_weather, valid
+   until the timeslices are changed */
 typedef struct {
-    GArray *before;
+    guint first;
+    guint len;
+} point_data_range;
+
+/* struct to store results from searches for point data, as ranges
+   of entries in the point data series */
+typedef struct {
+    point_data_range before;
     time_t point;
-    GArray *after;
+    point_data_range after;
 } point_data_results;
 
 
@@ -109,6 +114,24 @@ double_to_string(const gdouble val,
 }
 
 
+/* great circle distance in meters between two points given in degrees */
+gdouble
+calc_distance(gdouble lat1,
+              gdouble lon1,
+              gdouble lat2,
+              gdouble lon2)
+{
+    gdouble dlat, dlon, a;
+
+    lat1 *= G_PI / 180;
+    lat2 *= G_PI / 180;
+    dlat = lat2 - lat1;
+    dlon = (lon2 - lon1) * G_PI / 180;
+    a = pow(sin(dlat / 2), 2) + cos(lat1) * cos(lat2) * pow(sin(dlon / 2), 2);
+    return 2 * EARTH_RADIUS * asin(MIN(1.0, sqrt(a)));
+}
+
+
 gchar *
 format_date(time_t date_t,
             const gchar *format,
@@ -139,7 +162,7 @@ gboolean
 timeslice_is_interval(xml_time *timeslice)
 {
     return (timeslice->location->symbol != NULL ||
-            timeslice->location->precipitation_value != NULL);
+            timeslice->location->precipitation.valid);
 }
 
 
@@ -152,11 +175,11 @@ calc_dewpoint(const xml_location *loc)
 {
     gdouble temp, humidity, val;
 
-    if (G_UNLIKELY(loc->humidity_value == NULL))
+    if (G_UNLIKELY(!loc->humidity.valid))
         return INVALID_VALUE;
 
-    temp = string_to_double(loc->temperature_value, 0);
-    humidity = string_to_double(loc->humidity_value, 0);
+    temp = loc->temperature.value;
+    humidity = loc->humidity.value;
     val = log(humidity / 100);
     return (241.2 * val + 4222.03716 * temp / (241.2 + temp))
         / (17.5043 - val - 17.5043 * temp / (241.2 + temp));
@@ -169,9 +192,9 @@ calc_apparent_temperature(const xml_location *loc,
                           const apparent_temp_models model,
                           const gboolean night_time)
 {
-    gdouble temp = string_to_double(loc->temperature_value, 0);
-    gdouble windspeed = string_to_double(loc->wind_speed_mps, 0);
-    gdouble humidity = string_to_double(loc->humidity_value, 0);
+    gdouble temp = loc->temperature.value;
+    gdouble windspeed = loc->wind_speed_mps.value;
+    gdouble humidity = loc->humidity.value;
     gdouble dp, e;
 
     switch (model) {
@@ -285,14 +308,14 @@ calc_apparent_temperature(const xml_location *loc,
  * direction the wind is coming _from_.
  */
 static gchar*
-wind_dir_name_by_deg(gchar *degrees, gboolean long_name)
+wind_dir_name_by_deg(const xml_value *degrees, gboolean long_name)
 {
     gdouble deg;
 
-    if (G_UNLIKELY(degrees == NULL))
+    if (G_UNLIKELY(!degrees->valid))
         return "";
 
-    deg = string_to_double(degrees, 0);
+    deg = degrees->value;
 
     if (deg >= 360 - 22.5 || deg < 45 - 22.5)
         return (long_name) ? _("North") : _("N");
@@ -344,8 +367,7 @@ get_data(const xml_time *timeslice,
             return LOCALE_DOUBLE(loc->altitude, "%.0f");
 
         case FEET:
-            val = string_to_double(loc->altitude, 0);
-            val /= 0.3048;
+            val = loc->altitude.value / 0.3048;
             return g_strdup_printf(ROUND_TO_INT("%.2f"), val);
         }
         break;
@@ -357,7 +379,7 @@ get_data(const xml_time *timeslice,
         return LOCALE_DOUBLE(loc->longitude, "%.4f");
 
     case TEMPERATURE:      /* source is in °C */
-        val = string_to_double(loc->temperature_value, 0);
+        val = loc->temperature.value;
         if (units->temperature == FAHRENHEIT)
             CALC_FAHRENHEIT(round, val);
         else
@@ -365,7 +387,7 @@ get_data(const xml_time *timeslice,
         return g_strdup_printf(ROUND_TO_INT("%.1f"), val);
 
     case PRESSURE:         /* source is in hectopascals */
-        val = string_to_double(loc->pressure_value, 0);
+        val = loc->pressure.value;
         switch (units->pressure) {
         case INCH_MERCURY:
             val *= 0.03;
@@ -380,7 +402,7 @@ get_data(const xml_time *timeslice,
         return g_strdup_printf(ROUND_TO_INT("%.1f"), val);
 
     case WIND_SPEED:       /* source is in meters per hour */
-        val = string_to_double(loc->wind_speed_mps, 0);
+        val = loc->wind_speed_mps.value;
         switch (units->windspeed) {
         case KMH:
             val *= 3.6;
@@ -398,17 +420,16 @@ get_data(const xml_time *timeslice,
         return g_strdup_printf(ROUND_TO_INT("%.1f"), val);
 
     case WIND_BEAUFORT:
-        val = string_to_double(loc->wind_speed_beaufort, 0);
-        return g_strdup_printf("%.0f", val);
+        return g_strdup_printf("%.0f", loc->wind_speed_beaufort.value);
 
     case WIND_DIRECTION:
-        return g_strdup(wind_dir_name_by_deg(loc->wind_dir_deg, FALSE));
+        return g_strdup(wind_dir_name_by_deg(&loc->wind_dir_deg, FALSE));
 
     case WIND_DIRECTION_DEG:
         return LOCALE_DOUBLE(loc->wind_dir_deg, ROUND_TO_INT("%.1f"));
 
     case HUMIDITY:
-        return LOCALE_DOUBLE(loc->humidity_value, ROUND_TO_INT("%.1f"));
+        return LOCALE_DOUBLE(loc->humidity, ROUND_TO_INT("%.1f"));
 
     case DEWPOINT:
         val = calc_dewpoint(loc);
@@ -449,7 +470,7 @@ get_data(const xml_time *timeslice,
         return LOCALE_DOUBLE(loc->fog_percent, ROUND_TO_INT("%.1f"));
 
     case PRECIPITATION:   /* source is in millimeters */
-        val = string_to_double(loc->precipitation_value, 0);
+        val = loc->precipitation.value;
 
         /* For snow, adjust precipitation dependent on temperature. Source:
            http://answers.yahoo.com/question/index?qid=20061230123635AAAdZAe */
@@ -458,7 +479,7 @@ get_data(const xml_time *timeslice,
             loc->symbol_id == SYMBOL_SNOWTHUNDER ||
             loc->symbol_id == SYMBOL_SNOWSUNPOLAR ||
             loc->symbol_id == SYMBOL_SNOWSUNTHUNDER) {
-            temp = string_to_double(loc->temperature_value, 0);
+            temp = loc->temperature.value;
             if (temp < -11.1111)      /* below 12 °F, low snow density */
                 val *= 12;
             else if (temp < -4.4444)  /* 12 to 24 °F, still low density */
@@ -640,15 +661,14 @@ calculate_symbol(xml_time *timeslice,
 
     loc = timeslice->location;
 
-    precipitation = string_to_double(loc->precipitation_value, 0);
+    precipitation = loc->precipitation.value;
     if (precipitation > 0)
         return;
 
     /* do some modifications only if we're making a timeslice for
        current conditions */
     if (current_conditions) {
-        cloudiness =
-            string_to_double(loc->clouds_percent[CLOUDS_PERC_CLOUDINESS], 0);
+        cloudiness = loc->clouds_percent[CLOUDS_PERC_CLOUDINESS].value;
         if (cloudiness >= 90)
             loc->symbol_id = SYMBOL_CLOUD;
         else if (cloudiness >= 30)
@@ -657,13 +677,12 @@ calculate_symbol(xml_time *timeslice,
             loc->symbol_id = SYMBOL_LIGHTCLOUD;
     }
 
-    fog = string_to_double(loc->fog_percent, 0);
+    fog = loc->fog_percent.value;
     if (fog >= 80)
         loc->symbol_id = SYMBOL_FOG;
 
     /* update symbol name */
-    g_free(loc->symbol);
-    loc->symbol = g_strdup(get_symbol_name(loc->symbol_id));
+    loc->symbol = get_symbol_name(loc->symbol_id);
 }
 
 
@@ -696,26 +715,27 @@ interpolate_value(gdouble value_start,
 
 
 /*
- * convert gchar in a gdouble and interpolate the value
+ * Interpolate a location value, optionally treating it as an angle
  */
-static gchar *
-interpolate_gchar_value(gchar *value_start,
-                        gchar *value_end,
-                        time_t start_t,
-                        time_t end_t,
-                        time_t between_t,
-                        gboolean radian)
+static xml_value
+interpolate_location_value(const xml_value *value_start,
+                           const xml_value *value_end,
+                           time_t start_t,
+                           time_t end_t,
+                           time_t between_t,
+                           gboolean radian)
 {
+    xml_value result = { 0, FALSE };
     gdouble val_start, val_end, val_result;
 
-    if (G_UNLIKELY(value_end == NULL))
-        return NULL;
+    if (G_UNLIKELY(!value_end->valid))
+        return result;
 
-    if (value_start == NULL)
-        return g_strdup(value_end);
+    if (!value_start->valid)
+        return *value_end;
 
-    val_start = string_to_double(value_start, 0);
-    val_end = string_to_double(value_end, 0);
+    val_start = value_start->value;
+    val_end = value_end->value;
 
     if (radian) {
         if (val_end > val_start && val_end - val_start > 180)
@@ -731,27 +751,26 @@ interpolate_gchar_value(gchar *value_start,
 
     weather_debug("Interpolated data: start=%f, end=%f, result=%f",
                   val_start, val_end, val_result);
-    return double_to_string(val_result, "%.1f");
+    XML_VALUE_SET(result, val_result);
+    return result;
 }
 
 
-/* Create a new combined timeslice, with optionally interpolated data */
+/*
+ * Create a new combined timeslice from an interval and the point data
+ * at its start and end, with optionally interpolated data.
+ */
 static xml_time *
-make_combined_timeslice(xml_weather *wd,
-                        const xml_time *interval,
-                        const time_t *between_t,
-                        gboolean current_conditions)
+combine_timeslice(const xml_time *interval,
+                  const xml_time *start,
+                  const xml_time *end,
+                  const time_t *between_t,
+                  gboolean current_conditions)
 {
-    xml_time *comb, *start, *end;
+    xml_time *comb;
     gboolean ipol = (between_t != NULL) ? TRUE : FALSE;
     gint i;
 
-    /* find point data at start of interval (may not be available) */
-    start = get_timeslice(wd, interval->start, interval->start, NULL);
-
-    /* find point interval at end of interval */
-    end = get_timeslice(wd, interval->end, interval->end, NULL);
-
     if (start == NULL && end == NULL)
         return NULL;
 
@@ -786,20 +805,14 @@ make_combined_timeslice(xml_weather *wd,
     COMB_END_COPY(latitude);
     COMB_END_COPY(longitude);
 
-    INTERPOLATE_OR_COPY(temperature_value, FALSE);
-    COMB_END_COPY(temperature_unit);
+    INTERPOLATE_OR_COPY(temperature, FALSE);
 
     INTERPOLATE_OR_COPY(wind_dir_deg, TRUE);
-    comb->location->wind_dir_name =
-        g_strdup(wind_dir_name_by_deg(comb->location->wind_dir_deg, FALSE));
-
     INTERPOLATE_OR_COPY(wind_speed_mps, FALSE);
     INTERPOLATE_OR_COPY(wind_speed_beaufort, FALSE);
-    INTERPOLATE_OR_COPY(humidity_value, FALSE);
-    COMB_END_COPY(humidity_unit);
+    INTERPOLATE_OR_COPY(humidity, FALSE);
 
-    INTERPOLATE_OR_COPY(pressure_value, FALSE);
-    COMB_END_COPY(pressure_unit);
+    INTERPOLATE_OR_COPY(pressure, FALSE);
 
     for (i = 0; i < CLOUDS_PERC_NUM; i++)
         INTERPOLATE_OR_COPY(clouds_percent[i], FALSE);
@@ -807,19 +820,36 @@ make_combined_timeslice(xml_weather *wd,
     INTERPOLATE_OR_COPY(fog_percent, FALSE);
 
     /* it makes no sense to interpolate the following (interval) values */
-    comb->location->precipitation_value =
-        g_strdup(interval->location->precipitation_value);
-    comb->location->precipitation_unit =
-        g_strdup(interval->location->precipitation_unit);
+    comb->location->precipitation = interval->location->precipitation;
 
     comb->location->symbol_id = interval->location->symbol_id;
-    comb->location->symbol = g_strdup(interval->location->symbol);
+    comb->location->symbol = interval->location->symbol;
 
     calculate_symbol(comb, current_conditions);
     return comb;
 }
 
 
+/* Create a new combined timeslice, with optionally interpolated data */
+static xml_time *
+make_combined_timeslice(xml_weather *wd,
+                        const xml_time *interval,
+                        const time_t *between_t,
+                        gboolean current_conditions)
+{
+    xml_time *start, *end;
+
+    /* find point data at start of interval (may not be available) */
+    start = get_timeslice(wd, interval->start, interval->start);
+
+    /* find point interval at end of interval */
+    end = get_timeslice(wd, interval->end, interval->end);
+
+    return combine_timeslice(interval, start, end,
+                             between_t, current_conditions);
+}
+
+
 void
 merge_astro(GArray *astrodata,
             const xml_astro *astro)
@@ -835,7 +865,7 @@ merge_astro(GArray *astrodata,
     new_astro = xml_astro_copy(astro);
 
     weather_debug("Current astrodata entries: %d", astrodata->len);
-    weather_debug("new_astro->day=%s", format_date(new_astro->day, NULL,TRUE));
+    weather_debug_date("new_astro->day=%s", new_astro->day, NULL, TRUE);
     weather_dump(weather_dump_astro, new_astro);
 
     /* check for and replace existing astrodata of the same date */
@@ -860,7 +890,6 @@ merge_timeslice(xml_weather *wd,
 {
     xml_time *old_ts, *new_ts;
     time_t now_t = time(NULL);
-    guint index;
 
     g_assert(wd != NULL);
     if (G_UNLIKELY(wd == NULL))
@@ -877,16 +906,18 @@ merge_timeslice(xml_weather *wd,
 
     /* check if there is a timeslice with the same interval and
        replace it with the current data */
-    old_ts = get_timeslice(wd, timeslice->start, timeslice->end, &index);
+    old_ts = get_timeslice(wd, timeslice->start, timeslice->end);
     if (old_ts) {
-        xml_time_free(old_ts);
-        g_array_remove_index(wd->timeslices, index);
-        g_array_insert_val(wd->timeslices, index, new_ts);
-        weather_debug("Replaced existing timeslice at %d.", index);
-    } else {
-        g_array_prepend_val(wd->timeslices, new_ts);
-        //weather_debug("Prepended timeslice to the existing timeslices.");
-    }
+        /* swap locations so that the indexed timeslice stays in place */
+        xml_location *loc = old_ts->location;
+        old_ts->location = new_ts->location;
+        old_ts->point = new_ts->point;
+        new_ts->location = loc;
+        xml_time_free(new_ts);
+        wd->series_dirty = TRUE;
+        weather_debug("Replaced existing timeslice.");
+    } else
+        add_timeslice(wd, new_ts);
 }
 
 
@@ -1021,32 +1052,55 @@ xml_time_compare(gconstpointer a,
 }
 
 
-static void
-point_data_results_free(point_data_results *pdr)
+/*
+ * Return the index of the first entry in a sorted time column that
+ * is not earlier than the given time, or the column length if there
+ * is none.
+ */
+static guint
+time_column_search(const GArray *column,
+                   time_t t)
 {
-    g_assert(pdr != NULL);
-    if (G_UNLIKELY(pdr == NULL))
-        return;
+    guint low = 0, high = column->len, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (g_array_index(column, time_t, mid) < t)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+
+/* return entries of a sorted time column within [from_t, to_t] */
+static point_data_range
+time_column_range(const GArray *column,
+                  time_t from_t,
+                  time_t to_t)
+{
+    point_data_range range = { 0, 0 };
 
-    g_assert(pdr->before != NULL);
-    g_array_free(pdr->before, FALSE);
-    g_assert(pdr->after != NULL);
-    g_array_free(pdr->after, FALSE);
-    g_slice_free(point_data_results, pdr);
-    return;
+    if (to_t < from_t)
+        return range;
+    range.first = time_column_search(column, from_t);
+    range.len = time_column_search(column, to_t + 1) - range.first;
+    return range;
 }
 
+
 /*
- * Given an array of point data, find two points for which
- * corresponding interval data can be found so that the interval is as
- * small as possible, returning NULL if such interval data doesn't
- * exist.
+ * Given point data before and after a point in time, find two points
+ * for which corresponding interval data can be found so that the
+ * interval is as small as possible, returning NULL if such interval
+ * data doesn't exist.
  */
 static xml_time *
 find_smallest_interval(xml_weather *wd,
                        const point_data_results *pdr)
 {
-    GArray *before = pdr->before, *after = pdr->after;
+    const point_data_range *before = &pdr->before, *after = &pdr->after;
     xml_time *ts_before, *ts_after, *found;
     guint i, j;
 
@@ -1054,10 +1108,12 @@ find_smallest_interval(xml_weather *wd,
         return NULL;
 
     for (i = before->len - 1; i > 0; i--) {
-        ts_before = g_array_index(before, xml_time *, i);
+        ts_before = g_array_index(wd->points->timeslices, xml_time *,
+                                  before->first + i);
         for (j = 0; j < after->len; j++) {
-            ts_after = g_array_index(after, xml_time *, j);
-            found = get_timeslice(wd, ts_before->start, ts_after->end, NULL);
+            ts_after = g_array_index(wd->points->timeslices, xml_time *,
+                                     after->first + j);
+            found = get_timeslice(wd, ts_before->start, ts_after->end);
             if (found)
                 return found;
         }
@@ -1070,76 +1126,56 @@ static xml_time *
 find_smallest_incomplete_interval(xml_weather *wd,
                                   time_t end_t)
 {
-    xml_time *timeslice, *found = NULL;
+    xml_time_series *intervals;
+    xml_time *found = NULL;
     guint i;
 
     weather_debug("Searching for the smallest incomplete interval.");
-    /* search for all timeslices with interval data that have end time end_t */
-    for (i = 0; i < wd->timeslices->len; i++) {
-        timeslice = g_array_index(wd->timeslices, xml_time *, i);
-        if (timeslice && difftime(timeslice->end, end_t) == 0
-            && difftime(timeslice->end, timeslice->start) != 0) {
-            if (found == NULL)
-                found = timeslice;
-            else
-                if (difftime(timeslice->start, found->start) > 0)
-                    found = timeslice;
-            weather_dump(weather_dump_timeslice, found);
+    g_assert(!wd->series_dirty && wd->intervals != NULL);
+    xml_weather_update_series(wd);
+    intervals = wd->intervals;
+
+    /* The series is sorted by start time, so the first interval with
+       end time end_t found while walking backwards from end_t is the
+       smallest one. */
+    for (i = time_column_search(intervals->start, end_t); i > 0; i--)
+        if (g_array_index(intervals->end, time_t, i - 1) == end_t) {
+            found = g_array_index(intervals->timeslices, xml_time *, i - 1);
+            break;
         }
-    }
     weather_debug("Search result for smallest incomplete interval is:");
     weather_dump(weather_dump_timeslice, found);
     return found;
 }
 
 
-/* find point data within certain limits around a point in time */
-static point_data_results *
-find_point_data(const xml_weather *wd,
+/*
+ * Find point data within certain limits around a point in time. For
+ * point data, start and end time are the same, so the start time
+ * column can be searched.
+ */
+static void
+find_point_data(xml_weather *wd,
                 const time_t point_t,
-                const gdouble min_diff,
-                const gdouble max_diff)
+                const time_t min_diff,
+                const time_t max_diff,
+                point_data_results *found)
 {
-    point_data_results *found;
-    xml_time *timeslice;
-    gdouble diff;
-    guint i;
+    GArray *column;
 
-    found = g_slice_new0(point_data_results);
-    found->before = g_array_new(FALSE, TRUE, sizeof(xml_time *));
-    found->after = g_array_new(FALSE, TRUE, sizeof(xml_time *));
+    g_assert(!wd->series_dirty && wd->points != NULL);
+    xml_weather_update_series(wd);
+    column = wd->points->start;
 
-    weather_debug("Checking %d timeslices for point data.",
-                  wd->timeslices->len);
-    for (i = 0; i < wd->timeslices->len; i++) {
-        timeslice = g_array_index(wd->timeslices, xml_time *, i);
-        /* look only for point data, not intervals */
-        if (G_UNLIKELY(timeslice == NULL) || timeslice_is_interval(timeslice))
-            continue;
-
-        /* add point data if within limits */
-        diff = difftime(timeslice->end, point_t);
-        if (diff <= 0) {  /* before point_t */
-            diff *= -1;
-            if (diff < min_diff || diff > max_diff)
-                continue;
-            g_array_append_val(found->before, timeslice);
-            weather_dump(weather_dump_timeslice, timeslice);
-        } else {          /* after point_t */
-            if (diff < min_diff || diff > max_diff)
-                continue;
-            g_array_append_val(found->after, timeslice);
-            weather_dump(weather_dump_timeslice, timeslice);
-        }
-    }
-    g_array_sort(found->before, (GCompareFunc) xml_time_compare);
-    g_array_sort(found->after, (GCompareFunc) xml_time_compare);
     found->point = point_t;
+    found->before = time_column_range(column, point_t - max_diff,
+                                      point_t - min_diff);
+    found->after = time_column_range(column, point_t + MAX(min_diff, 1),
+                                     point_t + max_diff);
     weather_debug("Found %d timeslices with point data, "
                   "%d before and %d after point_t.",
-                  (found->before->len + found->after->len),
-                  found->before->len, found->after->len);
-    return found;
+                  (found->before.len + found->after.len),
+                  found->before.len, found->after.len);
 }
 
 
@@ -1147,9 +1183,9 @@ xml_time *
 make_current_conditions(xml_weather *wd,
                         time_t now_t)
 {
-    point_data_results *found = NULL;
+    point_data_results found;
     xml_time *interval = NULL, *incomplete;
-    struct tm point_tm = *localtime(&now_t);
+    struct tm point_tm;
     time_t point_t;
     gint i = 0;
 
@@ -1157,13 +1193,29 @@ make_current_conditions(xml_weather *wd,
     if (G_UNLIKELY(wd == NULL))
         return NULL;
 
+    localtime_r(&now_t, &point_tm);
+
+    /* Between downloads, the interval found last time usually still
+       covers the current time, so only interpolate again. Rebuilding
+       the series after new data has been merged drops that interval. */
+    g_assert(!wd->series_dirty && wd->intervals != NULL);
+    xml_weather_update_series(wd);
+    interval = wd->current_interval;
+    if (interval &&
+        difftime(now_t, interval->start) > 0 &&
+        difftime(interval->end, now_t) > 0) {
+        weather_debug("Reusing interval for current conditions.");
+        return combine_timeslice(interval, wd->current_start,
+                                 wd->current_end, &now_t, TRUE);
+    }
+    interval = NULL;
+
     /* there may not be a timeslice available for the current
        interval, so look max three hours ahead */
     while (i < 3 && interval == NULL) {
         point_t = time_calc_hour(point_tm, i);
-        found = find_point_data(wd, point_t, 1, 4 * 3600);
-        interval = find_smallest_interval(wd, found);
-        point_data_results_free(found);
+        find_point_data(wd, point_t, 1, 4 * 3600, &found);
+        interval = find_smallest_interval(wd, &found);
 
         /* There may be interval data where point data is only
            available at the end of that interval. If such an interval
@@ -1173,14 +1225,18 @@ make_current_conditions(xml_weather *wd,
             if ((incomplete =
                  find_smallest_incomplete_interval(wd, interval->start)))
                 interval = incomplete;
-        point_tm = *localtime(&point_t);
+        localtime_r(&point_t, &point_tm);
         i++;
     }
     weather_dump(weather_dump_timeslice, interval);
     if (interval == NULL)
         return NULL;
 
-    return make_combined_timeslice(wd, interval, &now_t, TRUE);
+    wd->current_interval = interval;
+    wd->current_start = get_timeslice(wd, interval->start, interval->start);
+    wd->current_end = get_timeslice(wd, interval->end, interval->end);
+    return combine_timeslice(interval, wd->current_start,
+                             wd->current_end, &now_t, TRUE);
 }
 
 
@@ -1224,7 +1280,7 @@ get_astro_data_for_day(const GArray *astrodata,
         astro = g_array_index(astrodata, xml_astro *, i);
         weather_debug("checking astro %d", i);
         weather_debug("astro data for day:");
-        weather_debug("%s",weather_dump_astro(astro));
+        weather_dump(weather_dump_astro, astro);
 
         if (astro) {
             weather_debug("Checking difftime: astro_day  day_t %d %d.",
@@ -1241,70 +1297,23 @@ get_astro_data_for_day(const GArray *astrodata,
 }
 
 
-/*
- * Get all point data relevant for a given day.
- */
-GArray *
-get_point_data_for_day(xml_weather *wd,
-                       gint day)
-{
-    GArray *found;
-    xml_time *timeslice;
-    time_t day_t = time(NULL);
-    guint i;
-
-    day_t = day_at_midnight(day_t, day);
-
-    /* loop over weather data and pick relevant point data */
-    found = g_array_new(FALSE, TRUE, sizeof(xml_time *));
-    g_assert(found != NULL);
-    if (G_UNLIKELY(found == NULL))
-        return NULL;
-
-    weather_debug("Checking %d timeslices for point data relevant to day %d.",
-                  wd->timeslices->len, day);
-    for (i = 0; i < wd->timeslices->len; i++) {
-        timeslice = g_array_index(wd->timeslices, xml_time *, i);
-
-        /* look only for point data, not intervals */
-        if (G_UNLIKELY(timeslice == NULL) || timeslice_is_interval(timeslice))
-            continue;
-
-        if (difftime(timeslice->start, day_t) >= DAY_START * 3600 &&
-            difftime(timeslice->end, day_t) <= DAY_END * 3600) {
-            weather_dump(weather_dump_timeslice, timeslice);
-            g_array_append_val(found, timeslice);
-        }
-    }
-    g_array_sort(found, (GCompareFunc) xml_time_compare);
-    weather_debug("Found %d timeslices for day %d.", found->len, day);
-    return found;
-}
-
-
 /*
  * Return forecast data for a given daytime, using the data provided.
  */
 xml_time *
 make_forecast_data(xml_weather *wd,
-                   GArray *daydata,
                    gint day,
                    daytime dt)
 {
-    xml_time *ts1, *ts2, *interval = NULL;
-    struct tm point_tm, start_tm, end_tm, tm1, tm2;
-    time_t point_t, start_t, end_t;
+    xml_time *interval = NULL;
+    struct tm point_tm, start_tm, end_tm;
+    time_t point_t, start_t, end_t, slot_t;
     gint min = 0, max = 0, point = 0;
-    guint i, j;
 
     g_assert(wd != NULL);
     if (G_UNLIKELY(wd == NULL))
         return NULL;
 
-    g_assert(daydata != NULL);
-    if (G_UNLIKELY(daydata == NULL))
-        return NULL;
-
     /* choose search interval and desired point in time depending on daytime */
     switch (dt) {
     case MORNING:
@@ -1352,86 +1361,27 @@ make_forecast_data(xml_weather *wd,
     end_tm.tm_isdst = -1;
     end_t = mktime(&end_tm);
 
-    /* using search criteria, find an appropriate interval */
-    for (i = 0; i < daydata->len; i++) {
-        weather_debug("checking start ts %d", i);
-
-        /* try start timeslice for interval */
-        ts1 = g_array_index(daydata, xml_time *, i);
-
-        if (G_UNLIKELY(ts1 == NULL))
+    /* Candidate intervals start at 0, 6, 12 or 18 hours UTC time and
+       lie within the daytime limits, so only the few slots between the
+       start of the limits and the daytime point need to be checked. As
+       intervals are indexed in UTC, a dst change within the daytime
+       limits does not matter here. */
+    slot_t = start_t + FORECAST_INTERVAL_LEN - 1;
+    slot_t -= slot_t % FORECAST_INTERVAL_LEN;
+    for (; difftime(point_t, slot_t) >= 0; slot_t += FORECAST_INTERVAL_LEN) {
+        interval = get_forecast_interval(wd, slot_t);
+        if (interval == NULL)
             continue;
-        weather_debug("start ts is not null");
 
-        /* start timeslice needs to be within max daytime interval */
-        if (difftime(ts1->start, start_t) < 0 ||
-            difftime(end_t, ts1->start) < 0)
+        /* interval needs to end within the daytime limits and the
+           daytime point needs to be within the interval */
+        if (difftime(end_t, interval->end) < 0 ||
+            difftime(interval->end, point_t) < 0)
             continue;
-        weather_debug("start ts is in max daytime interval");
 
-        /* start timeslice needs to start at 0, 6, 12, or 18 hours UTC time */
-        tm1 = *gmtime(&ts1->start);
-        if (tm1.tm_hour != 0 && tm1.tm_hour % 6 != 0)
-            continue;
-        weather_debug("start ts does start at 0, 6, 12, 18 hour UTC time");
-
-        for (j = 0; j < daydata->len; j++) {
-            weather_debug("checking end ts %d", j);
-
-            /* find end timeslice for interval */
-            ts2 = g_array_index(daydata, xml_time *, j);
-
-            if (G_UNLIKELY(ts2 == NULL))
-                continue;
-            weather_debug("end ts is not null");
-
-            /* end timeslice has to be different from the start timeslice */
-            if (ts1 == ts2)
-                continue;
-            weather_debug("start ts is different from end ts");
-
-            /* end timeslice needs to be after start timeslice */
-            if (difftime(ts2->start, ts1->start) <= 0)
-                continue;
-            weather_debug("start ts is before end ts");
-
-            /* end timeslice needs to be in max daytime interval */
-            if (difftime(ts2->start, start_t) < 0 ||
-                difftime(end_t, ts2->start) < 0)
-                continue;
-            weather_debug("end ts is in max daytime interval");
-
-            /* end timeslice needs to start at 0, 6, 12, or 18 hours UTC time */
-            tm2 = *gmtime(&ts2->start);
-            if (tm2.tm_hour != 0 && tm2.tm_hour % 6 != 0)
-                continue;
-            weather_debug("end ts does start at 0, 6, 12, 18 hour UTC time");
-
-            /* start and end timeslice need to be a 6 hours interval... */
-            if (difftime(ts2->start, ts1->start) != DAYTIME_LEN * 3600)
-                /* ...however we may need to take into account possible dst
-                   difference so let's also try DAYTIME_LEN ±1 hour */
-                if ((difftime(ts2->start, ts1->start) < (DAYTIME_LEN - 1) * 3600 ||
-                     difftime(ts2->start, ts1->start) > (DAYTIME_LEN + 1) * 3600) &&
-                    get_timeslice(wd, ts1->start, ts2->end, NULL) == NULL)
-                    continue;
-            weather_debug("start and end ts are 6 hours apart");
-
-            /* daytime point needs to be within the interval */
-            if (difftime(point_t, ts1->start) < 0 ||
-                difftime(ts2->start, point_t) < 0)
-                continue;
-            weather_debug("daytime point is within the found interval");
-
-            /* check whether the desired interval exists */
-            interval = get_timeslice(wd, ts1->start, ts2->end, NULL);
-            if (interval == NULL)
-                continue;
-
-            /* make and return a combined interval with interpolated data */
-            weather_debug("returning valid interval");
-            return make_combined_timeslice(wd, interval, &point_t, FALSE);
-        }
+        /* make and return a combined interval with interpolated data */
+        weather_debug("returning valid interval");
+        return make_combined_timeslice(wd, interval, &point_t, FALSE);
     }
 
     /* Finding a 6 hours daytime interval failed; maybe current time
@@ -1442,7 +1392,7 @@ make_forecast_data(xml_weather *wd,
         difftime(wd->current_conditions->start, start_t) >= 0 &&
         difftime(end_t, wd->current_conditions->end) >= 0) {
         interval = get_timeslice(wd, wd->current_conditions->start,
-                                 wd->current_conditions->end, NULL);
+                                 wd->current_conditions->end);
         weather_debug("returning current conditions interval for daytime %d "
                       "of day %d", dt, day);
         return make_combined_timeslice(wd, interval,
@@ -1454,3 +1404,101 @@ make_forecast_data(xml_weather *wd,
     weather_debug("no forecast data for daytime %d of day %d", dt, day);
     return NULL;
 }
+
+
+forecast_grid *
+make_forecast_grid(void)
+{
+    forecast_grid *grid;
+
+    grid = g_slice_new0(forecast_grid);
+    grid->cells = g_ptr_array_new();
+    return grid;
+}
+
+
+static void
+forecast_grid_clear(forecast_grid *grid)
+{
+    xml_time *cell;
+    guint i;
+
+    for (i = 0; i < grid->cells->len; i++) {
+        cell = g_ptr_array_index(grid->cells, i);
+        if (cell)
+            xml_time_free(cell);
+    }
+    g_ptr_array_set_size(grid->cells, 0);
+    grid->days = 0;
+}
+
+
+/*
+ * Compute the forecast data for all days and daytimes, unless that
+ * has already been done for the given data generation.
+ */
+void
+forecast_grid_update(forecast_grid *grid,
+                     xml_weather *wd,
+                     guint generation,
+                     guint days)
+{
+    xml_time *cell;
+    daytime dt;
+    guint day;
+
+    g_assert(grid != NULL);
+    if (G_UNLIKELY(grid == NULL || wd == NULL))
+        return;
+
+    if (grid->days == days && grid->generation == generation) {
+        weather_debug("Forecast grid is up to date (generation %u).",
+                      generation);
+        return;
+    }
+
+    forecast_grid_clear(grid);
+    for (day = 0; day < days; day++)
+        for (dt = MORNING; dt <= NIGHT; dt++) {
+            cell = make_forecast_data(wd, day, dt);
+            if (cell && cell->location == NULL) {
+                xml_time_free(cell);
+                cell = NULL;
+            }
+            g_ptr_array_add(grid->cells, cell);
+        }
+    grid->days = days;
+    grid->generation = generation;
+    weather_debug("Computed forecast grid for %u days (generation %u).",
+                  days, generation);
+}
+
+
+/*
+ * Return the forecast data for a given day and daytime, or NULL if
+ * none is available.
+ */
+const xml_time *
+forecast_grid_get_cell(const forecast_grid *grid,
+                       guint day,
+                       daytime dt)
+{
+    g_assert(grid != NULL);
+    if (G_UNLIKELY(grid == NULL) || day >= grid->days)
+        return NULL;
+
+    return g_ptr_array_index(grid->cells, day * (NIGHT + 1) + dt);
+}
+
+
+void
+forecast_grid_free(forecast_grid *grid)
+{
+    g_assert(grid != NULL);
+    if (G_UNLIKELY(grid == NULL))
+        return;
+
+    forecast_grid_clear(grid);
+    g_ptr_array_free(grid->cells, TRUE);
+    g_slice_free(forecast_grid, grid);
+}
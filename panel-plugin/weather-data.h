@@ -87,6 +87,14 @@ typedef enum {
     NIGHT
 } daytime;
 
+/* forecast data for all days and daytimes, computed once per data
+   generation */
+typedef struct {
+    guint generation;
+    guint days;
+    GPtrArray *cells;           /* xml_time *, days * (NIGHT + 1) */
+} forecast_grid;
+
 typedef struct {
     gint temperature;
     gint apparent_temperature;
@@ -103,6 +111,11 @@ gdouble string_to_double(const gchar *str,
 gchar *double_to_string(gdouble val,
                         const gchar *format);
 
+gdouble calc_distance(gdouble lat1,
+                      gdouble lon1,
+                      gdouble lat2,
+                      gdouble lon2);
+
 gchar *format_date(time_t t,
                    const gchar *format,
                    gboolean local);
@@ -160,14 +173,23 @@ time_t day_at_midnight(time_t day_t,
 xml_astro *get_astro_data_for_day(const GArray *astrodata,
                                   const gint day);
 
-GArray *get_point_data_for_day(xml_weather *wd,
-                               const gint day);
-
 xml_time *make_forecast_data(xml_weather *wd,
-                             GArray *daydata,
                              gint day,
                              daytime dt);
 
+forecast_grid *make_forecast_grid(void);
+
+void forecast_grid_update(forecast_grid *grid,
+                          xml_weather *wd,
+                          guint generation,
+                          guint days);
+
+const xml_time *forecast_grid_get_cell(const forecast_grid *grid,
+                                       guint day,
+                                       daytime dt);
+
+void forecast_grid_free(forecast_grid *grid);
+
 G_END_DECLS
 
 #endif
@@ -24,6 +24,11 @@
 
 #define YESNO(bool) ((bool) ? "yes" : "no")
 
+#define DUMP_VALUE(buf, var)                                    \
+    ((var).valid                                                \
+     ? g_ascii_formatd(buf, sizeof(buf), "%.1f", (var).value)   \
+     : "(null)")
+
 
 void
 weather_debug_init(const gchar *log_domain,
@@ -237,6 +242,14 @@ static gchar *
 weather_dump_location(const xml_location *loc,
                       const gboolean interval)
 {
+    gchar alt[G_ASCII_DTOSTR_BUF_SIZE], lat[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar lon[G_ASCII_DTOSTR_BUF_SIZE], prec[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar temp[G_ASCII_DTOSTR_BUF_SIZE], wdir[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar wspeed[G_ASCII_DTOSTR_BUF_SIZE], wbf[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar hum[G_ASCII_DTOSTR_BUF_SIZE], press[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar fog[G_ASCII_DTOSTR_BUF_SIZE], cloudiness[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar cl[G_ASCII_DTOSTR_BUF_SIZE], cm[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar ch[G_ASCII_DTOSTR_BUF_SIZE];
     gchar *out;
 
     if (!loc)
@@ -245,38 +258,34 @@ weather_dump_location(const xml_location *loc,
     if (interval)
         out =
             g_strdup_printf("alt=%s, lat=%s, lon=%s, "
-                            "prec=%s %s, symid=%d (%s)",
-                            loc->altitude,
-                            loc->latitude,
-                            loc->longitude,
-                            loc->precipitation_value,
-                            loc->precipitation_unit,
+                            "prec=%s mm, symid=%d (%s)",
+                            DUMP_VALUE(alt, loc->altitude),
+                            DUMP_VALUE(lat, loc->latitude),
+                            DUMP_VALUE(lon, loc->longitude),
+                            DUMP_VALUE(prec, loc->precipitation),
                             loc->symbol_id,
                             loc->symbol);
     else
         out =
-            g_strdup_printf("alt=%s, lat=%s, lon=%s, temp=%s %s, "
-                            "wind=%s %s° %s m/s (%s bf), "
-                            "hum=%s %s, press=%s %s, fog=%s, cloudiness=%s, "
+            g_strdup_printf("alt=%s, lat=%s, lon=%s, temp=%s °C, "
+                            "wind=%s° %s m/s (%s bf), "
+                            "hum=%s %%, press=%s hPa, fog=%s, cloudiness=%s, "
                             "cl=%s, cm=%s, ch=%s)",
-                            loc->altitude,
-                            loc->latitude,
-                            loc->longitude,
-                            loc->temperature_value,
-                            loc->temperature_unit,
-                            loc->wind_dir_name,
-                            loc->wind_dir_deg,
-                            loc->wind_speed_mps,
-                            loc->wind_speed_beaufort,
-                            loc->humidity_value,
-                            loc->humidity_unit,
-                            loc->pressure_value,
-                            loc->pressure_unit,
-                            loc->fog_percent,
-                            loc->clouds_percent[CLOUDS_PERC_CLOUDINESS],
-                            loc->clouds_percent[CLOUDS_PERC_LOW],
-                            loc->clouds_percent[CLOUDS_PERC_MID],
-                            loc->clouds_percent[CLOUDS_PERC_HIGH]);
+                            DUMP_VALUE(alt, loc->altitude),
+                            DUMP_VALUE(lat, loc->latitude),
+                            DUMP_VALUE(lon, loc->longitude),
+                            DUMP_VALUE(temp, loc->temperature),
+                            DUMP_VALUE(wdir, loc->wind_dir_deg),
+                            DUMP_VALUE(wspeed, loc->wind_speed_mps),
+                            DUMP_VALUE(wbf, loc->wind_speed_beaufort),
+                            DUMP_VALUE(hum, loc->humidity),
+                            DUMP_VALUE(press, loc->pressure),
+                            DUMP_VALUE(fog, loc->fog_percent),
+                            DUMP_VALUE(cloudiness,
+                                       loc->clouds_percent[CLOUDS_PERC_CLOUDINESS]),
+                            DUMP_VALUE(cl, loc->clouds_percent[CLOUDS_PERC_LOW]),
+                            DUMP_VALUE(cm, loc->clouds_percent[CLOUDS_PERC_MID]),
+                            DUMP_VALUE(ch, loc->clouds_percent[CLOUDS_PERC_HIGH]));
     return out;
 }
 
@@ -376,7 +385,8 @@ weather_dump_plugindata(const plugin_data *data)
     GString *out;
     gchar *last_astro_update, *last_weather_update, *last_conditions_update;
     gchar *next_astro_update, *next_weather_update, *next_conditions_update;
-    gchar *next_wakeup, *result;
+    gchar *next_wakeup, *weather_expires, *result;
+    weather_cache_store_stats stats;
 
     last_astro_update = format_date(data->astro_update->last, "%c", TRUE);
     last_weather_update = format_date(data->weather_update->last, "%c", TRUE);
@@ -384,6 +394,7 @@ weather_dump_plugindata(const plugin_data *data)
         format_date(data->conditions_update->last, "%c", TRUE);
     next_astro_update = format_date(data->astro_update->next, "%c", TRUE);
     next_weather_update = format_date(data->weather_update->next, "%c", TRUE);
+    weather_expires = format_date(data->weather_update->expires, "%c", TRUE);
     next_conditions_update =
         format_date(data->conditions_update->next, "%c", TRUE);
     next_wakeup = format_date(data->next_wakeup, "%c", TRUE);
@@ -401,13 +412,20 @@ weather_dump_plugindata(const plugin_data *data)
                            "  upower on battery: %s\n"
 #endif
                            "  power saving: %s\n"
+                           "  download astro data: %s\n"
+                           "  shared downloads: %s\n"
                            "  --------------------------------------------\n"
                            "  last astro update: %s\n"
                            "  next astro update: %s\n"
                            "  astro download attempts: %u\n"
+                           "  astro retry policy: %s, %u failures, "
+                           "delay %u s, breaker %s\n"
                            "  last weather update: %s\n"
                            "  next weather update: %s\n"
+                           "  weather data expires: %s\n"
                            "  weather download attempts: %u\n"
+                           "  weather retry policy: %s, %u failures, "
+                           "delay %u s, breaker %s\n"
                            "  last conditions update: %s\n"
                            "  next conditions update: %s\n"
                            "  next scheduled wakeup: %s\n"
@@ -444,12 +462,23 @@ weather_dump_plugindata(const plugin_data *data)
                            YESNO(data->upower_on_battery),
 #endif
                            YESNO(data->power_saving),
+                           YESNO(data->astro_download),
+                           YESNO(data->shared_downloads),
                            last_astro_update,
                            next_astro_update,
                            data->astro_update->attempt,
+                           weather_backoff_policy_name(&data->astro_update->backoff),
+                           data->astro_update->backoff.failures,
+                           data->astro_update->backoff.delay,
+                           weather_backoff_breaker_name(&data->astro_update->backoff),
                            last_weather_update,
                            next_weather_update,
+                           weather_expires,
                            data->weather_update->attempt,
+                           weather_backoff_policy_name(&data->weather_update->backoff),
+                           data->weather_update->backoff.failures,
+                           data->weather_update->backoff.delay,
+                           weather_backoff_breaker_name(&data->weather_update->backoff),
                            last_conditions_update,
                            next_conditions_update,
                            next_wakeup,
@@ -473,9 +502,26 @@ weather_dump_plugindata(const plugin_data *data)
                            gdk_rgba_to_string(&(data->scrollbox_color)),
                            YESNO(data->scrollbox_use_color),
                            YESNO(data->scrollbox_animate));
+
+    weather_cache_store_get_stats(data->cache_store, &stats);
+    g_string_append_printf(out,
+                           "\n  cache hits: %u\n"
+                           "  cache misses: %u\n"
+                           "  cache evictions: %u\n"
+                           "  cache entries: %u\n"
+                           "  cache size: %" G_GUINT64_FORMAT " bytes\n"
+                           "  cache max size: %" G_GUINT64_FORMAT " bytes\n"
+                           "  --------------------------------------------",
+                           stats.hits,
+                           stats.misses,
+                           stats.evictions,
+                           stats.entries,
+                           stats.size,
+                           stats.max_size);
     g_free(next_wakeup);
     g_free(next_astro_update);
     g_free(next_weather_update);
+    g_free(weather_expires);
     g_free(next_conditions_update);
     g_free(last_astro_update);
     g_free(last_weather_update);
@@ -37,16 +37,42 @@ G_BEGIN_DECLS
 #endif
 #endif
 
-#define weather_debug(...)                                  \
-    weather_debug_real(G_LOG_DOMAIN, __FILE__, __func__,    \
-                       __LINE__, __VA_ARGS__)
-
-#define weather_dump(func, data)                \
-    if (G_UNLIKELY(debug_mode)) {               \
-        gchar *dump_msg = func(data);                \
-        weather_debug("%s", dump_msg);               \
-        g_free(dump_msg);                            \
-    }
+/*
+ * Arguments are only evaluated if debug mode is active. Building with
+ * WEATHER_DISABLE_DEBUG turns all of this into dead code, which is
+ * still type checked but removed by the compiler.
+ */
+#ifdef WEATHER_DISABLE_DEBUG
+#define weather_debug_enabled() FALSE
+#else
+#define weather_debug_enabled() G_UNLIKELY(debug_mode)
+#endif
+
+#define weather_debug(...)                                      \
+    G_STMT_START {                                              \
+        if (weather_debug_enabled())                            \
+            weather_debug_real(G_LOG_DOMAIN, __FILE__, __func__, \
+                               __LINE__, __VA_ARGS__);          \
+    } G_STMT_END
+
+#define weather_dump(func, data)                        \
+    G_STMT_START {                                      \
+        if (weather_debug_enabled()) {                  \
+            gchar *dump_msg = func(data);               \
+            weather_debug("%s", dump_msg);              \
+            g_free(dump_msg);                           \
+        }                                               \
+    } G_STMT_END
+
+/* format is a message with a single %s for the date */
+#define weather_debug_date(format, date_t, date_format, local)          \
+    G_STMT_START {                                                      \
+        if (weather_debug_enabled()) {                                  \
+            gchar *dump_date = format_date(date_t, date_format, local); \
+            weather_debug(format, dump_date);                           \
+            g_free(dump_date);                                          \
+        }                                                               \
+    } G_STMT_END
 
 void weather_debug_init(const gchar *log_domain,
                         gboolean debug_mode);
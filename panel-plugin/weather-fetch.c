@@ -0,0 +1,372 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * A batch of HTTP requests that are sent concurrently, with a limit on
+ * the number of requests in flight to each host. A request that fails
+ * is retried on its own after a randomized delay, without repeating the
+ * ones that succeeded, unless retrying it is pointless. Once every
+ * request has either succeeded or given up, the done function is
+ * called, which is the only point the caller needs to synchronize on.
+ *
+ * Requests in flight keep a reference to the batch, so it may be freed
+ * at any time, even from within the done function. Freeing the batch
+ * cancels the requests still in flight, their responses are ignored.
+ */
+
+#include "weather-fetch.h"
+#include "weather-backoff.h"
+#include "weather-scheduler.h"
+#include "weather-debug.h"
+#include "weather.h"
+
+#define FETCH_RETRY_DELAY 10            /* seconds, grows with jitter */
+#define FETCH_RETRY_MAX_DELAY 120
+
+
+typedef struct {
+    weather_fetch *fetch;
+    gchar *uri;
+    gchar *host;
+    WeatherFetchFunc func;
+    gpointer data;
+    guint attempt;
+    guint delay;                    /* seconds before the last retry */
+} fetch_request;
+
+struct _weather_fetch {
+    gint ref_count;
+    SoupSession *session;
+    GCancellable *cancellable;      /* of the requests in flight */
+    weather_schedule_priority priority;
+    guint max_per_host;
+    guint max_attempts;
+    GQueue *waiting;                /* requests ready to be sent */
+    GHashTable *in_flight;          /* host -> number of requests */
+    guint unfinished;
+    guint failed;
+    guint failed_status;            /* of the last request given up */
+    gboolean started;
+    gboolean cancelled;
+    WeatherFetchDoneFunc done_func;
+    gpointer user_data;
+};
+
+
+static void fetch_dispatch(weather_fetch *fetch);
+
+
+static weather_fetch *
+fetch_ref(weather_fetch *fetch)
+{
+    fetch->ref_count++;
+    return fetch;
+}
+
+
+static void
+fetch_unref(weather_fetch *fetch)
+{
+    if (--fetch->ref_count > 0)
+        return;
+    g_queue_free(fetch->waiting);
+    g_hash_table_destroy(fetch->in_flight);
+    g_object_unref(fetch->session);
+    g_object_unref(fetch->cancellable);
+    g_slice_free(weather_fetch, fetch);
+}
+
+
+static void
+fetch_request_free(fetch_request *req)
+{
+    g_free(req->uri);
+    g_free(req->host);
+    g_slice_free(fetch_request, req);
+}
+
+
+static guint
+fetch_get_in_flight(weather_fetch *fetch,
+                    const gchar *host)
+{
+    return GPOINTER_TO_UINT(g_hash_table_lookup(fetch->in_flight, host));
+}
+
+
+static void
+fetch_set_in_flight(weather_fetch *fetch,
+                    const gchar *host,
+                    guint count)
+{
+    if (count > 0)
+        g_hash_table_insert(fetch->in_flight, g_strdup(host),
+                            GUINT_TO_POINTER(count));
+    else
+        g_hash_table_remove(fetch->in_flight, host);
+}
+
+
+/* a request is finished for good, check whether the batch is done */
+static void
+fetch_request_finish(fetch_request *req,
+                     gboolean success)
+{
+    weather_fetch *fetch = req->fetch;
+
+    if (!success)
+        fetch->failed++;
+    fetch_request_free(req);
+    if (--fetch->unfinished == 0) {
+        weather_debug("All requests finished, %u failed.", fetch->failed);
+        fetch->done_func(fetch, fetch->failed, fetch->user_data);
+    }
+}
+
+
+static gboolean
+fetch_retry(gpointer user_data)
+{
+    fetch_request *req = user_data;
+    weather_fetch *fetch = req->fetch;
+
+    if (fetch->cancelled)
+        fetch_request_free(req);
+    else {
+        g_queue_push_tail(fetch->waiting, req);
+        fetch_dispatch(fetch);
+    }
+    fetch_unref(fetch);
+    return G_SOURCE_REMOVE;
+}
+
+
+static void
+fetch_response(fetch_request *req,
+               guint status,
+               const gchar *body,
+               gsize len)
+{
+    weather_fetch *fetch = req->fetch;
+    gboolean success = FALSE;
+
+    fetch_set_in_flight(fetch, req->host,
+                        fetch_get_in_flight(fetch, req->host) - 1);
+    if (fetch->cancelled) {
+        fetch_request_free(req);
+        fetch_unref(fetch);
+        return;
+    }
+
+    if (SOUP_STATUS_IS_SUCCESSFUL(status))
+        success = req->func(status, body, len, req->data,
+                            fetch->user_data);
+    else
+        g_warning_once("Download of %s failed with HTTP Status Code %u.",
+                       req->uri, status);
+
+    if (success)
+        fetch_request_finish(req, TRUE);
+    else if (req->attempt < fetch->max_attempts &&
+             weather_backoff_classify(status) != WEATHER_FAILURE_PERMANENT) {
+        req->delay = weather_backoff_jitter(FETCH_RETRY_DELAY,
+                                            FETCH_RETRY_MAX_DELAY,
+                                            req->delay);
+        weather_debug("Retrying %s in %u seconds.", req->uri, req->delay);
+        g_timeout_add_seconds(req->delay, fetch_retry, req);
+        fetch_ref(fetch);
+    } else {
+        weather_debug("Giving up on %s after %u attempts.",
+                      req->uri, req->attempt);
+        fetch->failed_status = status;
+        fetch_request_finish(req, FALSE);
+    }
+
+    /* the done function may have cancelled the batch */
+    if (!fetch->cancelled)
+        fetch_dispatch(fetch);
+    fetch_unref(fetch);
+}
+
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+cb_fetch_response(GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    fetch_request *req = user_data;
+    SoupMessage *msg;
+    GBytes *response;
+    GError *error = NULL;
+    const gchar *body = NULL;
+    gsize len = 0;
+    guint status;
+
+    msg = soup_session_get_async_result_message(SOUP_SESSION(source), result);
+    response = soup_session_send_and_read_finish(SOUP_SESSION(source),
+                                                 result, &error);
+    if (G_LIKELY(error == NULL)) {
+        status = soup_message_get_status(msg);
+        body = g_bytes_get_data(response, &len);
+    } else {
+        weather_debug("Download of %s failed: %s", req->uri, error->message);
+        status = SOUP_STATUS_NONE;
+        g_error_free(error);
+    }
+    fetch_response(req, status, body, len);
+    if (response)
+        g_bytes_unref(response);
+}
+#else
+static void
+cb_fetch_response(SoupSession *session,
+                  SoupMessage *msg,
+                  gpointer user_data)
+{
+    fetch_request *req = user_data;
+
+    if (msg->response_body && msg->response_body->data)
+        fetch_response(req, msg->status_code, msg->response_body->data,
+                       msg->response_body->length);
+    else
+        fetch_response(req, msg->status_code, NULL, 0);
+}
+#endif
+
+
+static void
+fetch_send(weather_fetch *fetch,
+           fetch_request *req)
+{
+    req->attempt++;
+    fetch_set_in_flight(fetch, req->host,
+                        fetch_get_in_flight(fetch, req->host) + 1);
+    fetch_ref(fetch);
+    weather_debug("Sending request %s (attempt %u).", req->uri, req->attempt);
+
+    weather_http_queue_request(fetch->session, req->uri, fetch->priority,
+                               fetch->cancellable, cb_fetch_response, req);
+}
+
+
+/* send waiting requests as long as their host has capacity left */
+static void
+fetch_dispatch(weather_fetch *fetch)
+{
+    GList *item, *next;
+    fetch_request *req;
+
+    for (item = fetch->waiting->head; item != NULL; item = next) {
+        next = item->next;
+        req = item->data;
+        if (fetch_get_in_flight(fetch, req->host) >= fetch->max_per_host)
+            continue;
+        g_queue_delete_link(fetch->waiting, item);
+        fetch_send(fetch, req);
+    }
+}
+
+
+weather_fetch *
+weather_fetch_new(SoupSession *session,
+                  weather_schedule_priority priority,
+                  guint max_per_host,
+                  guint max_attempts,
+                  WeatherFetchDoneFunc done_func,
+                  gpointer user_data)
+{
+    weather_fetch *fetch;
+
+    g_assert(session != NULL && done_func != NULL);
+    fetch = g_slice_new0(weather_fetch);
+    fetch->ref_count = 1;
+    fetch->session = g_object_ref(session);
+    fetch->cancellable = g_cancellable_new();
+    fetch->priority = priority;
+    fetch->max_per_host = MAX(max_per_host, 1);
+    fetch->max_attempts = MAX(max_attempts, 1);
+    fetch->waiting = g_queue_new();
+    fetch->in_flight = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, NULL);
+    fetch->done_func = done_func;
+    fetch->user_data = user_data;
+    return fetch;
+}
+
+
+
+/* the status of the last request that was given up, if any */
+guint
+weather_fetch_get_failed_status(const weather_fetch *fetch)
+{
+    g_assert(fetch != NULL);
+    return fetch->failed_status;
+}
+
+/*
+ * Add a request to the batch. The request data is not freed by the
+ * batch and needs to stay valid until it is done or freed.
+ */
+void
+weather_fetch_add(weather_fetch *fetch,
+                  const gchar *uri,
+                  WeatherFetchFunc func,
+                  gpointer request_data)
+{
+    fetch_request *req;
+
+    g_assert(fetch != NULL && uri != NULL && func != NULL);
+    g_assert(!fetch->started);
+
+    req = g_slice_new0(fetch_request);
+    req->fetch = fetch;
+    req->uri = g_strdup(uri);
+    req->host = weather_scheduler_get_host(uri);
+    req->func = func;
+    req->data = request_data;
+    g_queue_push_tail(fetch->waiting, req);
+    fetch->unfinished++;
+}
+
+
+void
+weather_fetch_start(weather_fetch *fetch)
+{
+    g_assert(fetch != NULL && !fetch->started);
+    fetch->started = TRUE;
+    if (fetch->unfinished == 0) {
+        fetch->done_func(fetch, 0, fetch->user_data);
+        return;
+    }
+    fetch_dispatch(fetch);
+}
+
+
+/* cancel what has not finished yet, the done function is not called */
+void
+weather_fetch_free(weather_fetch *fetch)
+{
+    if (G_UNLIKELY(fetch == NULL))
+        return;
+    fetch->cancelled = TRUE;
+    g_cancellable_cancel(fetch->cancellable);
+    g_queue_free_full(fetch->waiting, (GDestroyNotify) fetch_request_free);
+    fetch->waiting = g_queue_new();
+    fetch_unref(fetch);
+}
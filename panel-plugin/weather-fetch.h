@@ -0,0 +1,64 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __WEATHER_FETCH_H__
+#define __WEATHER_FETCH_H__
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include "weather-scheduler.h"
+
+G_BEGIN_DECLS
+
+typedef struct _weather_fetch weather_fetch;
+
+/* called for a successful response, returns whether it could be used */
+typedef gboolean (*WeatherFetchFunc) (guint status,
+                                      const gchar *body,
+                                      gsize len,
+                                      gpointer request_data,
+                                      gpointer user_data);
+
+/* called once after all requests have finished or given up */
+typedef void (*WeatherFetchDoneFunc) (weather_fetch *fetch,
+                                      guint failed,
+                                      gpointer user_data);
+
+
+weather_fetch *weather_fetch_new(SoupSession *session,
+                                 weather_schedule_priority priority,
+                                 guint max_per_host,
+                                 guint max_attempts,
+                                 WeatherFetchDoneFunc done_func,
+                                 gpointer user_data);
+
+void weather_fetch_add(weather_fetch *fetch,
+                       const gchar *uri,
+                       WeatherFetchFunc func,
+                       gpointer request_data);
+
+void weather_fetch_start(weather_fetch *fetch);
+
+guint weather_fetch_get_failed_status(const weather_fetch *fetch);
+
+void weather_fetch_free(weather_fetch *fetch);
+
+G_END_DECLS
+
+#endif
@@ -31,6 +31,14 @@
 #define ICON_DIR_SMALL "22"
 #define ICON_DIR_MEDIUM "48"
 #define ICON_DIR_BIG "128"
+#define ICON_CACHE_MAX 128
+
+
+/* decoded icons and icons known to be missing, per theme */
+struct _icon_cache {
+    GHashTable *surfaces;       /* size@scale/symbol+suffix -> surface */
+    GHashTable *missing;        /* sizedir/symbol+suffix */
+};
 
 
 static const gchar *symbol_names[] = {
@@ -73,27 +81,42 @@ const gchar *get_symbol_name(gint idx)
 }
 
 
+static icon_cache *
+make_icon_cache(void)
+{
+    icon_cache *cache = g_slice_new0(icon_cache);
+
+    cache->surfaces =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                              (GDestroyNotify) cairo_surface_destroy);
+    cache->missing =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    return cache;
+}
+
+
+static void
+icon_cache_free(icon_cache *cache)
+{
+    g_hash_table_destroy(cache->surfaces);
+    g_hash_table_destroy(cache->missing);
+    g_slice_free(icon_cache, cache);
+}
+
+
 static gboolean
 icon_missing(const icon_theme *theme,
              const gchar *sizedir,
              const gchar *symbol_name,
              const gchar *suffix)
 {
-    gchar *missing, *icon;
-    guint i;
+    gchar *icon;
+    gboolean missing;
 
     icon = g_strconcat(sizedir, G_DIR_SEPARATOR_S, symbol_name, suffix, NULL);
-    for (i = 0; i < theme->missing_icons->len; i++) {
-        missing = g_array_index(theme->missing_icons, gchar *, i);
-        if (G_UNLIKELY(missing == NULL))
-            continue;
-        if (strcmp(missing, icon) == 0) {
-            g_free(icon);
-            return TRUE;
-        }
-    }
+    missing = g_hash_table_contains(theme->cache->missing, icon);
     g_free(icon);
-    return FALSE;
+    return missing;
 }
 
 
@@ -106,8 +129,8 @@ remember_missing_icon(const icon_theme *theme,
     gchar *icon;
 
     icon = g_strconcat(sizedir, G_DIR_SEPARATOR_S, symbol_name, suffix, NULL);
-    g_array_append_val(theme->missing_icons, icon);
     weather_debug("Remembered missing icon %s.", icon);
+    g_hash_table_add(theme->cache->missing, icon);
 }
 
 
@@ -173,34 +196,26 @@ quiet_gdk_pixbuf_new_from_file_at_scale(const char *filename,
 }
 
 
-cairo_surface_t *
-get_icon(const icon_theme *theme,
-         const gchar *symbol_name,
-         const gint _size,
-         gint scale,
-         const gboolean night)
+/*
+ * Read an icon from disk, falling back to the day icon for night
+ * symbols, to the NODATA icon of the theme and finally to the NODATA
+ * icon of the standard theme.
+ */
+static cairo_surface_t *
+load_icon(const icon_theme *theme,
+          const gchar *sizedir,
+          const gchar *symbol_name,
+          const gchar *suffix,
+          const gint _size,
+          gint scale,
+          const gboolean night)
 {
     GdkPixbuf *image = NULL;
     cairo_surface_t *icon = NULL;
-    const gchar *sizedir;
-    gchar *filename = NULL, *suffix = "";
+    gchar *filename = NULL;
     GError *error = NULL;
     gint size = _size * scale;
 
-    g_assert(theme != NULL);
-    if (G_UNLIKELY(!theme)) {
-        g_warning("No icon theme!");
-        return NULL;
-    }
-
-    /* choose icons from directory best matching the requested size */
-    sizedir = get_icon_sizedir(size);
-
-    if (symbol_name == NULL || strlen(symbol_name) == 0)
-        symbol_name = symbol_names[SYMBOL_NODATA];
-    else if (night)
-        suffix = "-night";
-
     /* check whether icon has been verified to be missing before */
     if (!icon_missing(theme, sizedir, symbol_name, suffix)) {
         filename = make_icon_filename(theme, sizedir, symbol_name, suffix);
@@ -247,6 +262,57 @@ get_icon(const icon_theme *theme,
 }
 
 
+/*
+ * Return a new reference to the icon for a symbol, which is only
+ * read from disk on first use.
+ */
+cairo_surface_t *
+get_icon(const icon_theme *theme,
+         const gchar *symbol_name,
+         const gint _size,
+         gint scale,
+         const gboolean night)
+{
+    cairo_surface_t *icon;
+    const gchar *sizedir;
+    gchar *suffix = "", *key;
+
+    g_assert(theme != NULL);
+    if (G_UNLIKELY(!theme)) {
+        g_warning("No icon theme!");
+        return NULL;
+    }
+
+    /* choose icons from directory best matching the requested size */
+    sizedir = get_icon_sizedir(_size * scale);
+
+    if (symbol_name == NULL || strlen(symbol_name) == 0)
+        symbol_name = symbol_names[SYMBOL_NODATA];
+    else if (night)
+        suffix = "-night";
+
+    /* widgets on monitors of different scales share the cache */
+    key = g_strdup_printf("%d@%d/%s%s", _size, scale, symbol_name, suffix);
+    icon = g_hash_table_lookup(theme->cache->surfaces, key);
+    if (icon) {
+        g_free(key);
+        return cairo_surface_reference(icon);
+    }
+    icon = load_icon(theme, sizedir, symbol_name, suffix, _size, scale, night);
+    if (G_LIKELY(icon)) {
+        /* keep the cache bounded, it is refilled quickly */
+        if (g_hash_table_size(theme->cache->surfaces) >= ICON_CACHE_MAX) {
+            weather_debug("Icon cache is full, clearing it.");
+            g_hash_table_remove_all(theme->cache->surfaces);
+        }
+        g_hash_table_insert(theme->cache->surfaces, key,
+                            cairo_surface_reference(icon));
+    } else
+        g_free(key);
+    return icon;
+}
+
+
 /*
  * Create a new icon theme struct, initializing caches to undefined.
  */
@@ -258,7 +324,7 @@ make_icon_theme(void)
     g_assert(theme != NULL);
     if (theme == NULL)
         return NULL;
-    theme->missing_icons = g_array_new(FALSE, TRUE, sizeof(gchar *));
+    theme->cache = make_icon_cache();
     return theme;
 }
 
@@ -513,9 +579,6 @@ icon_theme_copy(icon_theme *src)
 void
 icon_theme_free(icon_theme *theme)
 {
-    gchar *missing;
-    guint i;
-
     g_assert(theme != NULL);
     if (G_UNLIKELY(theme == NULL))
         return;
@@ -524,10 +587,6 @@ icon_theme_free(icon_theme *theme)
     g_free(theme->author);
     g_free(theme->description);
     g_free(theme->license);
-    for (i = 0; i < theme->missing_icons->len; i++) {
-        missing = g_array_index(theme->missing_icons, gchar *, i);
-        g_free(missing);
-    }
-    g_array_free(theme->missing_icons, FALSE);
+    icon_cache_free(theme->cache);
     g_slice_free(icon_theme, theme);
 }
@@ -49,13 +49,15 @@ typedef enum {
     SYMBOL_COUNT
 } symbol_ids;
 
+typedef struct _icon_cache icon_cache;
+
 typedef struct {
     gchar *dir;
     gchar *name;
     gchar *author;
     gchar *description;
     gchar *license;
-    GArray *missing_icons;
+    icon_cache *cache;
 } icon_theme;
 
 
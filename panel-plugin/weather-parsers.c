@@ -30,6 +30,7 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -90,29 +91,198 @@ remove_timezone_offset(const gchar *date)
 }
 
 
+static guint
+timeslice_hash(gconstpointer key)
+{
+    const xml_time *ts = key;
+
+    return (guint) ts->start * 2654435761u ^ (guint) ts->end;
+}
+
+
+static gboolean
+timeslice_equal(gconstpointer a,
+                gconstpointer b)
+{
+    const xml_time *ts1 = a, *ts2 = b;
+
+    return ts1->start == ts2->start && ts1->end == ts2->end;
+}
+
+
 xml_time *
 get_timeslice(xml_weather *wd,
               const time_t start_t,
-              const time_t end_t,
-              guint *index)
+              const time_t end_t)
 {
-    xml_time *timeslice;
-    guint i;
+    xml_time key;
 
     g_assert(wd != NULL);
     if (G_UNLIKELY(wd == NULL))
         return NULL;
 
-    for (i = 0; i < wd->timeslices->len; i++) {
-        timeslice = g_array_index(wd->timeslices, xml_time *, i);
-        if (timeslice &&
-            timeslice->start == start_t && timeslice->end == end_t) {
-            if (index != NULL)
-                *index = i;
-            return timeslice;
+    key.start = start_t;
+    key.end = end_t;
+    return g_hash_table_lookup(wd->timeslice_index, &key);
+}
+
+
+/*
+ * Add a timeslice to the weather data. Any existing timeslice with
+ * the same interval must have been removed before.
+ */
+void
+add_timeslice(xml_weather *wd,
+              xml_time *timeslice)
+{
+    g_array_append_val(wd->timeslices, timeslice);
+    g_hash_table_add(wd->timeslice_index, timeslice);
+    wd->series_dirty = TRUE;
+}
+
+
+static xml_time_series *
+make_time_series(guint size)
+{
+    xml_time_series *series;
+
+    series = g_slice_new0(xml_time_series);
+    series->start = g_array_sized_new(FALSE, FALSE, sizeof(time_t), size);
+    series->end = g_array_sized_new(FALSE, FALSE, sizeof(time_t), size);
+    series->timeslices =
+        g_array_sized_new(FALSE, FALSE, sizeof(xml_time *), size);
+    return series;
+}
+
+
+static void
+time_series_append(xml_time_series *series,
+                   xml_time *timeslice)
+{
+    g_array_append_val(series->start, timeslice->start);
+    g_array_append_val(series->end, timeslice->end);
+    g_array_append_val(series->timeslices, timeslice);
+}
+
+
+static void
+time_series_free(xml_time_series *series)
+{
+    if (series == NULL)
+        return;
+    g_array_free(series->start, TRUE);
+    g_array_free(series->end, TRUE);
+    g_array_free(series->timeslices, TRUE);
+    g_slice_free(xml_time_series, series);
+}
+
+
+/*
+ * Index the intervals usable for the forecast by the 6 hour UTC slot
+ * they start in. Both start and end need to be at 0, 6, 12 or 18
+ * hours UTC time and have point data available. If there are several
+ * such intervals starting at the same time, the shortest one is used.
+ */
+static void
+index_forecast_intervals(xml_weather *wd)
+{
+    xml_time_series *intervals = wd->intervals;
+    xml_time *interval;
+    time_t start_t, end_t;
+    guint i, slot;
+
+    g_array_set_size(wd->forecast_intervals, 0);
+    wd->forecast_base = 0;
+    for (i = 0; i < intervals->start->len; i++) {
+        start_t = g_array_index(intervals->start, time_t, i);
+        end_t = g_array_index(intervals->end, time_t, i);
+        if (start_t % FORECAST_INTERVAL_LEN != 0 ||
+            end_t % FORECAST_INTERVAL_LEN != 0 ||
+            get_timeslice(wd, start_t, start_t) == NULL ||
+            get_timeslice(wd, end_t, end_t) == NULL)
+            continue;
+
+        /* the series is sorted, so the first one determines the base */
+        if (wd->forecast_base == 0)
+            wd->forecast_base = start_t;
+        slot = (start_t - wd->forecast_base) / FORECAST_INTERVAL_LEN;
+        if (slot >= wd->forecast_intervals->len)
+            g_array_set_size(wd->forecast_intervals, slot + 1);
+        if (g_array_index(wd->forecast_intervals, xml_time *, slot) == NULL) {
+            interval = g_array_index(intervals->timeslices, xml_time *, i);
+            g_array_index(wd->forecast_intervals, xml_time *, slot) = interval;
         }
     }
-    return NULL;
+}
+
+
+/*
+ * Return the forecast interval starting at the given time, which
+ * needs to be at 0, 6, 12 or 18 hours UTC time, or NULL.
+ */
+xml_time *
+get_forecast_interval(xml_weather *wd,
+                      time_t slot_t)
+{
+    guint slot;
+
+    g_assert(!wd->series_dirty && wd->intervals != NULL);
+    xml_weather_update_series(wd);
+    if (wd->forecast_base == 0 || slot_t < wd->forecast_base)
+        return NULL;
+
+    slot = (slot_t - wd->forecast_base) / FORECAST_INTERVAL_LEN;
+    if (slot >= wd->forecast_intervals->len)
+        return NULL;
+    return g_array_index(wd->forecast_intervals, xml_time *, slot);
+}
+
+
+/*
+ * Rebuild the point and interval data time series if the timeslices
+ * have changed since they were last built. This must be done before
+ * the weather data is published, the functions searching the series
+ * only rebuild them if that has been missed.
+ */
+void
+xml_weather_update_series(xml_weather *wd)
+{
+    GArray *sorted;
+    xml_time *timeslice;
+    guint i;
+
+    g_assert(wd != NULL);
+    if (G_UNLIKELY(wd == NULL))
+        return;
+
+    if (!wd->series_dirty && wd->points && wd->intervals)
+        return;
+
+    time_series_free(wd->points);
+    time_series_free(wd->intervals);
+    wd->points = make_time_series(wd->timeslices->len / 2);
+    wd->intervals = make_time_series(wd->timeslices->len / 2);
+
+    sorted = g_array_sized_new(FALSE, FALSE, sizeof(xml_time *),
+                               wd->timeslices->len);
+    g_array_append_vals(sorted, wd->timeslices->data, wd->timeslices->len);
+    g_array_sort(sorted, (GCompareFunc) xml_time_compare);
+    for (i = 0; i < sorted->len; i++) {
+        timeslice = g_array_index(sorted, xml_time *, i);
+        if (G_UNLIKELY(timeslice == NULL))
+            continue;
+        if (timeslice_is_interval(timeslice))
+            time_series_append(wd->intervals, timeslice);
+        else
+            time_series_append(wd->points, timeslice);
+    }
+    g_array_free(sorted, TRUE);
+
+    index_forecast_intervals(wd);
+    wd->current_interval = wd->current_start = wd->current_end = NULL;
+    wd->series_dirty = FALSE;
+    weather_debug("Rebuilt time series with %u point and %u interval entries.",
+                  wd->points->timeslices->len, wd->intervals->timeslices->len);
 }
 
 
@@ -128,11 +298,11 @@ get_astro(const GArray *astrodata,
     if (G_UNLIKELY(astrodata == NULL))
         return NULL;
 
-    weather_debug("day_t=%s", format_date(day_t, NULL,TRUE));
+    weather_debug_date("day_t=%s", day_t, NULL, TRUE);
     for (i = 0; i < astrodata->len; i++) {
         astro = g_array_index(astrodata, xml_astro *, i);
         if (astro) {
-            weather_debug("astro->day=%s", format_date(astro->day, NULL,TRUE));
+            weather_debug_date("astro->day=%s", astro->day, NULL, TRUE);
             if (astro->day == day_t) {
                 if (index != NULL)
                     *index = i;
@@ -179,7 +349,7 @@ parse_timestring(const gchar *ts,
 }
 
 
-static const gchar *
+const gchar *
 parse_moonposition (gdouble pos_in) {
     gdouble pos = pos_in / 360.0 * 100.0;
     if (pos < 0.0 || pos > 100.0)
@@ -202,97 +372,103 @@ parse_moonposition (gdouble pos_in) {
 }
 
 
+/* look up an attribute in the attribute list of a SAX callback */
+static gchar *
+sax_prop(const xmlChar **atts,
+         const gchar *prop)
+{
+    if (atts == NULL)
+        return NULL;
+    for (; atts[0] != NULL; atts += 2)
+        if (xmlStrEqual(atts[0], (const xmlChar *) prop))
+            return g_strdup((const gchar *) atts[1]);
+    return NULL;
+}
+
+
+/*
+ * A value is only valid if the whole attribute is a finite number, so
+ * that a truncated or garbled value is not shown as 0 or as a prefix.
+ */
 static void
-parse_location(xmlNode *cur_node,
-               xml_location *loc)
+parse_value(xml_value *val,
+            const xmlChar **atts,
+            const gchar *prop)
 {
-    xmlNode *child_node;
+    gchar *str, *end = NULL;
+
+    str = sax_prop(atts, prop);
+    val->value = 0;
+    val->valid = FALSE;
+    if (str != NULL && *str != '\0') {
+        val->value = g_ascii_strtod(str, &end);
+        val->valid = (*end == '\0' && isfinite(val->value));
+        if (!val->valid)
+            val->value = 0;
+    }
+    g_free(str);
+}
 
-    g_free(loc->altitude);
-    loc->altitude = PROP(cur_node, "altitude");
 
-    g_free(loc->latitude);
-    loc->latitude = PROP(cur_node, "latitude");
+static void
+parse_location_attributes(xml_location *loc,
+                          const xmlChar **atts)
+{
+    parse_value(&loc->altitude, atts, "altitude");
+    parse_value(&loc->latitude, atts, "latitude");
+    parse_value(&loc->longitude, atts, "longitude");
+}
 
-    g_free(loc->longitude);
-    loc->longitude = PROP(cur_node, "longitude");
 
-    for (child_node = cur_node->children; child_node;
-         child_node = child_node->next) {
-        if (NODE_IS_TYPE(child_node, "temperature")) {
-            g_free(loc->temperature_unit);
-            g_free(loc->temperature_value);
-            loc->temperature_unit = PROP(child_node, "unit");
-            loc->temperature_value = PROP(child_node, "value");
-        }
-        if (NODE_IS_TYPE(child_node, "windDirection")) {
-            g_free(loc->wind_dir_deg);
-            g_free(loc->wind_dir_name);
-            loc->wind_dir_deg = PROP(child_node, "deg");
-            loc->wind_dir_name = PROP(child_node, "name");
-        }
-        if (NODE_IS_TYPE(child_node, "windSpeed")) {
-            g_free(loc->wind_speed_mps);
-            g_free(loc->wind_speed_beaufort);
-            loc->wind_speed_mps = PROP(child_node, "mps");
-            loc->wind_speed_beaufort = PROP(child_node, "beaufort");
-        }
-        if (NODE_IS_TYPE(child_node, "humidity")) {
-            g_free(loc->humidity_unit);
-            g_free(loc->humidity_value);
-            loc->humidity_unit = PROP(child_node, "unit");
-            loc->humidity_value = PROP(child_node, "value");
-        }
-        if (NODE_IS_TYPE(child_node, "pressure")) {
-            g_free(loc->pressure_unit);
-            g_free(loc->pressure_value);
-            loc->pressure_unit = PROP(child_node, "unit");
-            loc->pressure_value = PROP(child_node, "value");
-        }
-        if (NODE_IS_TYPE(child_node, "cloudiness")) {
-            g_free(loc->clouds_percent[CLOUDS_PERC_CLOUDINESS]);
-            loc->clouds_percent[CLOUDS_PERC_CLOUDINESS] = PROP(child_node, "percent");
-        }
-        if (NODE_IS_TYPE(child_node, "fog")) {
-            g_free(loc->fog_percent);
-            loc->fog_percent = PROP(child_node, "percent");
-        }
-        if (NODE_IS_TYPE(child_node, "lowClouds")) {
-            g_free(loc->clouds_percent[CLOUDS_PERC_LOW]);
-            loc->clouds_percent[CLOUDS_PERC_LOW] = PROP(child_node, "percent");
-        }
-        if (NODE_IS_TYPE(child_node, "mediumClouds")) {
-            g_free(loc->clouds_percent[CLOUDS_PERC_MID]);
-            loc->clouds_percent[CLOUDS_PERC_MID] = PROP(child_node, "percent");
-        }
-        if (NODE_IS_TYPE(child_node, "highClouds")) {
-            g_free(loc->clouds_percent[CLOUDS_PERC_HIGH]);
-            loc->clouds_percent[CLOUDS_PERC_HIGH] = PROP(child_node, "percent");
-        }
-        if (NODE_IS_TYPE(child_node, "precipitation")) {
-            g_free(loc->precipitation_unit);
-            g_free(loc->precipitation_value);
-            loc->precipitation_unit = PROP(child_node, "unit");
-            loc->precipitation_value = PROP(child_node, "value");
-        }
-        if (NODE_IS_TYPE(child_node, "symbol")) {
-            g_free(loc->symbol);
-            loc->symbol_id = strtol(PROP(child_node, "number"), NULL, 10);
-            loc->symbol = g_strdup(get_symbol_for_id(loc->symbol_id));
+static void
+parse_location_element(xml_location *loc,
+                       const xmlChar *name,
+                       const xmlChar **atts)
+{
+    gchar *str;
+
+    if (xmlStrEqual(name, (const xmlChar *) "temperature")) {
+        parse_value(&loc->temperature, atts, "value");
+        /* Convert Fahrenheit to Celsius if necessary, so that we don't
+           have to do it later. met.no usually provides values in Celsius. */
+        str = sax_prop(atts, "unit");
+        if (str && strcmp(str, "fahrenheit") == 0)
+            loc->temperature.value =
+                (loc->temperature.value - 32.0) * 5.0 / 9.0;
+        g_free(str);
+    } else if (xmlStrEqual(name, (const xmlChar *) "windDirection"))
+        parse_value(&loc->wind_dir_deg, atts, "deg");
+    else if (xmlStrEqual(name, (const xmlChar *) "windSpeed")) {
+        parse_value(&loc->wind_speed_mps, atts, "mps");
+        parse_value(&loc->wind_speed_beaufort, atts, "beaufort");
+    } else if (xmlStrEqual(name, (const xmlChar *) "humidity"))
+        parse_value(&loc->humidity, atts, "value");
+    else if (xmlStrEqual(name, (const xmlChar *) "pressure"))
+        parse_value(&loc->pressure, atts, "value");
+    else if (xmlStrEqual(name, (const xmlChar *) "cloudiness"))
+        parse_value(&loc->clouds_percent[CLOUDS_PERC_CLOUDINESS],
+                    atts, "percent");
+    else if (xmlStrEqual(name, (const xmlChar *) "fog"))
+        parse_value(&loc->fog_percent, atts, "percent");
+    else if (xmlStrEqual(name, (const xmlChar *) "lowClouds"))
+        parse_value(&loc->clouds_percent[CLOUDS_PERC_LOW],
+                    atts, "percent");
+    else if (xmlStrEqual(name, (const xmlChar *) "mediumClouds"))
+        parse_value(&loc->clouds_percent[CLOUDS_PERC_MID],
+                    atts, "percent");
+    else if (xmlStrEqual(name, (const xmlChar *) "highClouds"))
+        parse_value(&loc->clouds_percent[CLOUDS_PERC_HIGH],
+                    atts, "percent");
+    else if (xmlStrEqual(name, (const xmlChar *) "precipitation"))
+        parse_value(&loc->precipitation, atts, "value");
+    else if (xmlStrEqual(name, (const xmlChar *) "symbol")) {
+        str = sax_prop(atts, "number");
+        if (G_LIKELY(str)) {
+            loc->symbol_id = strtol(str, NULL, 10);
+            loc->symbol = get_symbol_for_id(loc->symbol_id);
+            g_free(str);
         }
     }
-
-    /* Convert Fahrenheit to Celsius if necessary, so that we don't
-       have to do it later. met.no usually provides values in Celsius. */
-    if (loc->temperature_value && loc->temperature_unit &&
-        strcmp(loc->temperature_unit, "fahrenheit") == 0) {
-        gdouble val = string_to_double(loc->temperature_value, 0);
-        val = (val - 32.0) * 5.0 / 9.0;
-        g_free(loc->temperature_value);
-        loc->temperature_value = double_to_string(val, "%.1f");
-        g_free(loc->temperature_unit);
-        loc->temperature_unit = g_strdup("celsius");
-    }
 }
 
 
@@ -310,6 +486,9 @@ make_weather_data(void)
         g_slice_free(xml_weather, wd);
         return NULL;
     }
+    wd->timeslice_index = g_hash_table_new(timeslice_hash, timeslice_equal);
+    wd->forecast_intervals = g_array_new(FALSE, TRUE, sizeof(xml_time *));
+    wd->ref_count = 1;
     return wd;
 }
 
@@ -332,85 +511,230 @@ make_timeslice(void)
 }
 
 
-static void
-parse_time(xmlNode *cur_node,
-           xml_weather *wd)
+/*
+ * Look up the timeslice described by the attributes of a <time>
+ * element, or add a new one. Only forecast data is accepted.
+ */
+static xml_time *
+parse_time_attributes(xml_weather *wd,
+                      const xmlChar **atts)
 {
     gchar *datatype, *from, *to;
     time_t start_t, end_t;
     xml_time *timeslice;
-    xmlNode *child_node;
 
-    datatype = PROP(cur_node, "datatype");
+    datatype = sax_prop(atts, "datatype");
     if (xmlStrcasecmp((xmlChar *) datatype, (xmlChar *) "forecast")) {
-        xmlFree(datatype);
-        return;
+        g_free(datatype);
+        return NULL;
     }
-    xmlFree(datatype);
+    g_free(datatype);
 
-    from = PROP(cur_node, "from");
+    from = sax_prop(atts, "from");
     start_t = parse_timestring(from, NULL, FALSE);
-    xmlFree(from);
+    g_free(from);
 
-    to = PROP(cur_node, "to");
+    to = sax_prop(atts, "to");
     end_t = parse_timestring(to, NULL, FALSE);
-    xmlFree(to);
+    g_free(to);
 
     if (G_UNLIKELY(!start_t || !end_t))
-        return;
+        return NULL;
+
+    /* the location data is going to change */
+    wd->series_dirty = TRUE;
 
     /* look for existing timeslice or add a new one */
-    timeslice = get_timeslice(wd, start_t, end_t, NULL);
+    timeslice = get_timeslice(wd, start_t, end_t);
     if (! timeslice) {
         timeslice = make_timeslice();
         if (G_UNLIKELY(!timeslice))
-            return;
+            return NULL;
         timeslice->start = start_t;
         timeslice->end = end_t;
-        g_array_append_val(wd->timeslices, timeslice);
+        add_timeslice(wd, timeslice);
     }
-
-    for (child_node = cur_node->children; child_node;
-         child_node = child_node->next)
-        if (G_LIKELY(NODE_IS_TYPE(child_node, "location")))
-            parse_location(child_node, timeslice->location);
+    return timeslice;
 }
 
 
 /*
- * Parse XML weather data and merge it with current data.
+ * Parser for the weather data. The document is fed to a libxml2 push
+ * parser in chunks as it is downloaded, and timeslices are filled in
+ * from the SAX callbacks, so that neither the complete response body
+ * nor a DOM tree need to be kept in memory.
  */
-gboolean
-parse_weather(xmlNode *cur_node,
-              xml_weather *wd)
+enum {
+    WEATHER_DEPTH_ROOT = 1,
+    WEATHER_DEPTH_PRODUCT,
+    WEATHER_DEPTH_TIME,
+    WEATHER_DEPTH_LOCATION,
+    WEATHER_DEPTH_LOCATION_CHILD
+};
+
+struct _weather_parser {
+    xmlParserCtxtPtr ctxt;
+    xml_weather *wd;
+    xml_time *timeslice;
+    xml_location *location;
+    guint depth;
+    gboolean root_found;
+    gboolean in_product;
+    gboolean failed;
+};
+
+
+static void
+weather_parser_start_element(void *user_data,
+                             const xmlChar *name,
+                             const xmlChar **atts)
 {
-    xmlNode *child_node;
+    weather_parser *parser = user_data;
+    gchar *class;
+
+    switch (++parser->depth) {
+    case WEATHER_DEPTH_ROOT:
+        parser->root_found =
+            xmlStrEqual(name, (const xmlChar *) "weatherdata");
+        break;
+    case WEATHER_DEPTH_PRODUCT:
+        if (!parser->root_found ||
+            !xmlStrEqual(name, (const xmlChar *) "product"))
+            break;
+        class = sax_prop(atts, "class");
+        parser->in_product =
+            !xmlStrcasecmp((xmlChar *) class, (xmlChar *) "pointData");
+        g_free(class);
+        break;
+    case WEATHER_DEPTH_TIME:
+        if (parser->in_product &&
+            xmlStrEqual(name, (const xmlChar *) "time"))
+            parser->timeslice =
+                parse_time_attributes(parser->wd, atts);
+        break;
+    case WEATHER_DEPTH_LOCATION:
+        if (parser->timeslice &&
+            xmlStrEqual(name, (const xmlChar *) "location")) {
+            parser->location = parser->timeslice->location;
+            parse_location_attributes(parser->location, atts);
+        }
+        break;
+    case WEATHER_DEPTH_LOCATION_CHILD:
+        if (parser->location)
+            parse_location_element(parser->location, name, atts);
+        break;
+    }
+}
+
+
+static void
+weather_parser_end_element(void *user_data,
+                           const xmlChar *name)
+{
+    weather_parser *parser = user_data;
+
+    switch (parser->depth--) {
+    case WEATHER_DEPTH_PRODUCT:
+        parser->in_product = FALSE;
+        break;
+    case WEATHER_DEPTH_TIME:
+        parser->timeslice = NULL;
+        break;
+    case WEATHER_DEPTH_LOCATION:
+        parser->location = NULL;
+        break;
+    }
+}
+
+
+weather_parser *
+weather_parser_new(xml_weather *wd)
+{
+    weather_parser *parser;
+    xmlSAXHandler sax;
 
     g_assert(wd != NULL);
     if (G_UNLIKELY(wd == NULL))
+        return NULL;
+
+    parser = g_slice_new0(weather_parser);
+    if (G_UNLIKELY(parser == NULL))
+        return NULL;
+    parser->wd = wd;
+
+    /* only the element callbacks are needed, text content is ignored */
+    memset(&sax, 0, sizeof(xmlSAXHandler));
+    sax.initialized = XML_SAX2_MAGIC;
+    sax.startElement = weather_parser_start_element;
+    sax.endElement = weather_parser_end_element;
+
+    parser->ctxt = xmlCreatePushParserCtxt(&sax, parser, NULL, 0, NULL);
+    if (G_UNLIKELY(parser->ctxt == NULL)) {
+        g_slice_free(weather_parser, parser);
+        return NULL;
+    }
+    xmlCtxtUseOptions(parser->ctxt,
+                      XML_PARSE_NONET | XML_PARSE_NOERROR |
+                      XML_PARSE_NOWARNING);
+    return parser;
+}
+
+
+/*
+ * Feed the next chunk of the document to the parser. Returns FALSE
+ * as soon as the document is known to be malformed; further chunks
+ * will be ignored then.
+ */
+gboolean
+weather_parser_feed(weather_parser *parser,
+                    const gchar *chunk,
+                    gsize len)
+{
+    g_assert(parser != NULL);
+    if (G_UNLIKELY(parser == NULL))
         return FALSE;
 
-    if (G_UNLIKELY(cur_node == NULL || !NODE_IS_TYPE(cur_node, "weatherdata")))
+    if (G_UNLIKELY(parser->failed))
         return FALSE;
+    if (len == 0)
+        return TRUE;
 
-    for (cur_node = cur_node->children; cur_node; cur_node = cur_node->next) {
-        if (cur_node->type != XML_ELEMENT_NODE)
-            continue;
+    if (xmlParseChunk(parser->ctxt, chunk, len, 0) != 0)
+        parser->failed = TRUE;
+    return !parser->failed;
+}
 
-        if (NODE_IS_TYPE(cur_node, "product")) {
-            gchar *class = PROP(cur_node, "class");
-            if (xmlStrcasecmp((xmlChar *) class, (xmlChar *) "pointData")) {
-                xmlFree(class);
-                continue;
-            }
-            g_free(class);
-            for (child_node = cur_node->children; child_node;
-                 child_node = child_node->next)
-                if (NODE_IS_TYPE(child_node, "time"))
-                    parse_time(child_node, wd);
-        }
+
+/*
+ * Signal the end of the document. Returns TRUE if a well-formed
+ * weatherdata document has been parsed.
+ */
+gboolean
+weather_parser_finish(weather_parser *parser)
+{
+    g_assert(parser != NULL);
+    if (G_UNLIKELY(parser == NULL))
+        return FALSE;
+
+    if (!parser->failed && xmlParseChunk(parser->ctxt, NULL, 0, 1) != 0)
+        parser->failed = TRUE;
+    if (!parser->ctxt->wellFormed || !parser->root_found)
+        parser->failed = TRUE;
+    return !parser->failed;
+}
+
+
+void
+weather_parser_free(weather_parser *parser)
+{
+    if (G_UNLIKELY(parser == NULL))
+        return;
+
+    if (parser->ctxt) {
+        xmlFreeDoc(parser->ctxt->myDoc);
+        xmlFreeParserCtxt(parser->ctxt);
     }
-    return TRUE;
+    g_slice_free(weather_parser, parser);
 }
 
 
@@ -422,7 +746,7 @@ gboolean
 parse_astrodata_sun(json_object *cur_node,
                     GArray *astrodata)
 {
-    xml_astro *astro;
+    xml_astro *astro, *old_astro;
     json_object *jwhen, *jinterval, *jproperties, *jdate, *jsunrise,
                 *jsunrise_time, *jsunset, *jsunset_time,
                 *jsolarnoon, *jsolarmidnight, *jdisc_centre_elevation;
@@ -460,8 +784,8 @@ parse_astrodata_sun(json_object *cur_node,
 
     /* use time info at center of day interval */
     astro->day = day_at_midnight(parse_timestring(date, day_format, FALSE) + 12 * 3600, 0);
-    weather_debug("sun: astro->day=%s\n",
-                  format_date(astro->day, day_format,TRUE)); 
+    weather_debug_date("sun: astro->day=%s\n",
+                       astro->day, day_format, TRUE);
 
     jproperties = json_object_object_get(cur_node, "properties");
     if (G_UNLIKELY(jproperties == NULL))
@@ -481,8 +805,8 @@ parse_astrodata_sun(json_object *cur_node,
         time = remove_timezone_offset(date);
         astro->sunrise= parse_timestring(time, sun_format, TRUE);
         sun_rises = TRUE;
-        weather_debug("astro->sunrise=%s\n",
-                      format_date(astro->sunrise, NULL,TRUE));
+        weather_debug_date("astro->sunrise=%s\n",
+                           astro->sunrise, NULL, TRUE);
         g_free(time);
     }
 
@@ -500,8 +824,8 @@ parse_astrodata_sun(json_object *cur_node,
         time = remove_timezone_offset(date);
         astro->sunset= parse_timestring(time, sun_format, TRUE);
         sun_sets = TRUE;
-        weather_debug("astro->sunset=%s\n",
-                      format_date(astro->sunset, NULL,TRUE));
+        weather_debug_date("astro->sunset=%s\n",
+                           astro->sunset, NULL, TRUE);
         g_free(time);
     }
 
@@ -539,6 +863,15 @@ parse_astrodata_sun(json_object *cur_node,
     else
         astro->sun_never_sets = TRUE;
 
+    /* keep the moon data of the day if it has arrived already */
+    if ((old_astro = get_astro(astrodata, astro->day, NULL))) {
+        astro->moonrise = old_astro->moonrise;
+        astro->moonset = old_astro->moonset;
+        astro->moon_never_rises = old_astro->moon_never_rises;
+        astro->moon_never_sets = old_astro->moon_never_sets;
+        astro->moon_phase = g_strdup(old_astro->moon_phase);
+    }
+
     merge_astro(astrodata, astro);
     xml_astro_free(astro);
     return TRUE;
@@ -599,16 +932,19 @@ parse_astrodata_moon(json_object *cur_node,
 
     /* use time info at center of day interval */
     day = day_at_midnight(parse_timestring(date, day_format, FALSE) + 12 * 3600, 0);
-    /* this data seems weird */
+    /* the sun data of the day may arrive before or after this */
     astro = get_astro(astrodata, day, &index);
-    if (G_UNLIKELY(astro == NULL)) {
-        weather_debug("no sun astrodata for day=%s\n",
-                      format_date(day, day_format,FALSE));
-        return FALSE;
+    if (astro == NULL) {
+        astro = g_slice_new0(xml_astro);
+        astro->day = day;
+        merge_astro(astrodata, astro);
+        xml_astro_free(astro);
+        astro = get_astro(astrodata, day, &index);
     }
 
     astro->day=day;
-    weather_debug("moon: astro->day=%s\n", format_date(astro->day, day_format,TRUE));
+    weather_debug_date("moon: astro->day=%s\n",
+                       astro->day, day_format, TRUE);
 
     jproperties = json_object_object_get(cur_node, "properties");
     if (G_UNLIKELY(jproperties == NULL)) {
@@ -634,8 +970,8 @@ parse_astrodata_moon(json_object *cur_node,
         time = remove_timezone_offset(date);
         astro->moonrise= parse_timestring(time, moon_format, TRUE);
         moon_rises = TRUE;
-        weather_debug("astro->moonrise=%s\n",
-                      format_date(astro->moonrise, NULL,TRUE));
+        weather_debug_date("astro->moonrise=%s\n",
+                           astro->moonrise, NULL, TRUE);
         g_free(time);
     }
 
@@ -656,8 +992,8 @@ parse_astrodata_moon(json_object *cur_node,
         time = remove_timezone_offset(date);
         astro->moonset= parse_timestring(time, moon_format, TRUE);
         moon_sets = TRUE;
-        weather_debug("astro->moonset=%s\n",
-                      format_date(astro->moonset, NULL,TRUE));
+        weather_debug_date("astro->moonset=%s\n",
+                           astro->moonset, NULL, TRUE);
         g_free(time);
     }
 
@@ -850,27 +1186,6 @@ xml_location_free(xml_location *loc)
     g_assert(loc != NULL);
     if (G_UNLIKELY(loc == NULL))
         return;
-    g_free(loc->altitude);
-    g_free(loc->latitude);
-    g_free(loc->longitude);
-    g_free(loc->temperature_value);
-    g_free(loc->temperature_unit);
-    g_free(loc->wind_dir_deg);
-    g_free(loc->wind_dir_name);
-    g_free(loc->wind_speed_mps);
-    g_free(loc->wind_speed_beaufort);
-    g_free(loc->humidity_value);
-    g_free(loc->humidity_unit);
-    g_free(loc->pressure_value);
-    g_free(loc->pressure_unit);
-    g_free(loc->clouds_percent[CLOUDS_PERC_LOW]);
-    g_free(loc->clouds_percent[CLOUDS_PERC_MID]);
-    g_free(loc->clouds_percent[CLOUDS_PERC_HIGH]);
-    g_free(loc->clouds_percent[CLOUDS_PERC_CLOUDINESS]);
-    g_free(loc->fog_percent);
-    g_free(loc->precipitation_value);
-    g_free(loc->precipitation_unit);
-    g_free(loc->symbol);
     g_slice_free(xml_location, loc);
 }
 
@@ -915,7 +1230,6 @@ xml_time_copy(const xml_time *src)
 {
     xml_time *dst;
     xml_location *loc;
-    gint i;
 
     if (G_UNLIKELY(src == NULL))
         return NULL;
@@ -934,37 +1248,9 @@ xml_time_copy(const xml_time *src)
 
     dst->start = src->start;
     dst->end = src->end;
+    dst->point = src->point;
 
-    loc->altitude = g_strdup(src->location->altitude);
-    loc->latitude = g_strdup(src->location->latitude);
-    loc->longitude = g_strdup(src->location->longitude);
-
-    loc->temperature_value = g_strdup(src->location->temperature_value);
-    loc->temperature_unit = g_strdup(src->location->temperature_unit);
-
-    loc->wind_dir_deg = g_strdup(src->location->wind_dir_deg);
-    loc->wind_dir_name = g_strdup(src->location->wind_dir_name);
-    loc->wind_speed_mps = g_strdup(src->location->wind_speed_mps);
-    loc->wind_speed_beaufort = g_strdup(src->location->wind_speed_beaufort);
-
-    loc->humidity_value = g_strdup(src->location->humidity_value);
-    loc->humidity_unit = g_strdup(src->location->humidity_unit);
-
-    loc->pressure_value = g_strdup(src->location->pressure_value);
-    loc->pressure_unit = g_strdup(src->location->pressure_unit);
-
-    for (i = 0; i < CLOUDS_PERC_NUM; i++)
-        loc->clouds_percent[i] = g_strdup(src->location->clouds_percent[i]);
-
-    loc->fog_percent = g_strdup(src->location->fog_percent);
-
-    loc->precipitation_value =
-        g_strdup(src->location->precipitation_value);
-    loc->precipitation_unit = g_strdup(src->location->precipitation_unit);
-
-    loc->symbol_id = src->location->symbol_id;
-    loc->symbol = g_strdup(src->location->symbol);
-
+    *loc = *src->location;
     dst->location = loc;
 
     return dst;
@@ -982,7 +1268,7 @@ xml_time_free(xml_time *timeslice)
 }
 
 
-void
+static void
 xml_weather_free(xml_weather *wd)
 {
     xml_time *timeslice;
@@ -997,8 +1283,14 @@ xml_weather_free(xml_weather *wd)
             timeslice = g_array_index(wd->timeslices, xml_time *, i);
             xml_time_free(timeslice);
         }
-        g_array_free(wd->timeslices, FALSE);
+        g_array_free(wd->timeslices, TRUE);
     }
+    if (G_LIKELY(wd->timeslice_index))
+        g_hash_table_destroy(wd->timeslice_index);
+    time_series_free(wd->points);
+    time_series_free(wd->intervals);
+    if (G_LIKELY(wd->forecast_intervals))
+        g_array_free(wd->forecast_intervals, TRUE);
     if (G_LIKELY(wd->current_conditions)) {
         weather_debug("Freeing current conditions.");
         xml_time_free(wd->current_conditions);
@@ -1007,12 +1299,93 @@ xml_weather_free(xml_weather *wd)
 }
 
 
+/*
+ * Copy the timeslices of the weather data into a new, unpublished
+ * snapshot. Only the timeslices are read, so this is safe while the
+ * main context works with the source.
+ */
+xml_weather *
+xml_weather_copy(const xml_weather *src)
+{
+    xml_weather *dst;
+    xml_time *timeslice;
+    guint i;
+
+    g_assert(src != NULL);
+    if (G_UNLIKELY(src == NULL))
+        return NULL;
+
+    dst = make_weather_data();
+    if (G_UNLIKELY(dst == NULL))
+        return NULL;
+    for (i = 0; i < src->timeslices->len; i++) {
+        timeslice = g_array_index(src->timeslices, xml_time *, i);
+        if (G_LIKELY(timeslice))
+            add_timeslice(dst, xml_time_copy(timeslice));
+    }
+    return dst;
+}
+
+
+/*
+ * Move the timeslices of src into wd. A timeslice replaces the one of
+ * wd with the same interval, if there is one. src is left empty.
+ */
+void
+xml_weather_merge(xml_weather *wd,
+                  xml_weather *src)
+{
+    xml_time *timeslice, *old;
+    xml_location *loc;
+    guint i;
+
+    g_assert(wd != NULL && src != NULL);
+    if (G_UNLIKELY(wd == NULL || src == NULL))
+        return;
+
+    for (i = 0; i < src->timeslices->len; i++) {
+        timeslice = g_array_index(src->timeslices, xml_time *, i);
+        old = get_timeslice(wd, timeslice->start, timeslice->end);
+        if (old) {
+            loc = old->location;
+            old->location = timeslice->location;
+            timeslice->location = loc;
+            xml_time_free(timeslice);
+            wd->series_dirty = TRUE;
+        } else
+            add_timeslice(wd, timeslice);
+    }
+    g_array_set_size(src->timeslices, 0);
+    g_hash_table_remove_all(src->timeslice_index);
+    src->series_dirty = TRUE;
+}
+
+
+xml_weather *
+xml_weather_ref(xml_weather *wd)
+{
+    g_assert(wd != NULL);
+    g_atomic_int_inc(&wd->ref_count);
+    return wd;
+}
+
+
+void
+xml_weather_unref(xml_weather *wd)
+{
+    if (G_UNLIKELY(wd == NULL))
+        return;
+    if (g_atomic_int_dec_and_test(&wd->ref_count))
+        xml_weather_free(wd);
+}
+
+
 void
 xml_weather_clean(xml_weather *wd)
 {
     xml_time *timeslice;
     time_t now_t = time(NULL);
-    guint i;
+    guint i, removed = 0;
 
     if (G_UNLIKELY(wd == NULL || wd->timeslices == NULL))
         return;
@@ -1021,13 +1394,18 @@ xml_weather_clean(xml_weather *wd)
         if (G_UNLIKELY(timeslice == NULL))
             continue;
         if (difftime(now_t, timeslice->end) > DATA_EXPIRY_TIME) {
-            weather_debug("Removing expired timeslice:");
-            weather_dump(weather_dump_timeslice, timeslice);
+            g_hash_table_remove(wd->timeslice_index, timeslice);
+            wd->series_dirty = TRUE;
             xml_time_free(timeslice);
             g_array_remove_index(wd->timeslices, i--);
-            weather_debug("Remaining timeslices: %d", wd->timeslices->len);
+            removed++;
         }
     }
+    /* no dump of the timeslices, formatting their local time is not
+       safe on the worker thread this runs on */
+    if (removed)
+        weather_debug("Removed %u expired timeslices, %u remaining.",
+                      removed, wd->timeslices->len);
 }
 
 
@@ -1055,7 +1433,7 @@ astrodata_free(GArray *astrodata)
         if (astro)
             xml_astro_free(astro);
     }
-    g_array_free(astrodata, FALSE);
+    g_array_free(astrodata, TRUE);
 }
 
 
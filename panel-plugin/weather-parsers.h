@@ -25,6 +25,7 @@
 #include <json-c/json_tokener.h>
 
 #define DATA_EXPIRY_TIME (24 * 3600)
+#define FORECAST_INTERVAL_LEN (6 * 3600)
 
 G_BEGIN_DECLS
 
@@ -38,33 +39,42 @@ enum {
 
 typedef gpointer (*XmlParseFunc) (xmlNode *node);
 
+typedef struct _weather_parser weather_parser;
+
+/* a measured value, valid is FALSE if it is not available */
 typedef struct {
-    gchar *altitude;
-    gchar *latitude;
-    gchar *longitude;
+    gdouble value;
+    gboolean valid;
+} xml_value;
+
+#define XML_VALUE_SET(var, val)                 \
+    do {                                        \
+        (var).value = (val);                    \
+        (var).valid = TRUE;                     \
+    } while (0)
 
-    gchar *temperature_value;
-    gchar *temperature_unit;
+/* values are normalized to the units given in the comments */
+typedef struct {
+    xml_value altitude;             /* meters */
+    xml_value latitude;
+    xml_value longitude;
 
-    gchar *wind_dir_deg;
-    gchar *wind_dir_name;
-    gchar *wind_speed_mps;
-    gchar *wind_speed_beaufort;
+    xml_value temperature;          /* Celsius */
 
-    gchar *humidity_value;
-    gchar *humidity_unit;
+    xml_value wind_dir_deg;
+    xml_value wind_speed_mps;
+    xml_value wind_speed_beaufort;
 
-    gchar *pressure_value;
-    gchar *pressure_unit;
+    xml_value humidity;             /* percent */
+    xml_value pressure;             /* hectopascals */
 
-    gchar *clouds_percent[CLOUDS_PERC_NUM];
-    gchar *fog_percent;
+    xml_value clouds_percent[CLOUDS_PERC_NUM];
+    xml_value fog_percent;
 
-    gchar *precipitation_value;
-    gchar *precipitation_unit;
+    xml_value precipitation;        /* millimeters */
 
     gint symbol_id;
-    gchar *symbol;
+    const gchar *symbol;
 } xml_location;
 
 typedef struct {
@@ -74,9 +84,39 @@ typedef struct {
     xml_location *location;
 } xml_time;
 
+/*
+ * Timeslice start and end times in separate sorted columns, so that
+ * searches over a time range only need to touch contiguous memory.
+ * The measurements stay in the xml_location of each timeslice: no
+ * search looks at them, they are only read from the few timeslices
+ * a search has found, so value columns would not speed up anything.
+ */
 typedef struct {
+    GArray *start;                  /* time_t, ascending */
+    GArray *end;                    /* time_t */
+    GArray *timeslices;             /* xml_time *, in the same order */
+} xml_time_series;
+
+/*
+ * Weather data is shared as reference counted snapshot. Its time
+ * series are built before it is published to the main context, after
+ * which only current_conditions and the current_* fields may change,
+ * and only in the main context.
+ */
+typedef struct {
+    gint ref_count;
     GArray *timeslices;
+    GHashTable *timeslice_index;    /* (start, end) -> xml_time */
+    xml_time_series *points;
+    xml_time_series *intervals;
+    GArray *forecast_intervals;     /* xml_time *, per 6 hour UTC slot */
+    time_t forecast_base;           /* start of the first slot */
+    gboolean series_dirty;
     xml_time *current_conditions;
+    /* used for current conditions, valid until the series are rebuilt */
+    xml_time *current_interval;
+    xml_time *current_start;
+    xml_time *current_end;
 } xml_weather;
 
 typedef struct {
@@ -130,8 +170,17 @@ time_t parse_timestring(const gchar *ts,
                         const gchar *format,
                         gboolean local);
 
-gboolean parse_weather(xmlNode *cur_node,
-                       xml_weather *wd);
+const gchar *parse_moonposition(gdouble pos_in);
+
+weather_parser *weather_parser_new(xml_weather *wd);
+
+gboolean weather_parser_feed(weather_parser *parser,
+                             const gchar *chunk,
+                             gsize len);
+
+gboolean weather_parser_finish(weather_parser *parser);
+
+void weather_parser_free(weather_parser *parser);
 
 gboolean parse_astrodata_sun(json_object *cur_node,
                              GArray *astrodata);
@@ -149,8 +198,15 @@ xml_timezone *parse_timezone(xmlNode *cur_node);
 
 xml_time *get_timeslice(xml_weather *wd,
                         const time_t start_t,
-                        const time_t end_t,
-                        guint *index);
+                        const time_t end_t);
+
+void add_timeslice(xml_weather *wd,
+                   xml_time *timeslice);
+
+void xml_weather_update_series(xml_weather *wd);
+
+xml_time *get_forecast_interval(xml_weather *wd,
+                                time_t slot_t);
 
 xml_astro *get_astro(const GArray *astrodata,
                      const time_t day_t,
@@ -169,7 +225,14 @@ xml_time *xml_time_copy(const xml_time *src);
 
 void xml_time_free(xml_time *timeslice);
 
-void xml_weather_free(xml_weather *wd);
+xml_weather *xml_weather_copy(const xml_weather *src);
+
+void xml_weather_merge(xml_weather *wd,
+                       xml_weather *src);
+
+xml_weather *xml_weather_ref(xml_weather *wd);
+
+void xml_weather_unref(xml_weather *wd);
 
 void xml_weather_clean(xml_weather *wd);
 
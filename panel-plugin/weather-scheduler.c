@@ -0,0 +1,296 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Central scheduler for all outgoing HTTP requests. Requests wait in
+ * one queue per priority and are sent in priority order, as long as
+ * the token bucket of their host allows. Each host may send a burst
+ * of requests, after which tokens are refilled at a fixed rate, so
+ * that the rate limits of the providers are kept. A host that asked
+ * to be left alone with Retry-After gets no requests until then.
+ *
+ * Requests whose cancellable has been triggered are passed on right
+ * away, so that their callbacks are not held up.
+ *
+ * Times are monotonic, in microseconds, and given by the callers, so
+ * that the scheduling can be tested without waiting for the clock.
+ */
+
+#include <string.h>
+
+#include "weather-scheduler.h"
+#include "weather-debug.h"
+
+
+typedef struct {
+    gchar *host;
+    GCancellable *cancellable;
+    gulong handler;
+    WeatherScheduleFunc send_func;
+    gpointer user_data;
+} schedule_request;
+
+typedef struct {
+    gdouble rate;
+    gdouble burst;
+    gdouble tokens;
+    gint64 refilled;                /* monotonic time, microseconds */
+    gint64 blocked_until;
+} schedule_host;
+
+/* limits of hosts that need to be treated more carefully */
+static const struct {
+    const gchar *host;
+    gdouble rate;
+    gdouble burst;
+} schedule_host_limits[] = {
+    /* the usage policy allows one request per second at most */
+    { "nominatim.openstreetmap.org", 1.0, 1.0 },
+};
+
+static GQueue schedule_queues[WEATHER_SCHEDULE_NUM_PRIORITIES];
+static GHashTable *schedule_hosts = NULL;
+static guint schedule_timer = 0;
+static gint64 schedule_timer_due = 0;
+static gboolean schedule_dispatching = FALSE;
+static gboolean schedule_dispatch_again = FALSE;
+
+
+/* the host of the URI, or "" if it has none */
+gchar *
+weather_scheduler_get_host(const gchar *uri)
+{
+    GUri *parsed;
+    gchar *host;
+
+    parsed = g_uri_parse(uri, G_URI_FLAGS_NONE, NULL);
+    host = g_strdup(parsed && g_uri_get_host(parsed)
+                    ? g_uri_get_host(parsed) : "");
+    if (parsed)
+        g_uri_unref(parsed);
+    return host;
+}
+
+
+static void
+schedule_host_free(gpointer host)
+{
+    g_slice_free(schedule_host, host);
+}
+
+
+static schedule_host *
+schedule_lookup_host(const gchar *name,
+                     gint64 now)
+{
+    schedule_host *host;
+    guint i;
+
+    if (G_UNLIKELY(schedule_hosts == NULL))
+        schedule_hosts = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, schedule_host_free);
+
+    host = g_hash_table_lookup(schedule_hosts, name);
+    if (host)
+        return host;
+
+    host = g_slice_new0(schedule_host);
+    host->rate = SCHEDULER_RATE;
+    host->burst = SCHEDULER_BURST;
+    for (i = 0; i < G_N_ELEMENTS(schedule_host_limits); i++)
+        if (strcmp(schedule_host_limits[i].host, name) == 0) {
+            host->rate = schedule_host_limits[i].rate;
+            host->burst = schedule_host_limits[i].burst;
+        }
+    host->tokens = host->burst;
+    host->refilled = now;
+    g_hash_table_insert(schedule_hosts, g_strdup(name), host);
+    return host;
+}
+
+
+/*
+ * Take a token of the host if there is one. Otherwise, return the
+ * time when the request may be sent.
+ */
+static gint64
+schedule_take_token(schedule_host *host,
+                    gint64 now)
+{
+    if (now < host->blocked_until)
+        return host->blocked_until;
+
+    host->tokens = MIN(host->burst, host->tokens +
+                       (now - host->refilled) * host->rate / G_USEC_PER_SEC);
+    host->refilled = now;
+    if (host->tokens >= 1) {
+        host->tokens -= 1;
+        return 0;
+    }
+    return now + (1 - host->tokens) * G_USEC_PER_SEC / host->rate;
+}
+
+
+static void
+schedule_request_free(schedule_request *req)
+{
+    if (req->cancellable) {
+        g_cancellable_disconnect(req->cancellable, req->handler);
+        g_object_unref(req->cancellable);
+    }
+    g_free(req->host);
+    g_slice_free(schedule_request, req);
+}
+
+
+static gboolean
+cb_schedule_timer(gpointer user_data)
+{
+    schedule_timer = 0;
+    schedule_timer_due = 0;
+    weather_scheduler_dispatch(g_get_monotonic_time());
+    return G_SOURCE_REMOVE;
+}
+
+
+/* wake up at the given time, unless that will happen earlier anyway */
+static void
+schedule_wakeup(gint64 due,
+                gint64 now)
+{
+    if (schedule_timer && schedule_timer_due <= due)
+        return;
+    if (schedule_timer)
+        g_source_remove(schedule_timer);
+    schedule_timer_due = due;
+    schedule_timer = g_timeout_add(MAX(due - now, 0) / 1000 + 1,
+                                   cb_schedule_timer, NULL);
+}
+
+
+static void
+cb_schedule_cancelled(GCancellable *cancellable,
+                      gpointer user_data)
+{
+    /* not from here, the request must not be freed within this handler */
+    schedule_wakeup(0, g_get_monotonic_time());
+}
+
+
+/*
+ * Send the requests the token buckets allow at the given time, in
+ * priority order. A send function may queue new requests, those are
+ * handled in another pass. Returns when the next waiting request may
+ * be sent, or 0 if none is waiting.
+ */
+gint64
+weather_scheduler_dispatch(gint64 now)
+{
+    schedule_request *req;
+    GList *item, *next;
+    gint64 due, wakeup;
+    guint prio;
+
+    if (schedule_dispatching) {
+        schedule_dispatch_again = TRUE;
+        return 0;
+    }
+    schedule_dispatching = TRUE;
+    do {
+        schedule_dispatch_again = FALSE;
+        wakeup = 0;
+        for (prio = 0; prio < WEATHER_SCHEDULE_NUM_PRIORITIES; prio++)
+            for (item = schedule_queues[prio].head; item; item = next) {
+                next = item->next;
+                req = item->data;
+                if (req->cancellable &&
+                    g_cancellable_is_cancelled(req->cancellable))
+                    due = 0;
+                else
+                    due = schedule_take_token(schedule_lookup_host(req->host,
+                                                                   now),
+                                              now);
+                if (due > 0) {
+                    wakeup = wakeup ? MIN(wakeup, due) : due;
+                    continue;
+                }
+                g_queue_delete_link(&schedule_queues[prio], item);
+                weather_debug("Sending request to %s (priority %u).",
+                              req->host, prio);
+                req->send_func(req->user_data);
+                schedule_request_free(req);
+            }
+    } while (schedule_dispatch_again);
+    schedule_dispatching = FALSE;
+
+    if (wakeup)
+        schedule_wakeup(wakeup, now);
+    return wakeup;
+}
+
+
+/*
+ * Queue a request to the given URI. The send function is called once
+ * the request may be sent, which may happen right away.
+ */
+void
+weather_scheduler_add(const gchar *uri,
+                      weather_schedule_priority priority,
+                      GCancellable *cancellable,
+                      WeatherScheduleFunc send_func,
+                      gpointer user_data,
+                      gint64 now)
+{
+    schedule_request *req;
+
+    g_assert(uri != NULL && send_func != NULL);
+    g_assert(priority < WEATHER_SCHEDULE_NUM_PRIORITIES);
+
+    req = g_slice_new0(schedule_request);
+    req->host = weather_scheduler_get_host(uri);
+    req->send_func = send_func;
+    req->user_data = user_data;
+    if (cancellable) {
+        req->cancellable = g_object_ref(cancellable);
+        if (!g_cancellable_is_cancelled(cancellable))
+            req->handler = g_cancellable_connect(cancellable,
+                                                 G_CALLBACK(cb_schedule_cancelled),
+                                                 NULL, NULL);
+    }
+    g_queue_push_tail(&schedule_queues[priority], req);
+    weather_scheduler_dispatch(now);
+}
+
+
+/* send no requests to the host of the URI for the given time */
+void
+weather_scheduler_retry_after(const gchar *uri,
+                              guint seconds,
+                              gint64 now)
+{
+    schedule_host *host;
+    gchar *name;
+
+    name = weather_scheduler_get_host(uri);
+    host = schedule_lookup_host(name, now);
+    seconds = MIN(seconds, SCHEDULER_MAX_RETRY_AFTER);
+    host->blocked_until = MAX(host->blocked_until,
+                              now + (gint64) seconds * G_USEC_PER_SEC);
+    weather_debug("Host %s asked to retry after %u seconds.", name, seconds);
+    g_free(name);
+}
@@ -0,0 +1,61 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __WEATHER_SCHEDULER_H__
+#define __WEATHER_SCHEDULER_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* token bucket of each host, unless it has stricter limits */
+#define SCHEDULER_RATE (4.0)            /* requests per second */
+#define SCHEDULER_BURST (8.0)
+#define SCHEDULER_MAX_RETRY_AFTER (3600) /* seconds */
+
+/* requests of a higher priority are always sent first */
+typedef enum {
+    WEATHER_SCHEDULE_INTERACTIVE,   /* searches and lookups by the user */
+    WEATHER_SCHEDULE_FORECAST,
+    WEATHER_SCHEDULE_ASTRO,
+    WEATHER_SCHEDULE_NUM_PRIORITIES
+} weather_schedule_priority;
+
+/* called when the request may be sent */
+typedef void (*WeatherScheduleFunc) (gpointer user_data);
+
+
+void weather_scheduler_add(const gchar *uri,
+                           weather_schedule_priority priority,
+                           GCancellable *cancellable,
+                           WeatherScheduleFunc send_func,
+                           gpointer user_data,
+                           gint64 now);
+
+gint64 weather_scheduler_dispatch(gint64 now);
+
+gchar *weather_scheduler_get_host(const gchar *uri);
+
+void weather_scheduler_retry_after(const gchar *uri,
+                                   guint seconds,
+                                   gint64 now);
+
+G_END_DECLS
+
+#endif
@@ -199,7 +199,9 @@ search_cb(GtkWidget *widget,
 
     gtk_tree_view_column_set_title(dialog->column, _("Searching..."));
     weather_debug("getting %s", url);
-    weather_http_queue_request(dialog->session, url, cb_searchdone, dialog);
+    weather_http_queue_request(dialog->session, url,
+                               WEATHER_SCHEDULE_INTERACTIVE, NULL,
+                               cb_searchdone, dialog);
     g_free(url);
 }
 
@@ -503,5 +505,6 @@ void weather_search_by_ip(SoupSession *session,
     data->user_data = user_data;
 
     weather_debug("getting %s", url);
-    weather_http_queue_request(session, url, cb_geolocation, data);
+    weather_http_queue_request(session, url, WEATHER_SCHEDULE_INTERACTIVE,
+                               NULL, cb_geolocation, data);
 }
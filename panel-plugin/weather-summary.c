@@ -303,6 +303,7 @@ weather_summary_get_logo(plugin_data *data)
     if (pixbuf == NULL)
         weather_http_queue_request(data->session,
                                    "https://www.met.no/_/asset/no.met.metno:1497355518/images/met-logo.svg",
+                                   WEATHER_SCHEDULE_INTERACTIVE, NULL,
                                    logo_fetched, image);
     else {
         cairo_surface_t *surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, scale_factor, NULL);
@@ -673,7 +674,7 @@ get_dayname(gint day)
 
 static gchar *
 forecast_cell_get_tooltip_text(plugin_data *data,
-                               xml_time *fcdata)
+                               const xml_time *fcdata)
 {
     GString *text;
     gchar *result, *value;
@@ -888,27 +889,21 @@ add_forecast_header(const gchar *text,
 
 static GtkWidget *
 add_forecast_cell(plugin_data *data,
-                  GArray *daydata,
                   gint day,
                   gint time_of_day)
 {
     GtkWidget *box, *label, *image;
     cairo_surface_t *icon;
     gchar *wind_speed, *wind_direction, *value, *rawvalue;
-    xml_time *fcdata;
+    const xml_time *fcdata;
     gint scale_factor;
 
     box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
 
-    fcdata = make_forecast_data(data->weatherdata, daydata, day, time_of_day);
+    fcdata = forecast_grid_get_cell(data->forecast, day, time_of_day);
     if (fcdata == NULL)
         return box;
 
-    if (fcdata->location == NULL) {
-        xml_time_free(fcdata);
-        return box;
-    }
-
     /* symbol */
     rawvalue = get_data(fcdata, data->units, SYMBOL,
                         FALSE, data->night_time);
@@ -960,7 +955,6 @@ add_forecast_cell(plugin_data *data,
     gtk_widget_set_tooltip_markup(GTK_WIDGET(box), value);
     g_free(value);
 
-    xml_time_free(fcdata);
     return box;
 }
 
@@ -971,7 +965,6 @@ make_forecast(plugin_data *data)
     GtkWidget *grid, *ebox, *box;
     GtkWidget *forecast_box;
 
-    GArray *daydata;
     xml_astro *astro;
     gchar *dayname, *text;
     guint i;
@@ -1008,6 +1001,10 @@ make_forecast(plugin_data *data)
     ATTACH_DAYTIME_HEADER(_("Evening"), 3);
     ATTACH_DAYTIME_HEADER(_("Night"), 4);
 
+    /* reuse the forecast data if nothing changed since it was computed */
+    forecast_grid_update(data->forecast, data->weatherdata,
+                         data->data_generation, data->forecast_days);
+
     for (i = 0; i < data->forecast_days; i++) {
         /* forecast day headers */
         dayname = get_dayname(i);
@@ -1029,12 +1026,9 @@ make_forecast(plugin_data *data)
             gtk_grid_attach (GTK_GRID (grid), GTK_WIDGET(ebox),
                              0, i+1, 1, 1);
 
-        /* to speed up things, first get forecast data for all daytimes */
-        daydata = get_point_data_for_day(data->weatherdata, i);
-
         /* get forecast data for each daytime */
         for (time_of_day = MORNING; time_of_day <= NIGHT; time_of_day++) {
-            forecast_box = add_forecast_cell(data, daydata, i, time_of_day);
+            forecast_box = add_forecast_cell(data, i, time_of_day);
             weather_widget_set_border_width (GTK_WIDGET (forecast_box), 4);
             gtk_widget_set_hexpand (GTK_WIDGET (forecast_box), TRUE);
             gtk_widget_set_vexpand (GTK_WIDGET (forecast_box), TRUE);
@@ -1053,7 +1047,6 @@ make_forecast(plugin_data *data)
                                  GTK_WIDGET(ebox),
                                  1+time_of_day, i+1, 1, 1);
         }
-        g_array_free(daydata, FALSE);
     }
     return grid;
 }
@@ -35,6 +35,8 @@
 
 #include "weather-parsers.h"
 #include "weather-data.h"
+#include "weather-astro.h"
+#include "weather-cache.h"
 #include "weather.h"
 
 #include "weather-translate.h"
@@ -46,11 +48,16 @@
 
 #define XFCEWEATHER_ROOT "weather"
 #define CACHE_FILE_MAX_AGE (48 * 3600)
+#define CACHE_MAX_SIZE (10 * 1024)       /* KiB */
+#define CACHE_MAX_DISTANCE (1000)        /* meters */
+#define CACHE_MAX_MSL_DIFF (50)          /* meters */
 #define BORDER (8)
 #define CONN_TIMEOUT (10)        /* connection timeout in seconds */
-#define CONN_MAX_ATTEMPTS (3)    /* max retry attempts using small interval */
-#define CONN_RETRY_INTERVAL_SMALL (10)
-#define CONN_RETRY_INTERVAL_LARGE (10 * 60)
+#define ASTRO_MAX_CONNECTIONS (4)       /* per host */
+#define ASTRO_MAX_ATTEMPTS (3)          /* per request */
+#define ASTRO_PART_SUN (1 << 0)
+#define ASTRO_PART_MOON (1 << 1)
+#define ASTRO_PART_ALL (ASTRO_PART_SUN | ASTRO_PART_MOON)
 
 /* power saving update interval in seconds used as a precaution to
    deal with suspend/resume events etc., when nothing needs to be
@@ -72,10 +79,6 @@
                           unit);                        \
     g_free(value);
 
-#define CACHE_APPEND(str, val)                  \
-    if (val)                                    \
-        g_string_append_printf(out, str, val);
-
 #define CACHE_FREE_VARS()                       \
     g_free(locname);                            \
     g_free(lat);                                \
@@ -87,6 +90,15 @@
 #define CACHE_READ_STRING(var, key)                         \
     var = g_key_file_get_string(keyfile, group, key, NULL); \
 
+#define CACHE_READ_VALUE(var, key)                                  \
+    timestring = g_key_file_get_string(keyfile, group, key, NULL);  \
+    if (timestring)                                                 \
+        XML_VALUE_SET(var, string_to_double(timestring, 0));        \
+    g_free(timestring);
+
+/* size of the chunks in which weather data is read */
+#define WEATHER_CHUNK_SIZE (16 * 1024)
+
 #define SCHEDULE_WAKEUP_COMPARE(var, reason)        \
     if (difftime(var, now_t) < diff) {              \
         data->next_wakeup = var;                    \
@@ -97,31 +109,363 @@
 
 gboolean debug_mode = FALSE;
 
+/* merge of downloaded weather data, done on a worker thread */
+typedef struct {
+    xml_weather *base;              /* snapshot to merge the data into */
+    GAsyncQueue *chunks;            /* NULL if there is no new data */
+    gchar *etag;
+    gchar *last_modified;
+    time_t conditions_t;            /* for the current conditions */
+    time_t downloaded;              /* 0 if just downloaded */
+    gboolean failed;                /* download failed */
+    gboolean invalid;               /* data could not be parsed */
+} weather_merge;
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+typedef struct {
+    GCancellable *cancellable;      /* of the request generation */
+    GInputStream *stream;
+    weather_merge *merge;           /* until the end has been pushed */
+    GAsyncQueue *chunks;
+} weather_download;
+#endif
+
+/* a request waiting in the scheduler or in flight */
+typedef struct {
+    SoupSession *session;
+    SoupMessage *msg;
+    gchar *uri;
+    GCancellable *cancellable;
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    gboolean stream;                /* hand the body over as stream */
+    GAsyncReadyCallback callback_func;
+#else
+    gulong handler;
+    SoupSessionCallback callback_func;
+#endif
+    gpointer user_data;
+} http_request;
+
+/* check for data of other plugin instances, done on a worker thread */
+typedef struct {
+    weather_cache_store *store;
+    GCancellable *cancellable;      /* of the request generation */
+    gchar *key;
+    gchar *lat;
+    gchar *lon;
+    gchar *offset;
+    gint msl;
+    time_t last;                    /* of our last download */
+    gboolean had_lease;
+    gboolean leased;                /* holds the download lease now */
+    xml_weather *shared;            /* newer data from the cache */
+    gchar *location_name;
+    gchar *etag;
+    gchar *last_modified;
+    time_t downloaded;
+    time_t expires;
+} shared_check;
+
+/* lookup and load of the cached data, done on a worker thread */
+typedef struct {
+    weather_cache_store *store;
+    GCancellable *cancellable;      /* of the request generation */
+    gchar *key;
+    gchar *old_key;                 /* of the old text cache file */
+    gchar *lat;
+    gchar *lon;
+    gchar *offset;
+    gint msl;
+    gint max_age;
+    gint max_distance;
+    gint max_msl_diff;
+    GArray *astrodata;
+    xml_weather *weatherdata;
+    gboolean loaded;                /* weatherdata has been loaded */
+    gboolean exact;                 /* of the location, not nearby */
+    gchar *location_name;
+    gchar *etag;
+    gchar *last_modified;
+    time_t last_weather_download;
+    time_t weather_expires;
+    time_t last_astro_download;
+} cache_load;
+
 
 static void write_cache_file(plugin_data *data);
 
+static void start_shared_check(plugin_data *data);
+
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void cb_weather_update(GObject *source,
+                              GAsyncResult *result,
+                              gpointer user_data);
+#else
+static void cb_weather_update(SoupSession *session,
+                              SoupMessage *msg,
+                              gpointer user_data);
+#endif
+
 static void schedule_next_wakeup(plugin_data *data);
 
 
+/* parse an HTTP date, returns 0 if that fails */
+static time_t
+parse_http_date(const gchar *str)
+{
+    time_t t;
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    GDateTime *date;
+
+    date = soup_date_time_new_from_http_string(str);
+    if (date == NULL)
+        return 0;
+    t = g_date_time_to_unix(date);
+    g_date_time_unref(date);
+#else
+    SoupDate *date;
+
+    date = soup_date_new_from_string(str);
+    if (date == NULL)
+        return 0;
+    t = soup_date_to_time_t(date);
+    soup_date_free(date);
+#endif
+    return t;
+}
+
+
+/*
+ * Tell the scheduler to leave the host alone for a while if it is
+ * overloaded or rate limits us and says when to come back.
+ */
+static void
+http_request_check_retry_after(http_request *req,
+                               guint status,
+                               SoupMessageHeaders *headers)
+{
+    const gchar *value;
+    guint64 seconds;
+    time_t retry_t;
+
+    /* 429 Too Many Requests */
+    if ((status != 429 && status != SOUP_STATUS_SERVICE_UNAVAILABLE) ||
+        headers == NULL)
+        return;
+    value = soup_message_headers_get_one(headers, "Retry-After");
+    if (value == NULL)
+        return;
+
+    /* either a number of seconds or an HTTP date */
+    if (!g_ascii_string_to_unsigned(value, 10, 0, G_MAXUINT,
+                                    &seconds, NULL)) {
+        retry_t = parse_http_date(value);
+        if (retry_t == 0)
+            return;
+        seconds = MAX(difftime(retry_t, time(NULL)), 0);
+    }
+    weather_scheduler_retry_after(req->uri, seconds, g_get_monotonic_time());
+}
+
+
+static void
+http_request_free(http_request *req)
+{
+    g_object_unref(req->msg);
+    if (req->cancellable)
+        g_object_unref(req->cancellable);
+    g_free(req->uri);
+    g_slice_free(http_request, req);
+}
+
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+cb_http_request_done(GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+    http_request *req = user_data;
+
+    http_request_check_retry_after(req, soup_message_get_status(req->msg),
+                                   soup_message_get_response_headers(req->msg));
+    req->callback_func(source, result, req->user_data);
+    http_request_free(req);
+}
+
+
+static void
+http_request_send(gpointer user_data)
+{
+    http_request *req = user_data;
+
+    if (req->stream)
+        soup_session_send_async(req->session, req->msg, G_PRIORITY_DEFAULT,
+                                req->cancellable, cb_http_request_done, req);
+    else
+        soup_session_send_and_read_async(req->session, req->msg,
+                                         G_PRIORITY_DEFAULT, req->cancellable,
+                                         cb_http_request_done, req);
+}
+#else
+static void
+cb_http_request_cancelled(GCancellable *cancellable,
+                          gpointer user_data)
+{
+    http_request *req = user_data;
+
+    soup_session_cancel_message(req->session, req->msg,
+                                SOUP_STATUS_CANCELLED);
+}
+
+
+static void
+cb_http_request_done(SoupSession *session,
+                     SoupMessage *msg,
+                     gpointer user_data)
+{
+    http_request *req = user_data;
+
+    if (req->cancellable) {
+        /* a response that arrived before the request could be
+           cancelled must not be used either */
+        if (g_cancellable_is_cancelled(req->cancellable))
+            soup_message_set_status(msg, SOUP_STATUS_CANCELLED);
+        else
+            g_cancellable_disconnect(req->cancellable, req->handler);
+    }
+    http_request_check_retry_after(req, msg->status_code,
+                                   msg->response_headers);
+    req->callback_func(session, msg, req->user_data);
+    http_request_free(req);
+}
+
+
+/*
+ * libsoup2 does not know about GCancellable, so cancel the message
+ * when the cancellable is triggered. The callback sees the status
+ * SOUP_STATUS_CANCELLED then.
+ */
+static void
+http_request_send(gpointer user_data)
+{
+    http_request *req = user_data;
+
+    /* the session takes over the reference of the message */
+    g_object_ref(req->msg);
+    soup_session_queue_message(req->session, req->msg,
+                               cb_http_request_done, req);
+    if (req->cancellable == NULL)
+        return;
+
+    /* the callback may be called from here, don't touch req after */
+    if (g_cancellable_is_cancelled(req->cancellable))
+        soup_session_cancel_message(req->session, req->msg,
+                                    SOUP_STATUS_CANCELLED);
+    else
+        req->handler = g_cancellable_connect(req->cancellable,
+                                             G_CALLBACK(cb_http_request_cancelled),
+                                             req, NULL);
+}
+#endif
+
+
+/*
+ * Hand the message over to the scheduler, which sends it once the
+ * rate limits of the host and requests of higher priority allow.
+ */
+static void
+http_request_schedule(SoupSession *session,
+                      SoupMessage *msg,
+                      const gchar *uri,
+                      weather_schedule_priority priority,
+                      GCancellable *cancellable,
+                      gboolean stream,
+#if SOUP_CHECK_VERSION(3, 0, 0)
+                      GAsyncReadyCallback callback_func,
+#else
+                      SoupSessionCallback callback_func,
+#endif
+                      gpointer user_data)
+{
+    http_request *req;
+
+    req = g_slice_new0(http_request);
+    req->session = session;
+    req->msg = msg;
+    req->uri = g_strdup(uri);
+    req->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    req->stream = stream;
+#endif
+    req->callback_func = callback_func;
+    req->user_data = user_data;
+    weather_scheduler_add(uri, priority, cancellable, http_request_send, req,
+                          g_get_monotonic_time());
+}
+
+
+/*
+ * Send a GET request. If the cancellable is triggered before the
+ * callback has been called, the callback gets G_IO_ERROR_CANCELLED
+ * with libsoup3, or the status SOUP_STATUS_CANCELLED with libsoup2,
+ * and must not use the response.
+ */
 void
 weather_http_queue_request(SoupSession *session,
                            const gchar *uri,
+                           weather_schedule_priority priority,
+                           GCancellable *cancellable,
 #if SOUP_CHECK_VERSION(3, 0, 0)
                            GAsyncReadyCallback callback_func,
 #else
                            SoupSessionCallback callback_func,
 #endif
                            gpointer user_data)
+{
+    http_request_schedule(session, soup_message_new("GET", uri), uri,
+                          priority, cancellable, FALSE,
+                          callback_func, user_data);
+}
+
+
+/*
+ * Send a GET request like weather_http_queue_request, but only ask for
+ * data that has changed since the response the validators of the
+ * update info belong to. With libsoup3, the callback gets the response
+ * body as a stream from soup_session_send_finish instead of reading it
+ * completely first.
+ */
+void
+weather_http_queue_conditional_request(SoupSession *session,
+                                       const gchar *uri,
+                                       const update_info *upi,
+                                       weather_schedule_priority priority,
+                                       GCancellable *cancellable,
+#if SOUP_CHECK_VERSION(3, 0, 0)
+                                       GAsyncReadyCallback callback_func,
+#else
+                                       SoupSessionCallback callback_func,
+#endif
+                                       gpointer user_data)
 {
     SoupMessage *msg;
+    SoupMessageHeaders *headers;
 
     msg = soup_message_new("GET", uri);
 #if SOUP_CHECK_VERSION(3, 0, 0)
-    soup_session_send_and_read_async(session, msg, G_PRIORITY_DEFAULT, NULL,
-                                     callback_func, user_data);
+    headers = soup_message_get_request_headers(msg);
 #else
-    soup_session_queue_message(session, msg, callback_func, user_data);
+    headers = msg->request_headers;
 #endif
+    if (upi->etag)
+        soup_message_headers_replace(headers, "If-None-Match", upi->etag);
+    if (upi->last_modified)
+        soup_message_headers_replace(headers, "If-Modified-Since",
+                                     upi->last_modified);
+    http_request_schedule(session, msg, uri, priority, cancellable, TRUE,
+                          callback_func, user_data);
 }
 
 
@@ -204,7 +548,7 @@ make_label(const plugin_data *data,
 }
 
 
-static update_info *
+update_info *
 make_update_info(const guint check_interval)
 {
     update_info *upi = g_slice_new0(update_info);
@@ -215,15 +559,95 @@ make_update_info(const guint check_interval)
 }
 
 
+void
+update_info_free(update_info *upi)
+{
+    if (G_UNLIKELY(upi == NULL))
+        return;
+    g_free(upi->etag);
+    g_free(upi->last_modified);
+    g_slice_free(update_info, upi);
+}
+
+
+/* the validators take ownership of the strings */
+void
+update_info_set_validators(update_info *upi,
+                           gchar *etag,
+                           gchar *last_modified)
+{
+    g_free(upi->etag);
+    g_free(upi->last_modified);
+    upi->etag = etag;
+    upi->last_modified = last_modified;
+}
+
+
+/*
+ * Return the expiry time of a response with some jitter added, so that
+ * the plugins on many machines do not all download new data at the
+ * same moment. The jitter is fixed for a machine and location, so that
+ * update times do not wander around.
+ */
+time_t
+get_response_expiry(SoupMessageHeaders *headers,
+                    const gchar *lat,
+                    const gchar *lon)
+{
+    const gchar *expires;
+    gchar *seed;
+    time_t expires_t;
+    guint jitter;
+
+    expires = soup_message_headers_get_one(headers, "Expires");
+    if (expires == NULL)
+        return 0;
+    expires_t = parse_http_date(expires);
+    if (expires_t == 0)
+        return 0;
+
+    seed = g_strdup_printf("%s/%s/%s", g_get_host_name(), lat, lon);
+    jitter = g_str_hash(seed) % (EXPIRES_MAX_JITTER + 1);
+    g_free(seed);
+    weather_debug("Response expires at %s, jitter %u s.", expires, jitter);
+    return expires_t + jitter;
+}
+
+
+/*
+ * Record a response to a conditional request in the update info. New
+ * data invalidates the old validators, the caller sets the new ones
+ * once the data has been parsed successfully.
+ */
+weather_response
+update_info_handle_response(update_info *upi,
+                            guint status,
+                            SoupMessageHeaders *headers,
+                            const gchar *lat,
+                            const gchar *lon)
+{
+    upi->attempt++;
+    if (status == SOUP_STATUS_NOT_MODIFIED) {
+        upi->expires = get_response_expiry(headers, lat, lon);
+        return WEATHER_RESPONSE_NOT_MODIFIED;
+    }
+
+    upi->http_status_code = status;
+    if (status != SOUP_STATUS_OK && status != 203)
+        return WEATHER_RESPONSE_FAILED;
+
+    update_info_set_validators(upi, NULL, NULL);
+    upi->expires = get_response_expiry(headers, lat, lon);
+    return WEATHER_RESPONSE_NEW_DATA;
+}
+
+
 static void
 init_update_infos(plugin_data *data)
 {
-    if (G_LIKELY(data->astro_update))
-        g_slice_free(update_info, data->astro_update);
-    if (G_LIKELY(data->weather_update))
-        g_slice_free(update_info, data->weather_update);
-    if (G_LIKELY(data->conditions_update))
-        g_slice_free(update_info, data->conditions_update);
+    update_info_free(data->astro_update);
+    update_info_free(data->weather_update);
+    update_info_free(data->conditions_update);
 
     data->astro_update = make_update_info(24 * 3600);
     data->weather_update = make_update_info(60 * 60);
@@ -403,39 +827,43 @@ update_current_astrodata(plugin_data *data)
             weather_debug("No current astrodata available.");
         else {
             weather_debug("Updated current astrodata.");
-            weather_debug("%s",weather_dump_astro(data->current_astro));
+            weather_dump(weather_dump_astro, data->current_astro);
         }
     }
 }
 
 
-static void
-update_current_conditions(plugin_data *data,
-                          gboolean immediately)
+/* use exact 5 minute intervals for calculation of current conditions */
+static time_t
+calc_conditions_time(time_t now_t)
 {
     struct tm now_tm;
 
-    if (G_UNLIKELY(data->weatherdata == NULL)) {
-        update_icon(data);
-        update_scrollbox(data, TRUE);
-        schedule_next_wakeup(data);
-        return;
-    }
-
-    g_clear_pointer(&data->weatherdata->current_conditions, xml_time_free);
-
-    /* use exact 5 minute intervals for calculation */
-    time(&data->conditions_update->last);
-    now_tm = *localtime(&data->conditions_update->last);
+    now_tm = *localtime(&now_t);
     now_tm.tm_min -= (now_tm.tm_min % 5);
     if (now_tm.tm_min < 0)
         now_tm.tm_min = 0;
     now_tm.tm_sec = 0;
-    data->conditions_update->last = mktime(&now_tm);
+    return mktime(&now_tm);
+}
 
-    data->weatherdata->current_conditions =
-        make_current_conditions(data->weatherdata,
-                                data->conditions_update->last);
+
+/*
+ * Show the current conditions of the weather data, which have been
+ * calculated for conditions_update->last.
+ */
+static void
+show_current_conditions(plugin_data *data,
+                        gboolean immediately)
+{
+    time_t day_t;
+
+    /* forecast days are relative to today, so recompute on a new day */
+    day_t = day_at_midnight(data->conditions_update->last, 0);
+    if (data->data_day != day_t) {
+        data->data_day = day_t;
+        data->data_generation++;
+    }
 
     /* update current astrodata */
     update_current_astrodata(data);
@@ -446,231 +874,651 @@ update_current_conditions(plugin_data *data,
     update_scrollbox(data, immediately);
 
     /* schedule next update */
-    now_tm.tm_min += 5;
-    data->conditions_update->next = mktime(&now_tm);
+    data->conditions_update->next = data->conditions_update->last + 5 * 60;
     schedule_next_wakeup(data);
 
     weather_debug("Updated current conditions.");
 }
 
 
-static time_t
+static void
+update_current_conditions(plugin_data *data,
+                          gboolean immediately)
+{
+    if (G_UNLIKELY(data->weatherdata == NULL)) {
+        update_icon(data);
+        update_scrollbox(data, TRUE);
+        schedule_next_wakeup(data);
+        return;
+    }
+
+    g_clear_pointer(&data->weatherdata->current_conditions, xml_time_free);
+    data->conditions_update->last = calc_conditions_time(time(NULL));
+    data->weatherdata->current_conditions =
+        make_current_conditions(data->weatherdata,
+                                data->conditions_update->last);
+    show_current_conditions(data, immediately);
+}
+
+
+time_t
 calc_next_download_time(const update_info *upi,
                         time_t retry_t) {
     struct tm retry_tm;
     guint interval;
 
-    retry_tm = *localtime(&retry_t);
+    /* If the download failed, retry after the delay of the backoff
+     * policy, but not later than the default check unless the breaker
+     * of the endpoint is open.
+     */
+    if (G_UNLIKELY(upi->attempt > 0))
+        return weather_backoff_next(&upi->backoff, retry_t,
+                                    upi->check_interval);
 
-    /* If the download failed, retry immediately using a small retry
-     * interval for a limited number of times. If it still fails after
-     * that, continue using a larger interval or the default check,
-     * whatever is smaller.
+    /* Download new data shortly after the server says the current
+     * data expires, but neither too early nor too late in case the
+     * expiry time is way off.
      */
-    if (G_LIKELY(upi->attempt == 0))
+    retry_tm = *localtime(&retry_t);
+    if (upi->expires > 0)
+        interval = CLAMP(difftime(upi->expires, retry_t),
+                         EXPIRES_MIN_INTERVAL, EXPIRES_MAX_INTERVAL);
+    else
         interval = upi->check_interval;
-    else if (upi->attempt <= CONN_MAX_ATTEMPTS)
-        interval = CONN_RETRY_INTERVAL_SMALL;
-    else {
-        if (upi->check_interval > CONN_RETRY_INTERVAL_LARGE)
-            interval = CONN_RETRY_INTERVAL_LARGE;
-        else
-            interval = upi->check_interval;
-    }
 
     weather_debug("interval=%d", interval);
 
     return time_calc(retry_tm, 0, 0, 0, 0, 0, interval);
 }
 
+
 /*
- * Process downloaded sun astro data and schedule next astro update.
+ * Finish a successful update of the astronomical data, whether it was
+ * downloaded or calculated, and schedule the next astro update.
  */
 static void
-#if SOUP_CHECK_VERSION(3, 0, 0)
-cb_astro_update_sun(GObject *source,
-                    GAsyncResult *result,
-#else
-cb_astro_update_sun(SoupSession *session,
-                    SoupMessage *msg,
-#endif
-                    gpointer user_data)
+astro_update_finish(plugin_data *data)
 {
-    plugin_data *data = user_data;
-    json_object *json_tree;
     time_t now_t;
-    guint astro_forecast_days;
-    const gchar *body = NULL;
-    gsize len = 0;
-#if SOUP_CHECK_VERSION(3, 0, 0)
-    SoupMessage *msg;
-    GError *error = NULL;
-    GBytes *response;
 
-    msg = soup_session_get_async_result_message(SOUP_SESSION(source), result);
-    data->msg_parse->sun_msg_processed++;
-    data->astro_update->http_status_code = soup_message_get_status(msg);
-    response = soup_session_send_and_read_finish(SOUP_SESSION(source),
-                                                 result, &error);
-    if (G_LIKELY(error == NULL)) {
-        body = g_bytes_get_data(response, &len);
-#else
-     data->msg_parse->sun_msg_processed++;
-     data->astro_update->http_status_code = msg->status_code;
-     if ((msg->status_code == 200 || msg->status_code == 203)) {
-         if (G_LIKELY(msg->response_body && msg->response_body->data)) {
-             body = msg->response_body->data;
-             len = msg->response_body->length;
-         }
-#endif
-        json_tree = get_json_tree(body, len);
-        if (G_LIKELY(json_tree)) {
-            if (!parse_astrodata_sun(json_tree, data->astrodata))  {
-                data->msg_parse->sun_msg_parse_error++;
-                g_warning("Error parsing sun astronomical data!");
-                weather_debug("data->astrodata:%s",
-                              weather_dump_astrodata(data->astrodata));
-            } else {
-                weather_dump(weather_dump_astrodata, data->astrodata);
-            }
-            g_assert(json_object_put(json_tree) ==1);
-        } else {
-            g_warning("Error parsing sun astronomical data!");
-            weather_debug("No json_tree");
+    astrodata_clean(data->astrodata);
+    g_array_sort(data->astrodata, (GCompareFunc) xml_astro_compare);
+    data->astro_update->attempt = 0;
+    weather_debug("astro data update scheduled!");
+    time(&now_t);
+    data->astro_update->last = now_t;
+    data->astro_update->next = calc_next_download_time(data->astro_update, now_t);
+    update_current_astrodata(data);
+    /* update icon */
+    data->night_time = is_night_time(data->current_astro, data->offset);
+    update_icon(data);
+    data->astro_update->finished = TRUE;
+}
+
+
+/*
+ * Find the days of the forecast horizon, which includes one day in
+ * advance, without complete astrodata. Astrodata of a day never
+ * changes, so only these need to be downloaded or calculated.
+ */
+static guint
+find_missing_astro_days(plugin_data *data,
+                        time_t now_t)
+{
+    parse_info *mp = data->msg_parse;
+    xml_astro *astro;
+    time_t day_t;
+    guint day;
+
+    mp->astro_num_days = 0;
+    for (day = 0; day <= MIN(data->forecast_days, MAX_FORECAST_DAYS); day++) {
+        day_t = day_at_midnight(now_t, day);
+        astro = get_astro(data->astrodata, day_t, NULL);
+        /* the moon phase is missing if the moon data failed */
+        if (astro == NULL || astro->moon_phase == NULL)
+            mp->astro_days[mp->astro_num_days++] = day_t;
+    }
+    return mp->astro_num_days;
+}
+
+
+/* parse the sun or moon part of the astro data of a day */
+static gboolean
+astro_parse_response(plugin_data *data,
+                     guint status,
+                     const gchar *body,
+                     gsize len,
+                     guint day,
+                     guint part)
+{
+    parse_info *mp = data->msg_parse;
+    json_object *json_tree;
+    gboolean parsed;
+
+    data->astro_update->http_status_code = status;
+    json_tree = get_json_tree(body, len);
+    if (G_UNLIKELY(json_tree == NULL)) {
+        g_warning("Error parsing astronomical data!");
+        weather_debug("No json_tree");
+        return FALSE;
+    }
+
+    if (part == ASTRO_PART_SUN)
+        parsed = parse_astrodata_sun(json_tree, mp->astrodata);
+    else
+        parsed = parse_astrodata_moon(json_tree, mp->astrodata);
+    json_object_put(json_tree);
+    if (G_UNLIKELY(!parsed)) {
+        g_warning("Error parsing %s astronomical data!",
+                  part == ASTRO_PART_SUN ? "sun" : "moon");
+        return FALSE;
+    }
+
+    mp->astro_done[day] |= part;
+    weather_dump(weather_dump_astrodata, mp->astrodata);
+    return TRUE;
+}
+
+
+static gboolean
+cb_astro_sun(guint status,
+             const gchar *body,
+             gsize len,
+             gpointer request_data,
+             gpointer user_data)
+{
+    return astro_parse_response(user_data, status, body, len,
+                                GPOINTER_TO_UINT(request_data),
+                                ASTRO_PART_SUN);
+}
+
+
+static gboolean
+cb_astro_moon(guint status,
+              const gchar *body,
+              gsize len,
+              gpointer request_data,
+              gpointer user_data)
+{
+    return astro_parse_response(user_data, status, body, len,
+                                GPOINTER_TO_UINT(request_data),
+                                ASTRO_PART_MOON);
+}
+
+
+static void
+cancel_astro_download(plugin_data *data)
+{
+    weather_fetch_free(data->astro_fetch);
+    data->astro_fetch = NULL;
+    if (data->msg_parse->astrodata) {
+        astrodata_free(data->msg_parse->astrodata);
+        data->msg_parse->astrodata = NULL;
+    }
+}
+
+
+/*
+ * Keep the download lease from being taken as abandoned by other
+ * plugin instances while the download or the merge is still pending.
+ * Once it has finished, the lease ages as usual until it is released
+ * with the cache write.
+ */
+static gboolean
+cb_refresh_download_lease(gpointer user_data)
+{
+    plugin_data *data = user_data;
+
+    if (data->download_lease == NULL || data->weather_update->finished) {
+        data->lease_timer = 0;
+        return G_SOURCE_REMOVE;
+    }
+    weather_cache_store_refresh_lease(data->cache_store,
+                                      data->download_lease);
+    return G_SOURCE_CONTINUE;
+}
+
+
+static void
+release_download_lease(plugin_data *data)
+{
+    if (data->lease_timer) {
+        g_source_remove(data->lease_timer);
+        data->lease_timer = 0;
+    }
+    if (data->download_lease == NULL)
+        return;
+    weather_cache_store_release_lease(data->cache_store,
+                                      data->download_lease);
+    g_clear_pointer(&data->download_lease, g_free);
+}
+
+
+/*
+ * Start a new request generation. The requests of the previous one are
+ * cancelled, as their responses belong to data that has been reset or
+ * is about to be, and must neither be parsed nor merged.
+ */
+void
+weather_cancel_requests(plugin_data *data)
+{
+    if (data->cancellable) {
+        g_cancellable_cancel(data->cancellable);
+        g_object_unref(data->cancellable);
+    }
+    data->cancellable = g_cancellable_new();
+    data->request_generation++;
+    /* a pending load of cached data is dropped along with it */
+    data->cache_loading = FALSE;
+    cancel_astro_download(data);
+    release_download_lease(data);
+    weather_debug("Starting request generation %u.",
+                  data->request_generation);
+}
+
+
+/*
+ * Called once all astro requests are done. The days for which both
+ * sun and moon data arrived are used even if others failed, so that
+ * only the failed ones need to be downloaded again.
+ */
+static void
+cb_astro_download_done(weather_fetch *fetch,
+                       guint failed,
+                       gpointer user_data)
+{
+    plugin_data *data = user_data;
+    parse_info *mp = data->msg_parse;
+    xml_astro *astro;
+    guint status, i;
+
+    for (i = 0; i < mp->astro_num_days; i++) {
+        if (mp->astro_done[i] != ASTRO_PART_ALL)
+            continue;
+        astro = get_astro(mp->astrodata, mp->astro_days[i], NULL);
+        if (G_LIKELY(astro))
+            merge_astro(data->astrodata, astro);
+    }
+    status = weather_fetch_get_failed_status(fetch);
+    cancel_astro_download(data);
+
+    if (G_LIKELY(failed == 0)) {
+        weather_backoff_succeeded(&data->astro_update->backoff);
+        astro_update_finish(data);
+        return;
+    }
+
+    weather_debug("astro data update failed for %u requests!", failed);
+    weather_backoff_failed(&data->astro_update->backoff, status, time(NULL));
+    g_array_sort(data->astrodata, (GCompareFunc) xml_astro_compare);
+    update_current_astrodata(data);
+    data->astro_update->next =
+        calc_next_download_time(data->astro_update, time(NULL));
+}
+
+
+/*
+ * Download sun and moon data of the missing days at the same time,
+ * retrying single requests that fail.
+ */
+static void
+start_astro_download(plugin_data *data)
+{
+    static const gchar *parts[] = { "sun", "moon" };
+    parse_info *mp = data->msg_parse;
+    struct tm day_tm;
+    gchar *url;
+    guint day, i;
+
+    data->astro_update->attempt++;
+    mp->astrodata = g_array_sized_new(FALSE, TRUE, sizeof(xml_astro *),
+                                      mp->astro_num_days);
+    memset(mp->astro_done, 0, sizeof(mp->astro_done));
+    data->astro_fetch = weather_fetch_new(data->session,
+                                          WEATHER_SCHEDULE_ASTRO,
+                                          ASTRO_MAX_CONNECTIONS,
+                                          ASTRO_MAX_ATTEMPTS,
+                                          cb_astro_download_done, data);
+
+    for (day = 0; day < mp->astro_num_days; day++) {
+        day_tm = *localtime(&mp->astro_days[day]);
+        for (i = 0; i < G_N_ELEMENTS(parts); i++) {
+            url = g_strdup_printf("https://aa062reffgwvo1efa.api.met.no/weatherapi"
+                                  "/sunrise/3.0/%s?lat=%s&lon=%s&"
+                                  "date=%04d-%02d-%02d&"
+                                  "offset=%s",
+                                  parts[i], data->lat, data->lon,
+                                  day_tm.tm_year + 1900,
+                                  day_tm.tm_mon + 1,
+                                  day_tm.tm_mday,
+                                  data->offset);
+            weather_debug("getting %s data: %s", parts[i], url);
+            weather_fetch_add(data->astro_fetch, url,
+                              i == 0 ? cb_astro_sun : cb_astro_moon,
+                              GUINT_TO_POINTER(day));
+            g_free(url);
         }
-#if SOUP_CHECK_VERSION(3, 0, 0)
-        g_bytes_unref(response);
-#endif
-     } else {
-        data->msg_parse->http_msg_fail = TRUE;
-#if SOUP_CHECK_VERSION(3, 0, 0)
-        g_warning_once("Download of sun astronomical data failed: %s",
-                       error->message);
-        g_error_free(error);
-#else
-        g_warning_once("Download of sun astronomical data failed with HTTP Status Code %d, Reason phrase: %s",
-                       msg->status_code, msg->reason_phrase);
-#endif
     }
+    weather_fetch_start(data->astro_fetch);
+}
 
-    astro_forecast_days = data->forecast_days + 1;
-    if (data->msg_parse->sun_msg_processed == astro_forecast_days) {
-        if (G_LIKELY(data->msg_parse->sun_msg_parse_error == 0 && !data->msg_parse->http_msg_fail)) {
-            data->msg_parse->astro_dwnld_state = ASTRO_DWNLD_MOON;
-            time(&now_t);
-            /* schedule astro moon data downloads immediately */
-            data->astro_update->next = now_t;
-            weather_debug( "astro moon data update scheduled! \n");
-            schedule_next_wakeup(data);
-        } else {
-            data->msg_parse->astro_dwnld_state = ASTRO_DWNLD_SUN;
-            weather_debug( "astro sun data update failed! \n");
-            time(&now_t);
-            data->astro_update->next = calc_next_download_time(data->astro_update,now_t);
+
+static void
+weather_merge_free(weather_merge *merge)
+{
+    xml_weather_unref(merge->base);
+    if (merge->chunks)
+        g_async_queue_unref(merge->chunks);
+    g_free(merge->etag);
+    g_free(merge->last_modified);
+    g_slice_free(weather_merge, merge);
+}
+
+
+/*
+ * Parse the downloaded data into scratch weather data while it is
+ * being received. The main context pushes each chunk to the queue,
+ * followed by an empty one at the end of the download. The data is
+ * only merged if the download completed and could be parsed.
+ */
+static xml_weather *
+weather_merge_parse(weather_merge *merge)
+{
+    weather_parser *parser;
+    xml_weather *scratch;
+    GBytes *chunk;
+    gconstpointer buf;
+    gsize len;
+    gboolean parsed;
+
+    scratch = make_weather_data();
+    parser = G_LIKELY(scratch) ? weather_parser_new(scratch) : NULL;
+    parsed = (parser != NULL);
+
+    /* the queue is drained in any case, as the download goes on */
+    for (;;) {
+        chunk = g_async_queue_pop(merge->chunks);
+        buf = g_bytes_get_data(chunk, &len);
+        if (len == 0) {
+            g_bytes_unref(chunk);
+            break;
         }
+        if (parsed)
+            parsed = weather_parser_feed(parser, buf, len);
+        g_bytes_unref(chunk);
+    }
+
+    /* failed has been set before the end was pushed */
+    parsed = parsed && !merge->failed && weather_parser_finish(parser);
+    merge->invalid = !parsed && !merge->failed;
+    weather_parser_free(parser);
+    if (G_UNLIKELY(!parsed)) {
+        xml_weather_unref(scratch);
+        return NULL;
     }
+    return scratch;
 }
 
 
 /*
- * Process downloaded moon astro data and schedule next astro update.
+ * Build the new snapshot: parse the downloaded data, merge it into a
+ * copy of the current snapshot, drop outdated timeslices, sort them
+ * and rebuild the time series. Nothing of this touches the plugin
+ * data, which the main context may change meanwhile, or depends on the
+ * time zone, which it may change too. If the data cannot be parsed,
+ * there is no new snapshot, so that the current one stays published.
  */
 static void
-#if SOUP_CHECK_VERSION(3, 0, 0)
-cb_astro_update_moon(GObject *source,
-                     GAsyncResult *result,
-#else
-cb_astro_update_moon(SoupSession *session,
-                     SoupMessage *msg,
-#endif
-                     gpointer user_data)
+weather_merge_thread(GTask *task,
+                     gpointer source_object,
+                     gpointer task_data,
+                     GCancellable *cancellable)
+{
+    weather_merge *merge = task_data;
+    xml_weather *wd, *scratch = NULL;
+
+    if (merge->chunks) {
+        scratch = weather_merge_parse(merge);
+        if (G_UNLIKELY(scratch == NULL)) {
+            g_task_return_pointer(task, NULL, NULL);
+            return;
+        }
+    }
+
+    wd = xml_weather_copy(merge->base);
+    if (G_UNLIKELY(wd == NULL)) {
+        xml_weather_unref(scratch);
+        g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                "Could not copy weather data");
+        return;
+    }
+    if (scratch) {
+        xml_weather_merge(wd, scratch);
+        xml_weather_unref(scratch);
+    }
+
+    if (g_task_return_error_if_cancelled(task)) {
+        xml_weather_unref(wd);
+        return;
+    }
+
+    xml_weather_clean(wd);
+    g_array_sort(wd->timeslices, (GCompareFunc) xml_time_compare);
+    xml_weather_update_series(wd);
+    g_task_return_pointer(task, wd, (GDestroyNotify) xml_weather_unref);
+}
+
+
+static void
+weather_update_failed(plugin_data *data,
+                      time_t now_t)
+{
+    weather_backoff_failed(&data->weather_update->backoff,
+                           data->weather_update->http_status_code, now_t);
+    data->weather_update->next = calc_next_download_time(data->weather_update,
+                                                         now_t);
+}
+
+
+/*
+ * Publish the merged snapshot and schedule the next weather update.
+ * If the request generation has been cancelled meanwhile, the result
+ * is dropped without touching the plugin data.
+ */
+static void
+cb_weather_merged(GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
 {
     plugin_data *data = user_data;
-    json_object *json_tree;
+    weather_merge *merge = g_task_get_task_data(G_TASK(result));
+    xml_weather *wd, *old;
+    GError *error = NULL;
     time_t now_t;
-    guint astro_forecast_days;
-    const gchar *body = NULL;
-    gsize len = 0;
+
+    wd = g_task_propagate_pointer(G_TASK(result), &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        weather_debug("Merging of weather data has been cancelled.");
+        g_error_free(error);
+        return;
+    }
+
+    time(&now_t);
+    if (G_UNLIKELY(error)) {
+        g_warning("%s", error->message);
+        g_error_free(error);
+        merge->failed = TRUE;
+    } else if (merge->invalid)
+        g_warning("Error parsing weather data!");
+
+    if (G_UNLIKELY(merge->failed || merge->invalid))
+        weather_update_failed(data, now_t);
+    else {
+        weather_backoff_succeeded(&data->weather_update->backoff);
+        data->weather_update->attempt = 0;
+        data->weather_update->last =
+            merge->downloaded ? merge->downloaded : now_t;
+        if (merge->chunks)
+            update_info_set_validators(data->weather_update,
+                                       g_steal_pointer(&merge->etag),
+                                       g_steal_pointer(&merge->last_modified));
+        data->weather_update->next =
+            calc_next_download_time(data->weather_update, now_t);
+    }
+
+    if (G_LIKELY(wd)) {
+        /* the current conditions depend on the time zone, which only
+           changes in the main context */
+        wd->current_conditions =
+            make_current_conditions(wd, merge->conditions_t);
+
+        /* readers all run in the main context, so swapping the
+           pointer here publishes the snapshot atomically for them */
+        old = data->weatherdata;
+        data->weatherdata = wd;
+        xml_weather_unref(old);
+        data->data_generation++;
+        data->conditions_update->last = merge->conditions_t;
+        weather_debug("Updating current conditions.");
+        show_current_conditions(data, TRUE);
+        gtk_scrollbox_reset(GTK_SCROLLBOX(data->scrollbox));
+    }
+
+    data->weather_update->finished = TRUE;
+    weather_dump(weather_dump_weatherdata, data->weatherdata);
+}
+
+
+static void
+start_weather_merge(plugin_data *data,
+                    weather_merge *merge)
+{
+    GTask *task;
+
+    merge->conditions_t = calc_conditions_time(time(NULL));
+    task = g_task_new(NULL, data->cancellable, cb_weather_merged, data);
+    g_task_set_task_data(task, merge, (GDestroyNotify) weather_merge_free);
+    g_task_run_in_thread(task, weather_merge_thread);
+    g_object_unref(task);
+}
+
+
+/*
+ * Finish processing of a weather data download without new data. If
+ * it failed, nothing has changed, so the current snapshot stays
+ * published and only the next download is scheduled.
+ */
+static void
+weather_update_finish(plugin_data *data,
+                      gboolean failed)
+{
+    weather_merge *merge;
+
+    if (failed) {
+        weather_update_failed(data, time(NULL));
+        data->weather_update->finished = TRUE;
+        schedule_next_wakeup(data);
+        return;
+    }
+
+    merge = g_slice_new0(weather_merge);
+    merge->base = xml_weather_ref(data->weatherdata);
+    start_weather_merge(data, merge);
+}
+
+
+/*
+ * Start merging new weather data, which is parsed on a worker thread
+ * while it is being downloaded. The caller pushes the chunks of data
+ * to the returned queue and must push an empty chunk at the end, after
+ * setting failed in the merge if the download did not complete. The
+ * merge must not be used any more after that.
+ */
+static weather_merge *
+weather_update_receive(plugin_data *data,
+                       gchar *etag,
+                       gchar *last_modified)
+{
+    weather_merge *merge;
+
+    merge = g_slice_new0(weather_merge);
+    merge->base = xml_weather_ref(data->weatherdata);
+    merge->chunks =
+        g_async_queue_new_full((GDestroyNotify) g_bytes_unref);
+    merge->etag = etag;
+    merge->last_modified = last_modified;
+    start_weather_merge(data, merge);
+    return merge;
+}
+
+
 #if SOUP_CHECK_VERSION(3, 0, 0)
-    SoupMessage *msg;
+/* let the worker parsing the data know that the download has ended */
+static void
+weather_download_end(weather_download *dl,
+                     gboolean failed)
+{
+    if (dl->merge == NULL)
+        return;
+    dl->merge->failed = failed;
+    dl->merge = NULL;
+    g_async_queue_push(dl->chunks, g_bytes_new(NULL, 0));
+}
+
+
+static void
+weather_download_free(weather_download *dl)
+{
+    weather_download_end(dl, TRUE);
+    g_async_queue_unref(dl->chunks);
+    g_object_unref(dl->stream);
+    g_object_unref(dl->cancellable);
+    g_slice_free(weather_download, dl);
+}
+
+
+/*
+ * Read the next chunk of the weather data response and hand it over
+ * to the worker parsing it, until the end of the stream is reached.
+ */
+static void
+cb_weather_read(GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    weather_download *dl = user_data;
     GError *error = NULL;
-    GBytes *response;
+    GBytes *chunk;
 
-    response = soup_session_send_and_read_finish(SOUP_SESSION(source),
-                                                 result, &error);
-    msg = soup_session_get_async_result_message(SOUP_SESSION(source), result);
-    data->msg_parse->moon_msg_processed++;
-    data->astro_update->http_status_code = soup_message_get_status(msg);
-    if (G_LIKELY(error == NULL)) {
-        body = g_bytes_get_data(response, &len);
-#else
-     data->msg_parse->moon_msg_processed++;
-     data->astro_update->http_status_code = msg->status_code;
-     if ((msg->status_code == 200 || msg->status_code == 203)) {
-         if (G_LIKELY(msg->response_body && msg->response_body->data)) {
-             body = msg->response_body->data;
-             len = msg->response_body->length;
-         }
-#endif
-        json_tree = get_json_tree(body, len);
-        if (G_LIKELY(json_tree)) {
-            if (!parse_astrodata_moon(json_tree, data->astrodata))  {
-                data->msg_parse->moon_msg_parse_error++;
-                g_warning("Error parsing moon astronomical data");
-                weather_debug("data->astrodata:%s",
-                              weather_dump_astrodata(data->astrodata));
-            } else {
-                weather_dump(weather_dump_astrodata, data->astrodata);
-            }
-            g_assert(json_object_put(json_tree) ==1);
-        } else {
-            g_warning("Error parsing moon astronomical data");
-            weather_debug("No json_tree");
-        }
-#if SOUP_CHECK_VERSION(3, 0, 0)
-        g_bytes_unref(response);
-#endif
-     } else {
-        data->msg_parse->http_msg_fail = TRUE;
-#if SOUP_CHECK_VERSION(3, 0, 0)
-        g_warning_once("Download of moon astronomical data failed: %s",
-                       error->message);
+    chunk = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source),
+                                             result, &error);
+    if (G_UNLIKELY(error)) {
+        /* the merge fails, or is dropped if the download has been
+           cancelled along with it */
+        weather_debug("Download of weather data failed: %s", error->message);
         g_error_free(error);
-#else
-        g_warning_once("Download of moon astronomical data failed with HTTP Status Code %d, Reason phrase: %s",
-                       msg->status_code, msg->reason_phrase);
-#endif
-     }
-
-    astro_forecast_days = data->forecast_days + 1;
-    if (data->msg_parse->sun_msg_processed == astro_forecast_days && data->msg_parse->moon_msg_processed == astro_forecast_days) {
-        if (G_LIKELY(data->msg_parse->moon_msg_parse_error == 0 && !data->msg_parse->http_msg_fail)) {
-            astrodata_clean(data->astrodata);
-            g_array_sort(data->astrodata, (GCompareFunc) xml_astro_compare);
-            data->astro_update->attempt = 0;
-            weather_debug( "astro sun data update scheduled! \n");
-            time(&now_t);
-            data->astro_update->last = now_t;
-            data->astro_update->next = calc_next_download_time(data->astro_update,now_t);
-            update_current_astrodata(data);
-            /* update icon */
-            data->night_time = is_night_time(data->current_astro, data->offset);
-            update_icon(data);
-            data->astro_update->finished = TRUE;
-            data->msg_parse->astro_dwnld_state = ASTRO_DWNLD_SUN;
-        } else {
-            data->msg_parse->astro_dwnld_state = ASTRO_DWNLD_MOON;
-            weather_debug( "astro moon data update failed! \n");
-            time(&now_t);
-            data->astro_update->next = calc_next_download_time(data->astro_update,now_t);
-            data->astro_update->attempt++;
-        }
+        weather_download_free(dl);
+        return;
     }
+
+    if (g_bytes_get_size(chunk) > 0) {
+        g_async_queue_push(dl->chunks, chunk);
+        g_input_stream_read_bytes_async(dl->stream, WEATHER_CHUNK_SIZE,
+                                        G_PRIORITY_DEFAULT, dl->cancellable,
+                                        cb_weather_read, dl);
+        return;
+    }
+    g_bytes_unref(chunk);
+
+    weather_download_end(dl, FALSE);
+    weather_download_free(dl);
 }
+#endif
 
 
 /*
- * Process downloaded weather data and schedule next weather update.
+ * Process downloaded weather data. With libsoup3, the response is
+ * read in chunks without blocking the main loop.
  */
 static void
 #if SOUP_CHECK_VERSION(3, 0, 0)
@@ -683,75 +1531,137 @@ cb_weather_update(SoupSession *session,
                   gpointer user_data)
 {
     plugin_data *data = user_data;
-    xmlDoc *doc = NULL;
-    xmlNode *root_node;
-    time_t now_t;
-    gboolean parsing_error = TRUE;
-    const gchar *body = NULL;
-    gsize len = 0;
 #if SOUP_CHECK_VERSION(3, 0, 0)
     SoupMessage *msg;
+    SoupMessageHeaders *headers;
     GError *error = NULL;
-    GBytes *response = NULL;
-
-    weather_debug("Processing downloaded weather data.");
-    response = soup_session_send_and_read_finish(SOUP_SESSION(source),
-                                                 result, &error);
-    msg = soup_session_get_async_result_message(SOUP_SESSION(source), result);
-    time(&now_t);
-    data->weather_update->attempt++;
-    data->weather_update->http_status_code = soup_message_get_status(msg);
-    if (G_LIKELY(error == NULL)) {
-        body = g_bytes_get_data(response, &len);
+    GInputStream *stream;
+    weather_download *dl;
+    guint status;
 #else
-     weather_debug("Processing downloaded weather data.");
-     time(&now_t);
-     data->weather_update->attempt++;
-     data->weather_update->http_status_code = msg->status_code;
-     if (msg->status_code == 200 || msg->status_code == 203) {
-         if (G_LIKELY(msg->response_body && msg->response_body->data)) {
-             body = msg->response_body->data;
-             len = msg->response_body->length;
-         }
-#endif
-        doc = get_xml_document(body, len);
-        if (G_LIKELY(doc)) {
-            root_node = xmlDocGetRootElement(doc);
-            if (G_LIKELY(root_node))
-                if (parse_weather(root_node, data->weatherdata)) {
-                    data->weather_update->attempt = 0;
-                    data->weather_update->last = now_t;
-                    parsing_error = FALSE;
-                }
-            xmlFreeDoc(doc);
-        }
-#if SOUP_CHECK_VERSION(3, 0, 0)
-        g_bytes_unref(response);
+    weather_merge *merge;
+    GAsyncQueue *chunks;
 #endif
-        if (parsing_error)
-            g_warning("Error parsing weather data!");
-    } else {
+    weather_response response;
+
 #if SOUP_CHECK_VERSION(3, 0, 0)
+    stream = soup_session_send_finish(SOUP_SESSION(source), result, &error);
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        weather_debug("Weather data download has been cancelled.");
+        g_error_free(error);
+        return;
+    }
+
+    weather_debug("Processing downloaded weather data.");
+    msg = soup_session_get_async_result_message(SOUP_SESSION(source), result);
+    status = soup_message_get_status(msg);
+    if (G_UNLIKELY(error)) {
+        data->weather_update->attempt++;
+        data->weather_update->http_status_code = status;
         weather_debug("Download of weather data failed: %s", error->message);
         g_error_free(error);
+        weather_update_finish(data, TRUE);
+        return;
+    }
+
+    headers = soup_message_get_response_headers(msg);
+    response = update_info_handle_response(data->weather_update, status,
+                                           headers, data->lat, data->lon);
+    if (response == WEATHER_RESPONSE_NOT_MODIFIED) {
+        weather_debug("Weather data has not been modified.");
+        g_object_unref(stream);
+        weather_update_finish(data, FALSE);
+        return;
+    }
+    if (response == WEATHER_RESPONSE_FAILED) {
+        weather_debug("Download of weather data failed with HTTP Status "
+                      "Code %d, Reason phrase: %s", status,
+                      soup_message_get_reason_phrase(msg));
+        g_object_unref(stream);
+        weather_update_finish(data, TRUE);
+        return;
+    }
+
+    dl = g_slice_new0(weather_download);
+    dl->cancellable = g_object_ref(data->cancellable);
+    dl->stream = stream;
+    dl->merge = weather_update_receive
+        (data,
+         g_strdup(soup_message_headers_get_one(headers, "ETag")),
+         g_strdup(soup_message_headers_get_one(headers, "Last-Modified")));
+    dl->chunks = g_async_queue_ref(dl->merge->chunks);
+    g_input_stream_read_bytes_async(stream, WEATHER_CHUNK_SIZE,
+                                    G_PRIORITY_DEFAULT, dl->cancellable,
+                                    cb_weather_read, dl);
 #else
+    if (msg->status_code == SOUP_STATUS_CANCELLED) {
+        weather_debug("Weather data download has been cancelled.");
+        return;
+    }
+
+    weather_debug("Processing downloaded weather data.");
+    response = update_info_handle_response(data->weather_update,
+                                           msg->status_code,
+                                           msg->response_headers,
+                                           data->lat, data->lon);
+    if (response == WEATHER_RESPONSE_NOT_MODIFIED) {
+        weather_debug("Weather data has not been modified.");
+        weather_update_finish(data, FALSE);
+    } else if (response == WEATHER_RESPONSE_NEW_DATA) {
+        if (G_LIKELY(msg->response_body && msg->response_body->length)) {
+            /* the whole body has been received, so it is a single chunk */
+            merge = weather_update_receive
+                (data,
+                 g_strdup(soup_message_headers_get_one(msg->response_headers,
+                                                       "ETag")),
+                 g_strdup(soup_message_headers_get_one(msg->response_headers,
+                                                       "Last-Modified")));
+            chunks = g_async_queue_ref(merge->chunks);
+            g_async_queue_push(chunks,
+                               g_bytes_new(msg->response_body->data,
+                                           msg->response_body->length));
+            g_async_queue_push(chunks, g_bytes_new(NULL, 0));
+            g_async_queue_unref(chunks);
+        } else {
+            g_warning("Error parsing weather data!");
+            weather_update_finish(data, TRUE);
+        }
+    } else {
         weather_debug
             ("Download of weather data failed with HTTP Status Code %d, "
              "Reason phrase: %s", msg->status_code, msg->reason_phrase);
-#endif
+        weather_update_finish(data, TRUE);
     }
-     data->weather_update->next = calc_next_download_time(data->weather_update,
-                                                         now_t);
+#endif
+}
 
-    xml_weather_clean(data->weatherdata);
-    g_array_sort(data->weatherdata->timeslices,
-                 (GCompareFunc) xml_time_compare);
-    weather_debug("Updating current conditions.");
-    update_current_conditions(data, !parsing_error);
-    gtk_scrollbox_reset(GTK_SCROLLBOX(data->scrollbox));
 
-    data->weather_update->finished = TRUE;
-    weather_dump(weather_dump_weatherdata, data->weatherdata);
+static void
+start_weather_download(plugin_data *data)
+{
+    gchar *api_version = FORECAST_API;
+    gchar *url;
+
+    /* pending until the data has been merged, see
+       cb_refresh_download_lease */
+    data->weather_update->started = TRUE;
+    data->weather_update->finished = FALSE;
+
+    /* build url */
+    url = g_strdup_printf("https://aa062reffgwvo1efa.api.met.no"
+                          "/weatherapi/locationforecast/%s/"
+                          "classic?lat=%s&lon=%s&altitude=%d",
+                          api_version,
+                          data->lat, data->lon, data->msl);
+
+    /* start receive thread */
+    weather_debug("getting %s", url);
+    weather_http_queue_conditional_request(data->session, url,
+                                           data->weather_update,
+                                           WEATHER_SCHEDULE_FORECAST,
+                                           data->cancellable,
+                                           cb_weather_update, data);
+    g_free(url);
 }
 
 
@@ -759,18 +1669,12 @@ static gboolean
 update_handler(gpointer user_data)
 {
     plugin_data *data = user_data;
-    gchar *api_version = FORECAST_API;
-    gchar *url;
     gboolean night_time;
-    time_t now_t, day_t;
+    time_t now_t;
     struct tm now_tm;
-    guint day;
-    guint astro_forecast_days;
 
     g_return_val_if_fail (data != NULL, FALSE);
 
-    dwnld_state astro_dwnld_state = data->msg_parse->astro_dwnld_state;
-
     /* plugin has not been configured yet, so simply update icon and
        scrollbox and return */
     if (G_UNLIKELY(data->lat == NULL || data->lon == NULL)) {
@@ -779,6 +1683,11 @@ update_handler(gpointer user_data)
         return FALSE;
     }
 
+    /* the cached data decides what needs to be downloaded, its
+       callback schedules the next update */
+    if (data->cache_loading)
+        return FALSE;
+
     now_t = time(NULL);
     now_tm = *localtime(&now_t);
 
@@ -791,90 +1700,63 @@ update_handler(gpointer user_data)
         data->weather_update->started = FALSE;
         data->weather_update->finished = FALSE;
         write_cache_file(data);
-    }
-
-    /* fetch astronomical data */
-    if (difftime(data->astro_update->next, now_t) <= 0) {
+        /* instances waiting for the data will find it in the cache */
+        release_download_lease(data);
+    }
+
+    /* calculate astronomical data of the days still missing */
+    if (!data->astro_download &&
+        difftime(data->astro_update->next, now_t) <= 0) {
+        find_missing_astro_days(data, now_t);
+        weather_debug("Calculating astronomical data of %u days.",
+                      data->msg_parse->astro_num_days);
+        data->astro_update->started = TRUE;
+        calc_astrodata(data->astrodata, data->msg_parse->astro_days,
+                       data->msg_parse->astro_num_days,
+                       string_to_double(data->lat, 0),
+                       string_to_double(data->lon, 0));
+        astro_update_finish(data);
+    }
+
+    /* keep away from endpoints whose breaker is open */
+    if (data->astro_download &&
+        difftime(data->astro_update->next, now_t) <= 0 &&
+        !weather_backoff_allow(&data->astro_update->backoff, now_t))
+        data->astro_update->next = data->astro_update->backoff.open_until;
+    if (difftime(data->weather_update->next, now_t) <= 0 &&
+        !weather_backoff_allow(&data->weather_update->backoff, now_t))
+        data->weather_update->next = data->weather_update->backoff.open_until;
+
+    /* fetch astronomical data, unless a download is still running */
+    if (data->astro_download && data->astro_fetch == NULL &&
+        difftime(data->astro_update->next, now_t) <= 0) {
         /* real next update time will be calculated when update is finished,
            this is to prevent spawning multiple updates in a row */
         data->astro_update->next = time_calc_hour(now_tm, 1);
-        data->msg_parse->http_msg_fail = FALSE;
-        /* forecast astronomical data one day in advance */
-        astro_forecast_days = data->forecast_days + 1;
-        weather_debug("Fetching astronomical data. State: %s.\n", (int)astro_dwnld_state ? "ASTRO_DWNLD_MOON" : "ASTRO_DWNLD_SUN");
-        switch (astro_dwnld_state) {
-        case ASTRO_DWNLD_SUN:
-            data->astro_update->started = TRUE;
-            data->astro_update->attempt++;
-            data->msg_parse->sun_msg_processed = 0;
-            data->msg_parse->sun_msg_parse_error = 0;
-            for (day = 0; day < astro_forecast_days; day++) {
-                day_t = day_at_midnight(now_t, day);
-                now_tm = *localtime(&day_t);
-                /* build url */
-                url = g_strdup_printf("https://aa062reffgwvo1efa.api.met.no/weatherapi"
-                                      "/sunrise/3.0/sun?lat=%s&lon=%s&"
-                                      "date=%04d-%02d-%02d&"
-                                      "offset=%s",
-                                      data->lat, data->lon,
-                                      now_tm.tm_year + 1900,
-                                      now_tm.tm_mon + 1,
-                                      now_tm.tm_mday,
-                                      data->offset
-                                     );
-                /* start receive thread */
-                weather_debug("getting sun data:%s", url);
-                weather_http_queue_request(data->session, url,
-                                           cb_astro_update_sun, data);
-                g_free(url);
-            }
-            break;
-
-        case ASTRO_DWNLD_MOON:
-            data->msg_parse->moon_msg_processed = 0;
-            data->msg_parse->moon_msg_parse_error = 0;
-            for (day = 0; day < astro_forecast_days; day++) {
-                day_t = day_at_midnight(now_t, day);
-                now_tm = *localtime(&day_t);
-                url = g_strdup_printf("https://aa062reffgwvo1efa.api.met.no/weatherapi"
-                                      "/sunrise/3.0/moon?lat=%s&lon=%s&"
-                                      "date=%04d-%02d-%02d&"
-                                      "offset=%s",
-                                      data->lat, data->lon,
-                                      now_tm.tm_year + 1900,
-                                      now_tm.tm_mon + 1,
-                                      now_tm.tm_mday,
-                                      data->offset
-                                      );
-                /* start receive thread */
-                weather_debug("getting moon data: %s", url);
-                weather_http_queue_request(data->session, url,
-                                           cb_astro_update_moon, data);
-                g_free(url);
-            }
-            break;
+        data->astro_update->started = TRUE;
+        /* only download what is not known yet, which is often
+           nothing at all */
+        if (find_missing_astro_days(data, now_t) == 0) {
+            weather_debug("All astronomical data is known already.");
+            astro_update_finish(data);
+        } else {
+            weather_debug("Fetching astronomical data of %u days.",
+                          data->msg_parse->astro_num_days);
+            start_astro_download(data);
         }
     }
 
-    /* fetch weather data */
     if (difftime(data->weather_update->next, now_t) <= 0) {
         /* real next update time will be calculated when update is finished,
            this is to prevent spawning multiple updates in a row */
         data->weather_update->next = time_calc_hour(now_tm, 1);
-        data->weather_update->started = TRUE;
 
-        /* build url */
-        url = g_strdup_printf("https://aa062reffgwvo1efa.api.met.no"
-                              "/weatherapi/locationforecast/%s/"
-                              "classic?lat=%s&lon=%s&altitude=%d",
-                              api_version,
-                              data->lat, data->lon, data->msl);
-
-        /* start receive thread */
-        weather_debug("getting %s", url);
-        weather_http_queue_request(data->session, url,
-                                   cb_weather_update, data);
-        g_free(url);
+        /* unless another plugin instance showing the same place has
+           just fetched the weather data or is doing it right now */
+        if (data->shared_downloads)
+            start_shared_check(data);
+        else
+            start_weather_download(data);
 
         /* cb_weather_update will deal with everything that follows this
          * block, so let's return instead of doing things twice */
@@ -1111,7 +1993,19 @@ xfceweather_read_config (XfcePanelPlugin *plugin,
     data->offset = xfceweather_xfconf_get_string (data, SETTING_OFFSET);
     data->geonames_username = xfceweather_xfconf_get_string (data, SETTING_GEONAMES);
     data->cache_file_max_age = xfceweather_xfconf_get_int (data, SETTING_CACHE_MAX_AGE, CACHE_FILE_MAX_AGE);
+    weather_cache_store_set_max_age(data->cache_store,
+                                    MAX(data->cache_file_max_age, 0));
+    data->cache_max_size = xfceweather_xfconf_get_int (data, SETTING_CACHE_MAX_SIZE, CACHE_MAX_SIZE);
+    constrain_to_limits(&data->cache_max_size, 0, G_MAXINT);
+    weather_cache_store_set_max_size(data->cache_store,
+                                     (guint64) data->cache_max_size * 1024);
+    data->cache_max_distance = xfceweather_xfconf_get_int (data, SETTING_CACHE_MAX_DISTANCE, CACHE_MAX_DISTANCE);
+    constrain_to_limits(&data->cache_max_distance, 0, 100000);
+    data->cache_max_msl_diff = xfceweather_xfconf_get_int (data, SETTING_CACHE_MAX_MSL_DIFF, CACHE_MAX_MSL_DIFF);
+    constrain_to_limits(&data->cache_max_msl_diff, 0, 10000);
     data->power_saving = xfceweather_xfconf_get_bool (data, SETTING_POWER_SAVING, TRUE);
+    data->astro_download = xfceweather_xfconf_get_bool (data, SETTING_ASTRO_DOWNLOAD, FALSE);
+    data->shared_downloads = xfceweather_xfconf_get_bool (data, SETTING_SHARED_DOWNLOADS, TRUE);
 
     /* Units */
     if (data->units)
@@ -1212,7 +2106,12 @@ xfceweather_write_config (XfcePanelPlugin *plugin,
     }
 
     xfceweather_xfconf_set_intbool (data, SETTING_CACHE_MAX_AGE, data->cache_file_max_age, FALSE);
+    xfceweather_xfconf_set_intbool (data, SETTING_CACHE_MAX_SIZE, data->cache_max_size, FALSE);
+    xfceweather_xfconf_set_intbool (data, SETTING_CACHE_MAX_DISTANCE, data->cache_max_distance, FALSE);
+    xfceweather_xfconf_set_intbool (data, SETTING_CACHE_MAX_MSL_DIFF, data->cache_max_msl_diff, FALSE);
     xfceweather_xfconf_set_intbool (data, SETTING_POWER_SAVING, data->power_saving, TRUE);
+    xfceweather_xfconf_set_intbool (data, SETTING_ASTRO_DOWNLOAD, data->astro_download, TRUE);
+    xfceweather_xfconf_set_intbool (data, SETTING_SHARED_DOWNLOADS, data->shared_downloads, TRUE);
 
     xfceweather_xfconf_set_intbool (data, SETTING_TEMPERATURE, data->units->temperature, FALSE);
     xfceweather_xfconf_set_intbool (data, SETTING_PRESSURE, data->units->pressure, FALSE);
@@ -1263,157 +2162,115 @@ xfceweather_write_config (XfcePanelPlugin *plugin,
 }
 
 
+/* generate the key of the cache files for the current location */
+static gchar *
+make_cache_key(plugin_data *data)
+{
+    if (G_UNLIKELY(data->lat == NULL || data->lon == NULL))
+        return NULL;
+
+    return weather_cache_store_make_key(string_to_double(data->lat, 0),
+                                        string_to_double(data->lon, 0));
+}
+
+
 /*
- * Generate file name for the weather data cache file.
+ * Generate the key used by older versions of the plugin, which is
+ * also the name of the old text cache file.
  */
 static gchar *
-make_cache_filename(plugin_data *data)
+make_old_cache_key(plugin_data *data)
 {
-    gchar *cache_dir, *file;
-
     if (G_UNLIKELY(data->lat == NULL || data->lon == NULL))
         return NULL;
 
-    cache_dir = get_cache_directory();
-    file = g_strdup_printf("%s%sweatherdata_%s_%s_%d",
-                           cache_dir, G_DIR_SEPARATOR_S,
+    return g_strdup_printf("weatherdata_%s_%s_%d",
                            data->lat, data->lon, data->msl);
-    g_free(cache_dir);
-    return file;
 }
 
 
 static void
 write_cache_file(plugin_data *data)
 {
-    GString *out;
-    xml_weather *wd = data->weatherdata;
-    xml_time *timeslice;
-    xml_location *loc;
-    xml_astro *astro;
-    gchar *file, *start, *end, *point, *now, *value;
-    gchar *date_format = "%Y-%m-%dT%H:%M:%SZ";
-    time_t now_t = time(NULL);
-    guint i, j;
+    weather_cache_info info;
+    gchar *key, *old_key;
 
-    file = make_cache_filename(data);
-    if (G_UNLIKELY(file == NULL))
+    key = make_cache_key(data);
+    if (G_UNLIKELY(key == NULL))
         return;
+    old_key = make_old_cache_key(data);
+
+    info.location_name = data->location_name;
+    info.lat = data->lat;
+    info.lon = data->lon;
+    info.offset = data->offset;
+    info.etag = data->weather_update ? data->weather_update->etag : NULL;
+    info.last_modified =
+        data->weather_update ? data->weather_update->last_modified : NULL;
+    info.msl = data->msl;
+    info.cache_date = time(NULL);
+    info.last_weather_download =
+        data->weather_update ? data->weather_update->last : 0;
+    info.last_astro_download =
+        data->astro_update ? data->astro_update->last : 0;
+    info.weather_expires =
+        data->weather_update ? data->weather_update->expires : 0;
+
+    weather_cache_write_async(data->cache_writer, key, old_key, &info,
+                              data->weatherdata, data->astrodata);
+    g_free(key);
+    g_free(old_key);
+}
 
-    out = g_string_sized_new(20480);
-    g_string_assign(out, "# xfce4-weather-plugin cache file\n\n[info]\n");
-    CACHE_APPEND("location_name=%s\n", data->location_name);
-    CACHE_APPEND("lat=%s\n", data->lat);
-    CACHE_APPEND("lon=%s\n", data->lon);
-    CACHE_APPEND("offset=%s\n", data->offset);
-    g_string_append_printf(out, "msl=%d\n", data->msl);
-    g_string_append_printf(out, "timeslices=%d\n", wd->timeslices->len);
-    if (G_LIKELY(data->weather_update)) {
-        value = format_date(data->weather_update->last, date_format, FALSE);
-        CACHE_APPEND("last_weather_download=%s\n", value);
-        g_free(value);
-    }
-    if (G_LIKELY(data->astro_update)) {
-        value = format_date(data->astro_update->last, date_format, FALSE);
-        CACHE_APPEND("last_astro_download=%s\n", value);
-        g_free(value);
-    }
-    now = format_date(now_t, date_format, FALSE);
-    CACHE_APPEND("cache_date=%s\n\n", now);
-    g_free(now);
-
-    if (data->astrodata) {
-        for (i = 0; i < data->astrodata->len; i++) {
-            astro = g_array_index(data->astrodata, xml_astro *, i);
-            if (G_UNLIKELY(astro == NULL))
-                continue;
-            value = format_date(astro->day, "%Y-%m-%d", TRUE);
-            start = format_date(astro->sunrise, date_format, TRUE);
-            end = format_date(astro->sunset, date_format, TRUE);
-            g_string_append_printf(out, "[astrodata%u]\n", i);
-            CACHE_APPEND("day=%s\n", value);
-            CACHE_APPEND("sunrise=%s\n", start);
-            CACHE_APPEND("sunset=%s\n", end);
-            CACHE_APPEND("sun_never_rises=%s\n",
-                         astro->sun_never_rises ? "true" : "false");
-            CACHE_APPEND("sun_never_sets=%s\n",
-                         astro->sun_never_sets ? "true" : "false");
-            CACHE_APPEND("solarnoon_elevation=%e\n", astro->solarnoon_elevation);
-            CACHE_APPEND("solarmidnight_elevation=%e\n", astro->solarmidnight_elevation);
-            g_free(value);
-            g_free(start);
-            g_free(end);
-
-            start = format_date(astro->moonrise, date_format, TRUE);
-            end = format_date(astro->moonset, date_format, TRUE);
-            CACHE_APPEND("moonrise=%s\n", start);
-            CACHE_APPEND("moonset=%s\n", end);
-            CACHE_APPEND("moon_never_rises=%s\n",
-                         astro->moon_never_rises ? "true" : "false");
-            CACHE_APPEND("moon_never_sets=%s\n",
-                         astro->moon_never_sets ? "true" : "false");
-            CACHE_APPEND("moon_phase=%s\n", astro->moon_phase);
-            g_free(start);
-            g_free(end);
-
-            g_string_append(out, "\n");
-        }
-    } else
-        g_string_append(out, "\n");
 
-    for (i = 0; i < wd->timeslices->len; i++) {
-        timeslice = g_array_index(wd->timeslices, xml_time *, i);
-        if (G_UNLIKELY(timeslice == NULL || timeslice->location == NULL))
-            continue;
-        loc = timeslice->location;
-        start = format_date(timeslice->start, date_format, FALSE);
-        end = format_date(timeslice->end, date_format, FALSE);
-        point = format_date(timeslice->point, date_format, FALSE);
-        g_string_append_printf(out, "[timeslice%u]\n", i);
-        CACHE_APPEND("start=%s\n", start);
-        CACHE_APPEND("end=%s\n", end);
-        CACHE_APPEND("point=%s\n", point);
-        CACHE_APPEND("altitude=%s\n", loc->altitude);
-        CACHE_APPEND("latitude=%s\n", loc->latitude);
-        CACHE_APPEND("longitude=%s\n", loc->longitude);
-        CACHE_APPEND("temperature_value=%s\n", loc->temperature_value);
-        CACHE_APPEND("temperature_unit=%s\n", loc->temperature_unit);
-        CACHE_APPEND("wind_dir_deg=%s\n", loc->wind_dir_deg);
-        CACHE_APPEND("wind_dir_name=%s\n", loc->wind_dir_name);
-        CACHE_APPEND("wind_speed_mps=%s\n", loc->wind_speed_mps);
-        CACHE_APPEND("wind_speed_beaufort=%s\n", loc->wind_speed_beaufort);
-        CACHE_APPEND("humidity_value=%s\n", loc->humidity_value);
-        CACHE_APPEND("humidity_unit=%s\n", loc->humidity_unit);
-        CACHE_APPEND("pressure_value=%s\n", loc->pressure_value);
-        CACHE_APPEND("pressure_unit=%s\n", loc->pressure_unit);
-        g_free(start);
-        g_free(end);
-        g_free(point);
-        for (j = 0; j < CLOUDS_PERC_NUM; j++)
-            if (loc->clouds_percent[j])
-                g_string_append_printf(out, "clouds_percent_%u=%s\n", j,
-                                       loc->clouds_percent[j]);
-        CACHE_APPEND("fog_percent=%s\n", loc->fog_percent);
-        CACHE_APPEND("precipitation_value=%s\n", loc->precipitation_value);
-        CACHE_APPEND("precipitation_unit=%s\n", loc->precipitation_unit);
-        if (loc->symbol)
-            g_string_append_printf(out, "symbol_id=%d\nsymbol=%s\n",
-                                   loc->symbol_id, loc->symbol);
-        g_string_append(out, "\n");
-    }
-
-    if (!g_file_set_contents(file, out->str, -1, NULL))
-        g_warning("Error writing cache file %s!", file);
+/*
+ * Restore the update times saved in the cache file, so that the cached
+ * data is only downloaded again once it has expired. Without a known
+ * expiry time, the weather data is downloaded right away.
+ */
+void
+restore_cached_update_times(update_info *weather_update,
+                            update_info *astro_update,
+                            time_t last_weather_t,
+                            time_t weather_expires_t,
+                            time_t last_astro_t,
+                            time_t now_t)
+{
+    weather_update->last = last_weather_t;
+    weather_update->expires = weather_expires_t;
+    if (difftime(weather_expires_t, now_t) > 0)
+        weather_update->next =
+            calc_next_download_time(weather_update, last_weather_t);
     else
-        weather_debug("Cache file %s has been written.", file);
+        weather_update->next = now_t;
 
-    g_string_free(out, TRUE);
-    g_free(file);
+    astro_update->last = last_astro_t;
+    astro_update->next = calc_next_download_time(astro_update, last_astro_t);
 }
 
 
 static void
-read_cache_file(plugin_data *data)
+check_cached_astrodata(plugin_data *data)
+{
+    /* downloads the astrodata of the day if necessary */
+    if (G_LIKELY(get_astro_data_for_day(data->astrodata, data->forecast_days)))
+        weather_debug("Reusing cached astrodata instead of downloading it.");
+    else {
+        weather_debug("Astrodata of the day not in cache. Downloading scheduled in 30s.");
+        data->astro_update->attempt = 0;
+        data->astro_update->next = time(NULL) + 30;
+        schedule_next_wakeup(data);
+    }
+}
+
+
+/*
+ * Import the text cache file written by older versions of the
+ * plugin. It is replaced by a binary cache file on the next write.
+ * Returns whether the data of the location has been imported.
+ */
+static gboolean
+import_text_cache_file(cache_load *load)
 {
     GKeyFile *keyfile;
     GError *err = NULL;
@@ -1421,29 +2278,20 @@ read_cache_file(plugin_data *data)
     xml_time *timeslice = NULL;
     xml_location *loc = NULL;
     xml_astro *astro = NULL;
-    time_t cache_date_t;
+    time_t cache_date_t, last_weather_t, last_astro_t;
     gchar *file, *locname = NULL, *lat = NULL, *lon = NULL, *group = NULL, *offset = NULL;
     gchar *timestring;
     gint msl, num_timeslices = 0, i, j;
 
-    g_assert(data != NULL);
-    if (G_UNLIKELY(data == NULL))
-        return;
-    wd = data->weatherdata;
-
-    if (G_UNLIKELY(data->lat == NULL || data->lon == NULL))
-        return;
-
-    file = make_cache_filename(data);
-    if (G_UNLIKELY(file == NULL))
-        return;
+    wd = load->weatherdata;
+    file = weather_cache_store_get_filename(load->store, load->old_key, "");
 
     keyfile = g_key_file_new();
     if (!g_key_file_load_from_file(keyfile, file, G_KEY_FILE_NONE, NULL)) {
         weather_debug("Could not read cache file %s.", file);
         g_key_file_free(keyfile);
         g_free(file);
-        return;
+        return FALSE;
     }
     weather_debug("Reading cache file %s.", file);
     g_free(file);
@@ -1451,7 +2299,7 @@ read_cache_file(plugin_data *data)
     group = "info";
     if (!g_key_file_has_group(keyfile, group)) {
         CACHE_FREE_VARS();
-        return;
+        return FALSE;
     }
 
     /* check all needed values are present and match the current parameters */
@@ -1463,46 +2311,40 @@ read_cache_file(plugin_data *data)
         CACHE_FREE_VARS();
         weather_debug("Required values are missing in the cache file, "
                       "reading cache file aborted.");
-        return;
+        return FALSE;
     }
     msl = g_key_file_get_integer(keyfile, group, "msl", &err);
     if (!err)
         num_timeslices = g_key_file_get_integer(keyfile, group,
                                                 "timeslices", &err);
-    if (err || strcmp(lat, data->lat) != 0 || strcmp(lon, data->lon) != 0 ||
-        strcmp(offset, data->offset) != 0 || msl != data->msl ||
+    if (err || strcmp(lat, load->lat) != 0 || strcmp(lon, load->lon) != 0 ||
+        strcmp(offset, load->offset) != 0 || msl != load->msl ||
         num_timeslices < 1) {
         CACHE_FREE_VARS();
         weather_debug("The required values are not present in the cache file "
                       "or do not match the current plugin data. Reading "
                       "cache file aborted.");
-        return;
+        return FALSE;
     }
     /* read cache creation date and check if cache file is not too old */
     CACHE_READ_STRING(timestring, "cache_date");
     cache_date_t = parse_timestring(timestring, NULL, FALSE);
     g_free(timestring);
-    if (difftime(time(NULL), cache_date_t) > data->cache_file_max_age) {
+    if (difftime(time(NULL), cache_date_t) > load->max_age) {
         weather_debug("Cache file is too old and will not be used.");
         CACHE_FREE_VARS();
-        return;
-    }
-    if (G_LIKELY(data->weather_update)) {
-        CACHE_READ_STRING(timestring, "last_weather_download");
-        data->weather_update->last = parse_timestring(timestring, NULL, FALSE);
-        data->weather_update->next =
-            calc_next_download_time(data->weather_update,
-                                    data->weather_update->last);
-        g_free(timestring);
-    }
-    if (G_LIKELY(data->astro_update)) {
-        CACHE_READ_STRING(timestring, "last_astro_download");
-        data->astro_update->last = parse_timestring(timestring, NULL, FALSE);
-        data->astro_update->next =
-            calc_next_download_time(data->astro_update,
-                                    data->astro_update->last);
-        g_free(timestring);
+        return FALSE;
     }
+    CACHE_READ_STRING(timestring, "last_weather_download");
+    last_weather_t = parse_timestring(timestring, NULL, FALSE);
+    g_free(timestring);
+    CACHE_READ_STRING(timestring, "last_astro_download");
+    last_astro_t = parse_timestring(timestring, NULL, FALSE);
+    g_free(timestring);
+    /* the text cache file has no expiry time */
+    load->last_weather_download = last_weather_t;
+    load->weather_expires = 0;
+    load->last_astro_download = last_astro_t;
 
     /* read cached astrodata if available and up-to-date */
     i = 0;
@@ -1515,8 +2357,8 @@ read_cache_file(plugin_data *data)
 
         CACHE_READ_STRING(timestring, "day");
         astro->day = parse_timestring(timestring, "%Y-%m-%d", TRUE);
-        weather_debug("cached astrodata for day=%s\n",
-                      format_date(astro->day, NULL, TRUE));
+        weather_debug_date("cached astrodata for day=%s\n",
+                           astro->day, NULL, TRUE);
         g_free(timestring);
         CACHE_READ_STRING(timestring, "sunrise");
         astro->sunrise = parse_timestring(timestring, NULL, TRUE);
@@ -1545,22 +2387,12 @@ read_cache_file(plugin_data *data)
         astro->moon_never_sets =
             g_key_file_get_boolean(keyfile, group, "moon_never_sets", NULL);
 
-        merge_astro(data->astrodata, astro);
+        merge_astro(load->astrodata, astro);
         xml_astro_free(astro);
 
         g_free(group);
         group = g_strdup_printf("astrodata%d", ++i);
     }
-
-    /* downloads the astrodata of the day if necessary */
-    if (G_LIKELY(get_astro_data_for_day(data->astrodata, data->forecast_days)))
-        weather_debug("Reusing cached astrodata instead of downloading it.");
-    else {
-        weather_debug("Astrodata of the day not in cache. Downloading scheduled in 30s.");
-        data->astro_update->attempt = 0;
-        data->astro_update->next += 30;
-        schedule_next_wakeup(data);
-    }
     g_clear_pointer(&group, g_free);
 
     /* parse available timeslices */
@@ -1591,42 +2423,435 @@ read_cache_file(plugin_data *data)
 
         /* parse location data */
         loc = timeslice->location;
-        CACHE_READ_STRING(loc->altitude, "altitude");
-        CACHE_READ_STRING(loc->latitude, "latitude");
-        CACHE_READ_STRING(loc->longitude, "longitude");
-        CACHE_READ_STRING(loc->temperature_value, "temperature_value");
-        CACHE_READ_STRING(loc->temperature_unit, "temperature_unit");
-        CACHE_READ_STRING(loc->wind_dir_name, "wind_dir_name");
-        CACHE_READ_STRING(loc->wind_dir_deg, "wind_dir_deg");
-        CACHE_READ_STRING(loc->wind_speed_mps, "wind_speed_mps");
-        CACHE_READ_STRING(loc->wind_speed_beaufort, "wind_speed_beaufort");
-        CACHE_READ_STRING(loc->humidity_value, "humidity_value");
-        CACHE_READ_STRING(loc->humidity_unit, "humidity_unit");
-        CACHE_READ_STRING(loc->pressure_value, "pressure_value");
-        CACHE_READ_STRING(loc->pressure_unit, "pressure_unit");
+        CACHE_READ_VALUE(loc->altitude, "altitude");
+        CACHE_READ_VALUE(loc->latitude, "latitude");
+        CACHE_READ_VALUE(loc->longitude, "longitude");
+        CACHE_READ_VALUE(loc->temperature, "temperature_value");
+        CACHE_READ_VALUE(loc->wind_dir_deg, "wind_dir_deg");
+        CACHE_READ_VALUE(loc->wind_speed_mps, "wind_speed_mps");
+        CACHE_READ_VALUE(loc->wind_speed_beaufort, "wind_speed_beaufort");
+        CACHE_READ_VALUE(loc->humidity, "humidity_value");
+        CACHE_READ_VALUE(loc->pressure, "pressure_value");
 
         for (j = 0; j < CLOUDS_PERC_NUM; j++) {
             gchar *key = g_strdup_printf("clouds_percent_%d", j);
-            if (g_key_file_has_key(keyfile, group, key, NULL))
-                loc->clouds_percent[j] =
-                    g_key_file_get_string(keyfile, group, key, NULL);
+            CACHE_READ_VALUE(loc->clouds_percent[j], key);
             g_free(key);
         }
 
-        CACHE_READ_STRING(loc->fog_percent, "fog_percent");
-        CACHE_READ_STRING(loc->precipitation_value, "precipitation_value");
-        CACHE_READ_STRING(loc->precipitation_unit, "precipitation_unit");
-        CACHE_READ_STRING(loc->symbol, "symbol");
-        if (loc->symbol &&
-            g_key_file_has_key(keyfile, group, "symbol_id", NULL))
+        CACHE_READ_VALUE(loc->fog_percent, "fog_percent");
+        CACHE_READ_VALUE(loc->precipitation, "precipitation_value");
+        if (g_key_file_has_key(keyfile, group, "symbol", NULL) &&
+            g_key_file_has_key(keyfile, group, "symbol_id", NULL)) {
             loc->symbol_id =
                 g_key_file_get_integer(keyfile, group, "symbol_id", NULL);
+            loc->symbol = get_symbol_for_id(loc->symbol_id);
+        }
 
         merge_timeslice(wd, timeslice);
         xml_time_free(timeslice);
     }
+    load->location_name = g_strdup(locname);
+    load->exact = TRUE;
     CACHE_FREE_VARS();
-    weather_debug("Reading cache file complete.");
+    weather_debug("Importing text cache file complete.");
+    return TRUE;
+}
+
+
+/*
+ * Check whether cached data can be used for the current location. Data
+ * of a place within the configured distance and altitude difference is
+ * good enough to be shown until new data has been downloaded.
+ */
+static gboolean
+cache_info_matches(const cache_load *load,
+                   const weather_cache_info *info,
+                   gboolean *exact)
+{
+    gdouble distance;
+
+    if (info->location_name == NULL || info->lat == NULL ||
+        info->lon == NULL || info->offset == NULL ||
+        g_strcmp0(info->offset, load->offset) != 0)
+        return FALSE;
+
+    distance = calc_distance(string_to_double(info->lat, 0),
+                             string_to_double(info->lon, 0),
+                             string_to_double(load->lat, 0),
+                             string_to_double(load->lon, 0));
+    if (distance > load->max_distance ||
+        ABS(info->msl - load->msl) > load->max_msl_diff) {
+        weather_debug("Cached data for %s is %.0f m away with an altitude "
+                      "difference of %d m, not using it.",
+                      info->location_name, distance,
+                      ABS(info->msl - load->msl));
+        return FALSE;
+    }
+
+    *exact = (strcmp(info->lat, load->lat) == 0 &&
+              strcmp(info->lon, load->lon) == 0 &&
+              info->msl == load->msl);
+    return TRUE;
+}
+
+
+static void
+cache_load_free(cache_load *load)
+{
+    weather_cache_store_unref(load->store);
+    g_object_unref(load->cancellable);
+    g_free(load->key);
+    g_free(load->old_key);
+    g_free(load->lat);
+    g_free(load->lon);
+    g_free(load->offset);
+    astrodata_free(load->astrodata);
+    xml_weather_unref(load->weatherdata);
+    g_free(load->location_name);
+    g_free(load->etag);
+    g_free(load->last_modified);
+    g_slice_free(cache_load, load);
+}
+
+
+/*
+ * Load the cached data of the location, or of a place nearby, falling
+ * back to the text cache file of older versions.
+ */
+static void
+cache_load_thread(GTask *task,
+                  gpointer source_object,
+                  gpointer task_data,
+                  GCancellable *cancellable)
+{
+    cache_load *load = task_data;
+    weather_cache *cache = NULL;
+    const weather_cache_info *info = NULL;
+    gchar **keys, *file;
+    gboolean found = FALSE;
+    guint i;
+
+    /* astrodata is kept regardless of the age of the cache file */
+    file = weather_cache_store_get_filename(load->store, load->key,
+                                            WEATHER_CACHE_ASTRO_SUFFIX);
+    weather_cache_load_astro_store(file, load->astrodata);
+    g_free(file);
+
+    /* look for the location in its own cell and the ones within the
+       configured distance, then for a cache file written by an older
+       version */
+    keys = weather_cache_store_get_nearby_keys(string_to_double(load->lat, 0),
+                                               string_to_double(load->lon, 0),
+                                               load->max_distance);
+    i = g_strv_length(keys);
+    keys = g_renew(gchar *, keys, i + 2);
+    keys[i] = g_strdup(load->old_key);
+    keys[i + 1] = NULL;
+
+    for (i = 0; keys[i] != NULL; i++) {
+        file = weather_cache_store_get_filename(load->store, keys[i],
+                                                WEATHER_CACHE_FILE_SUFFIX);
+        cache = weather_cache_open(file);
+        g_free(file);
+        if (cache == NULL)
+            continue;
+        found = TRUE;
+
+        /* check all needed values are present and match the current
+           parameters, and that the cache file is not too old */
+        info = weather_cache_get_info(cache);
+        if (!cache_info_matches(load, info, &load->exact) ||
+            weather_cache_get_num_timeslices(cache) < 1)
+            weather_debug("The cache file does not match the current plugin "
+                          "data.");
+        else if (difftime(time(NULL), info->cache_date) > load->max_age)
+            weather_debug("Cache file is too old and will not be used.");
+        else if (weather_cache_check_records(cache))
+            break;
+        weather_cache_close(cache);
+        cache = NULL;
+    }
+
+    if (cache == NULL) {
+        g_strfreev(keys);
+        weather_cache_store_miss(load->store);
+        load->exact = FALSE;
+        load->loaded = !found && import_text_cache_file(load);
+        /* the series are built before the data is published */
+        if (load->loaded)
+            xml_weather_update_series(load->weatherdata);
+        g_task_return_boolean(task, TRUE);
+        return;
+    }
+    weather_cache_store_hit(load->store, keys[i]);
+    g_strfreev(keys);
+
+    load->location_name = g_strdup(info->location_name);
+    load->etag = g_strdup(info->etag);
+    load->last_modified = g_strdup(info->last_modified);
+    load->last_weather_download = info->last_weather_download;
+    load->weather_expires = info->weather_expires;
+    load->last_astro_download = info->last_astro_download;
+    weather_cache_load_astrodata(cache, load->astrodata);
+    weather_cache_load_weatherdata(cache, load->weatherdata);
+    xml_weather_update_series(load->weatherdata);
+    load->loaded = TRUE;
+    weather_cache_close(cache);
+    g_task_return_boolean(task, TRUE);
+}
+
+
+/*
+ * Publish the cached data and schedule the downloads. If the request
+ * generation has been cancelled meanwhile, the plugin data may be gone
+ * already, and the data is dropped.
+ */
+static void
+cb_cache_loaded(GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    plugin_data *data = user_data;
+    cache_load *load = g_task_get_task_data(G_TASK(result));
+    time_t now_t;
+    guint i;
+
+    if (g_cancellable_is_cancelled(load->cancellable))
+        return;
+    data->cache_loading = FALSE;
+
+    for (i = 0; i < load->astrodata->len; i++)
+        merge_astro(data->astrodata,
+                    g_array_index(load->astrodata, xml_astro *, i));
+
+    /* use data of a nearby place only until new data has been
+       downloaded, which happens right away as the update times are
+       not restored */
+    if (load->loaded && load->exact) {
+        restore_cached_update_times(data->weather_update,
+                                    data->astro_update,
+                                    load->last_weather_download,
+                                    load->weather_expires,
+                                    load->last_astro_download,
+                                    time(NULL));
+        /* the next download only needs to be done if the data changed */
+        update_info_set_validators(data->weather_update,
+                                   g_steal_pointer(&load->etag),
+                                   g_steal_pointer(&load->last_modified));
+        check_cached_astrodata(data);
+    } else {
+        if (load->loaded)
+            weather_debug("Using cached data of %s until new data has "
+                          "been downloaded.", load->location_name);
+        time(&now_t);
+        data->weather_update->next = now_t;
+        data->astro_update->next = now_t;
+    }
+
+    if (load->loaded) {
+        if (data->weatherdata)
+            xml_weather_unref(data->weatherdata);
+        data->weatherdata = g_steal_pointer(&load->weatherdata);
+        data->data_generation++;
+        weather_debug("Reading cache file complete.");
+    }
+    update_current_conditions(data, TRUE);
+}
+
+
+/*
+ * Look up and load the cached data on a worker thread, as this opens
+ * and checks several files. No downloads are started until the data
+ * has been published, as the update times depend on it.
+ */
+static void
+read_cache_file(plugin_data *data)
+{
+    cache_load *load;
+    GTask *task;
+
+    g_assert(data != NULL);
+    if (G_UNLIKELY(data == NULL))
+        return;
+
+    if (G_UNLIKELY(data->lat == NULL || data->lon == NULL))
+        return;
+
+    load = g_slice_new0(cache_load);
+    load->store = weather_cache_store_ref(data->cache_store);
+    load->cancellable = g_object_ref(data->cancellable);
+    load->key = make_cache_key(data);
+    load->old_key = make_old_cache_key(data);
+    load->lat = g_strdup(data->lat);
+    load->lon = g_strdup(data->lon);
+    load->offset = g_strdup(data->offset);
+    load->msl = data->msl;
+    load->max_age = data->cache_file_max_age;
+    load->max_distance = data->cache_max_distance;
+    load->max_msl_diff = data->cache_max_msl_diff;
+    load->astrodata = g_array_sized_new(FALSE, TRUE, sizeof(xml_astro *), 30);
+    load->weatherdata = make_weather_data();
+    data->cache_loading = TRUE;
+
+    task = g_task_new(NULL, NULL, cb_cache_loaded, data);
+    g_task_set_task_data(task, load, (GDestroyNotify) cache_load_free);
+    g_task_run_in_thread(task, cache_load_thread);
+    g_object_unref(task);
+}
+
+
+static void
+shared_check_free(shared_check *check)
+{
+    weather_cache_store_unref(check->store);
+    g_object_unref(check->cancellable);
+    g_free(check->key);
+    g_free(check->lat);
+    g_free(check->lon);
+    g_free(check->offset);
+    xml_weather_unref(check->shared);
+    g_free(check->location_name);
+    g_free(check->etag);
+    g_free(check->last_modified);
+    g_slice_free(shared_check, check);
+}
+
+
+/*
+ * Look for weather data that another plugin instance showing the same
+ * place has downloaded and written to the cache, if it is newer than
+ * ours and has not expired yet. Otherwise take the lease on
+ * downloading the data, so that other instances wait for the cache
+ * file instead.
+ */
+static void
+shared_check_thread(GTask *task,
+                    gpointer source_object,
+                    gpointer task_data,
+                    GCancellable *cancellable)
+{
+    shared_check *check = task_data;
+    weather_cache *cache;
+    weather_cache_info want;
+    const weather_cache_info *info;
+
+    memset(&want, 0, sizeof(want));
+    want.lat = check->lat;
+    want.lon = check->lon;
+    want.offset = check->offset;
+    want.msl = check->msl;
+    want.last_weather_download = check->last;
+    cache = weather_cache_open_shared(check->store, check->key, &want,
+                                      time(NULL));
+    if (cache) {
+        info = weather_cache_get_info(cache);
+        check->shared = make_weather_data();
+        weather_cache_load_weatherdata(cache, check->shared);
+        check->location_name = g_strdup(info->location_name);
+        check->etag = g_strdup(info->etag);
+        check->last_modified = g_strdup(info->last_modified);
+        check->downloaded = info->last_weather_download;
+        check->expires = info->weather_expires;
+        weather_cache_close(cache);
+    }
+
+    if (check->shared == NULL && !check->leased)
+        check->leased =
+            weather_cache_store_take_lease(check->store, check->key,
+                                           SHARED_DOWNLOAD_LEASE);
+    g_task_return_boolean(task, TRUE);
+}
+
+
+/*
+ * Use the shared data like a download, download the data if the lease
+ * has been taken, or check again later. If the request generation has
+ * been cancelled meanwhile, the plugin data may be gone already, so
+ * only a lease that has just been taken is released.
+ */
+static void
+cb_shared_checked(GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    plugin_data *data = user_data;
+    shared_check *check = g_task_get_task_data(G_TASK(result));
+    weather_merge *merge;
+
+    if (g_cancellable_is_cancelled(check->cancellable)) {
+        if (check->leased && !check->had_lease)
+            weather_cache_store_release_lease(check->store, check->key);
+        return;
+    }
+
+    if (check->shared) {
+        weather_debug("Using the weather data of %s downloaded by another "
+                      "plugin instance.", check->location_name);
+        data->weather_update->started = TRUE;
+        data->weather_update->expires = check->expires;
+        update_info_set_validators(data->weather_update,
+                                   g_steal_pointer(&check->etag),
+                                   g_steal_pointer(&check->last_modified));
+        merge = g_slice_new0(weather_merge);
+        merge->base = g_steal_pointer(&check->shared);
+        merge->downloaded = check->downloaded;
+        start_weather_merge(data, merge);
+    } else if (!check->leased) {
+        weather_debug("Another instance is downloading the weather "
+                      "data, checking again in %d seconds.",
+                      SHARED_DOWNLOAD_WAIT);
+        data->weather_update->next = time(NULL) + SHARED_DOWNLOAD_WAIT;
+        schedule_next_wakeup(data);
+    } else {
+        /* a lease still held from before may be close to its end */
+        if (data->download_lease == NULL)
+            data->download_lease = g_steal_pointer(&check->key);
+        else
+            weather_cache_store_refresh_lease(data->cache_store,
+                                              data->download_lease);
+        if (data->lease_timer == 0)
+            data->lease_timer =
+                g_timeout_add_seconds(SHARED_DOWNLOAD_LEASE_REFRESH,
+                                      cb_refresh_download_lease, data);
+        start_weather_download(data);
+    }
+}
+
+
+/*
+ * Check for weather data of other plugin instances on a worker thread,
+ * as this opens the cache file and the lease, and download it if
+ * there is none.
+ */
+static void
+start_shared_check(plugin_data *data)
+{
+    shared_check *check;
+    GTask *task;
+    gchar *key;
+
+    key = make_cache_key(data);
+    if (G_UNLIKELY(key == NULL)) {
+        start_weather_download(data);
+        return;
+    }
+
+    check = g_slice_new0(shared_check);
+    check->store = weather_cache_store_ref(data->cache_store);
+    check->cancellable = g_object_ref(data->cancellable);
+    check->key = key;
+    check->lat = g_strdup(data->lat);
+    check->lon = g_strdup(data->lon);
+    check->offset = g_strdup(data->offset);
+    check->msl = data->msl;
+    check->last = data->weather_update->last;
+    check->had_lease = check->leased = (data->download_lease != NULL);
+
+    task = g_task_new(NULL, NULL, cb_shared_checked, data);
+    g_task_set_task_data(task, check, (GDestroyNotify) shared_check_free);
+    g_task_run_in_thread(task, shared_check_thread);
+    g_object_unref(task);
 }
 
 
@@ -1655,13 +2880,18 @@ update_weatherdata_with_reset(plugin_data *data)
     /* set the offset of timezone */
     update_offset(data);
 
+    /* drop downloads for the old data */
+    weather_cancel_requests(data);
+
     /* clear update times */
     init_update_infos(data);
 
     /* clear existing weather data */
     if (data->weatherdata) {
-        xml_weather_free(data->weatherdata);
+        xml_weather_unref(data->weatherdata);
         data->weatherdata = make_weather_data();
+        xml_weather_update_series(data->weatherdata);
+        data->data_generation++;
     }
 
     /* clear existing astronomical data */
@@ -1674,14 +2904,16 @@ update_weatherdata_with_reset(plugin_data *data)
     update_icon(data);
     update_scrollbox(data, TRUE);
 
-    /* make use of previously saved data */
-    read_cache_file(data);
-
-    /* schedule downloads immediately */
-    time(&now_t);
-    data->weather_update->next = now_t;
-    data->astro_update->next = now_t;
-    schedule_next_wakeup(data);
+    /* make use of previously saved data, downloads are scheduled once
+       it has been loaded */
+    if (data->lat && data->lon)
+        read_cache_file(data);
+    else {
+        time(&now_t);
+        data->weather_update->next = now_t;
+        data->astro_update->next = now_t;
+        schedule_next_wakeup(data);
+    }
 
     weather_debug("Updated weatherdata with reset.");
 }
@@ -1872,7 +3104,13 @@ xfceweather_dialog_response(GtkWidget *dlg,
     }
     g_array_free(dialog->icon_themes, FALSE);
     if (dialog->timer_id != 0) {
+        /* the pending update replaces the cancelled downloads */
         g_source_remove(dialog->timer_id);
+        update_weatherdata_with_reset(data);
+    }
+    if (dialog->lookup_cancellable) {
+        g_cancellable_cancel(dialog->lookup_cancellable);
+        g_object_unref(dialog->lookup_cancellable);
     }
     g_slice_free(xfceweather_dialog, dialog);
 
@@ -2128,6 +3366,7 @@ xfceweather_create_control(XfcePanelPlugin *plugin)
     cairo_surface_t *icon = NULL;
     data_types lbl;
     gint scale_factor;
+    gchar *cache_dir;
 
     /* Initialize with sane default values */
     data->plugin = plugin;
@@ -2138,8 +3377,19 @@ xfceweather_create_control(XfcePanelPlugin *plugin)
 #endif
     data->units = g_slice_new0(units_config);
     data->weatherdata = make_weather_data();
+    xml_weather_update_series(data->weatherdata);
+    data->forecast = make_forecast_grid();
+    cache_dir = get_cache_directory();
+    data->cache_store = weather_cache_store_new(cache_dir,
+                                                CACHE_MAX_SIZE * 1024);
+    g_free(cache_dir);
+    data->cache_writer = weather_cache_writer_new(data->cache_store);
     data->astrodata = g_array_sized_new(FALSE, TRUE, sizeof(xml_astro *), 30);
     data->cache_file_max_age = CACHE_FILE_MAX_AGE;
+    weather_cache_store_set_max_age(data->cache_store, CACHE_FILE_MAX_AGE);
+    data->cache_max_size = CACHE_MAX_SIZE;
+    data->cache_max_distance = CACHE_MAX_DISTANCE;
+    data->cache_max_msl_diff = CACHE_MAX_MSL_DIFF;
     data->show_scrollbox = TRUE;
     data->scrollbox_lines = 1;
     data->scrollbox_animate = TRUE;
@@ -2161,6 +3411,7 @@ xfceweather_create_control(XfcePanelPlugin *plugin)
 
     /* Setup session for HTTP connections */
     data->session = soup_session_new();
+    data->cancellable = g_cancellable_new();
 #if SOUP_CHECK_VERSION(3, 0, 0)
     soup_session_set_user_agent(data->session,
                                 PACKAGE_NAME "-" VERSION_FULL);
@@ -2299,14 +3550,23 @@ xfceweather_free(XfcePanelPlugin *plugin,
     g_clear_object(&data->upower);
 #endif
 
-    if (data->weatherdata)
-        xml_weather_free(data->weatherdata);
+    cancel_astro_download(data);
+    release_download_lease(data);
+    g_cancellable_cancel(data->cancellable);
+    g_object_unref(data->cancellable);
+
+    xml_weather_unref(data->weatherdata);
+
+    if (data->forecast)
+        forecast_grid_free(data->forecast);
+
+    /* finish writing the cache file before the data goes away */
+    weather_cache_writer_free(data->cache_writer);
+    weather_cache_store_unref(data->cache_store);
 
     if (data->units)
         g_slice_free(units_config, data->units);
 
-    xmlCleanupParser();
-
     /* free chars */
     g_free(data->lat);
     g_free(data->lon);
@@ -2318,9 +3578,9 @@ xfceweather_free(XfcePanelPlugin *plugin,
     g_free(data->geonames_username);
 
     /* free update infos */
-    g_slice_free(update_info, data->weather_update);
-    g_slice_free(update_info, data->astro_update);
-    g_slice_free(update_info, data->conditions_update);
+    update_info_free(data->weather_update);
+    update_info_free(data->astro_update);
+    update_info_free(data->conditions_update);
 
     /* free current data */
     data->current_astro = NULL;
@@ -27,6 +27,10 @@
 #include <upower.h>
 #endif
 #include "weather-icon.h"
+#include "weather-backoff.h"
+#include "weather-cache.h"
+#include "weather-fetch.h"
+#include "weather-scheduler.h"
 
 #define PLUGIN_WEBSITE "https://docs.xfce.org/panel-plugins/xfce4-weather-plugin"
 #define MAX_FORECAST_DAYS 10
@@ -34,6 +38,15 @@
 #define MAX_SCROLLBOX_LINES 10
 #define FORECAST_API "2.0"
 
+#define EXPIRES_MIN_INTERVAL (10 * 60)  /* bounds for server expiry times */
+#define EXPIRES_MAX_INTERVAL (6 * 3600)
+#define EXPIRES_MAX_JITTER (3 * 60)
+
+/* wait for the weather data another plugin instance is downloading */
+#define SHARED_DOWNLOAD_WAIT (15)       /* seconds between checks */
+#define SHARED_DOWNLOAD_LEASE (120)     /* seconds until abandoned */
+#define SHARED_DOWNLOAD_LEASE_REFRESH (SHARED_DOWNLOAD_LEASE / 4)
+
 #define SETTING_LOCATION_NAME "/location/name"
 #define SETTING_LATITUDE      "/location/latitude"
 #define SETTING_LONGITUDE     "/location/longitude"
@@ -42,7 +55,12 @@
 #define SETTING_OFFSET        "/offset"
 #define SETTING_GEONAMES      "/geonames-username"
 #define SETTING_CACHE_MAX_AGE "/cache-max-age"
+#define SETTING_CACHE_MAX_SIZE "/cache-max-size"
+#define SETTING_CACHE_MAX_DISTANCE "/cache-max-distance"
+#define SETTING_CACHE_MAX_MSL_DIFF "/cache-max-msl-difference"
 #define SETTING_POWER_SAVING  "/power-saving"
+#define SETTING_ASTRO_DOWNLOAD "/astro-download"
+#define SETTING_SHARED_DOWNLOADS "/shared-downloads"
 #define SETTING_TEMPERATURE   "/units/temperature"
 #define SETTING_PRESSURE      "/units/pressure"
 #define SETTING_WINDSPEED     "/units/windspeed"
@@ -91,20 +109,24 @@ typedef struct {
     gboolean started;
     gboolean finished;
     guint http_status_code;
+    gchar *etag;                /* validators of the last response */
+    gchar *last_modified;
+    time_t expires;             /* when new data is expected, with jitter */
+    weather_backoff backoff;    /* retry policy of the endpoint */
 } update_info;
 
+/* what a response to a conditional request means for the update */
 typedef enum {
-    ASTRO_DWNLD_SUN = 0,
-    ASTRO_DWNLD_MOON
-} dwnld_state;
+    WEATHER_RESPONSE_FAILED,
+    WEATHER_RESPONSE_NOT_MODIFIED,
+    WEATHER_RESPONSE_NEW_DATA
+} weather_response;
 
 typedef struct {
-    guint sun_msg_processed;
-    guint moon_msg_processed;
-    guint sun_msg_parse_error;
-    guint moon_msg_parse_error;
-    dwnld_state astro_dwnld_state;
-    gboolean http_msg_fail;
+    time_t astro_days[MAX_FORECAST_DAYS + 1]; /* days being downloaded */
+    guint astro_num_days;
+    guint astro_done[MAX_FORECAST_DAYS + 1];  /* parts that arrived */
+    GArray *astrodata;                        /* downloaded so far */
 } parse_info;
 
 typedef struct {
@@ -119,6 +141,8 @@ typedef struct {
     gboolean upower_lid_closed;
 #endif
     gboolean power_saving;
+    gboolean astro_download;
+    gboolean shared_downloads;
     SoupSession *session;
     gchar *geonames_username;
 
@@ -139,6 +163,11 @@ typedef struct {
     XfcePanelPluginMode panel_orientation;
     gboolean single_row;
     xml_weather *weatherdata;
+    guint data_generation;
+    time_t data_day;
+    forecast_grid *forecast;
+    weather_cache_store *cache_store;
+    weather_cache_writer *cache_writer;
     GArray *astrodata;
     xml_astro *current_astro;
 
@@ -146,6 +175,12 @@ typedef struct {
     update_info *weather_update;
     update_info *conditions_update;
     parse_info *msg_parse;
+    weather_fetch *astro_fetch;
+    GCancellable *cancellable;      /* of the current request generation */
+    guint request_generation;
+    gchar *download_lease;          /* cache key, while downloading */
+    guint lease_timer;              /* refreshes the download lease */
+    gboolean cache_loading;         /* cached data is being loaded */
     time_t next_wakeup;
     gchar *next_wakeup_reason;
     guint update_timer;
@@ -168,6 +203,9 @@ typedef struct {
     gchar *offset;
     gchar *timezone_initial;
     gint cache_file_max_age;
+    gint cache_max_size;
+    gint cache_max_distance;
+    gint cache_max_msl_diff;
     gboolean night_time;
 
     units_config *units;
@@ -184,6 +222,8 @@ extern gboolean debug_mode;
 
 void weather_http_queue_request(SoupSession *session,
                                 const gchar *uri,
+                                weather_schedule_priority priority,
+                                GCancellable *cancellable,
 #if SOUP_CHECK_VERSION(3, 0, 0)
                                 GAsyncReadyCallback callback_func,
 #else
@@ -191,6 +231,48 @@ void weather_http_queue_request(SoupSession *session,
 #endif
                                 gpointer user_data);
 
+void weather_http_queue_conditional_request(SoupSession *session,
+                                            const gchar *uri,
+                                            const update_info *upi,
+                                            weather_schedule_priority priority,
+                                            GCancellable *cancellable,
+#if SOUP_CHECK_VERSION(3, 0, 0)
+                                            GAsyncReadyCallback callback_func,
+#else
+                                            SoupSessionCallback callback_func,
+#endif
+                                            gpointer user_data);
+
+update_info *make_update_info(const guint check_interval);
+
+void update_info_free(update_info *upi);
+
+void update_info_set_validators(update_info *upi,
+                                gchar *etag,
+                                gchar *last_modified);
+
+time_t get_response_expiry(SoupMessageHeaders *headers,
+                           const gchar *lat,
+                           const gchar *lon);
+
+weather_response update_info_handle_response(update_info *upi,
+                                             guint status,
+                                             SoupMessageHeaders *headers,
+                                             const gchar *lat,
+                                             const gchar *lon);
+
+time_t calc_next_download_time(const update_info *upi,
+                               time_t retry_t);
+
+void restore_cached_update_times(update_info *weather_update,
+                                 update_info *astro_update,
+                                 time_t last_weather_t,
+                                 time_t weather_expires_t,
+                                 time_t last_astro_t,
+                                 time_t now_t);
+
+void weather_cancel_requests(plugin_data *data);
+
 void scrollbox_set_visible(plugin_data *data);
 
 void forecast_click(GtkWidget *widget,
@@ -0,0 +1,191 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Compare the timeslice lookup through the interval index with the
+ * linear scan it replaced, on the timeslices of a 10 day forecast.
+ * Each round merges the feed twice, the first time into empty data
+ * and the second time into data that already has all timeslices, as
+ * it happens when new data is downloaded.
+ */
+
+#include <glib.h>
+
+#include "weather-parsers.h"
+
+#define BENCH_ROUNDS (200)
+#define HOUR (3600)
+
+
+typedef struct {
+    time_t start;
+    time_t end;
+} feed_time;
+
+
+/*
+ * The <time> elements of a locationforecast feed: hourly point data
+ * and 1 hour intervals for the first 60 hours, with 3 and 6 hour
+ * intervals in between, then point data and 6 hour intervals every
+ * 6 hours up to 10 days.
+ */
+static GArray *
+make_feed(time_t base_t)
+{
+    GArray *feed;
+    feed_time ft;
+    time_t t;
+    gint h;
+
+    feed = g_array_new(FALSE, FALSE, sizeof(feed_time));
+    for (h = 0; h <= 10 * 24; h += (h < 60) ? 1 : 6) {
+        t = base_t + h * HOUR;
+        ft.start = ft.end = t;
+        g_array_append_val(feed, ft);
+        ft.end = t + (h < 60 ? 1 : 6) * HOUR;
+        g_array_append_val(feed, ft);
+        if (h < 60 && h % 3 == 0) {
+            ft.end = t + 3 * HOUR;
+            g_array_append_val(feed, ft);
+        }
+        if (h < 60 && h % 6 == 0) {
+            ft.end = t + 6 * HOUR;
+            g_array_append_val(feed, ft);
+        }
+    }
+    return feed;
+}
+
+
+/* the lookup before the index was added */
+static xml_time *
+linear_get_timeslice(GArray *timeslices,
+                     time_t start_t,
+                     time_t end_t)
+{
+    xml_time *timeslice;
+    guint i;
+
+    for (i = 0; i < timeslices->len; i++) {
+        timeslice = g_array_index(timeslices, xml_time *, i);
+        if (timeslice->start == start_t && timeslice->end == end_t)
+            return timeslice;
+    }
+    return NULL;
+}
+
+
+static guint
+merge_indexed(xml_weather *wd,
+              GArray *feed)
+{
+    feed_time *ft;
+    xml_time *timeslice;
+    guint i, found = 0;
+
+    for (i = 0; i < feed->len; i++) {
+        ft = &g_array_index(feed, feed_time, i);
+        timeslice = get_timeslice(wd, ft->start, ft->end);
+        if (timeslice)
+            found++;
+        else {
+            timeslice = make_timeslice();
+            timeslice->start = ft->start;
+            timeslice->end = ft->end;
+            add_timeslice(wd, timeslice);
+        }
+    }
+    return found;
+}
+
+
+static guint
+merge_linear(GArray *timeslices,
+             GArray *feed)
+{
+    feed_time *ft;
+    xml_time *timeslice;
+    guint i, found = 0;
+
+    for (i = 0; i < feed->len; i++) {
+        ft = &g_array_index(feed, feed_time, i);
+        timeslice = linear_get_timeslice(timeslices, ft->start, ft->end);
+        if (timeslice)
+            found++;
+        else {
+            timeslice = make_timeslice();
+            timeslice->start = ft->start;
+            timeslice->end = ft->end;
+            g_array_append_val(timeslices, timeslice);
+        }
+    }
+    return found;
+}
+
+
+int
+main(int argc,
+     char **argv)
+{
+    GArray *feed, *timeslices;
+    GTimer *timer;
+    xml_weather *wd;
+    gdouble indexed, linear;
+    guint round, i, found_indexed = 0, found_linear = 0;
+
+    feed = make_feed(1700000000);
+    timer = g_timer_new();
+
+    g_timer_start(timer);
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        wd = make_weather_data();
+        merge_indexed(wd, feed);
+        found_indexed += merge_indexed(wd, feed);
+        xml_weather_unref(wd);
+    }
+    indexed = g_timer_elapsed(timer, NULL);
+
+    g_timer_start(timer);
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        timeslices = g_array_new(FALSE, FALSE, sizeof(xml_time *));
+        merge_linear(timeslices, feed);
+        found_linear += merge_linear(timeslices, feed);
+        for (i = 0; i < timeslices->len; i++)
+            xml_time_free(g_array_index(timeslices, xml_time *, i));
+        g_array_free(timeslices, TRUE);
+    }
+    linear = g_timer_elapsed(timer, NULL);
+
+    /* both have to find every timeslice on the second merge */
+    if (found_indexed != found_linear ||
+        found_indexed != BENCH_ROUNDS * feed->len) {
+        g_printerr("lookups differ: %u indexed, %u linear\n",
+                   found_indexed, found_linear);
+        return 1;
+    }
+
+    g_print("%u timeslices, %d rounds\n", feed->len, BENCH_ROUNDS);
+    g_print("indexed lookup: %.3f ms per round\n",
+            indexed * 1000 / BENCH_ROUNDS);
+    g_print("linear scan:    %.3f ms per round\n",
+            linear * 1000 / BENCH_ROUNDS);
+
+    g_timer_destroy(timer);
+    g_array_free(feed, TRUE);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Compare the local sun calculation with reference values stored in
+ * data/. These are not recorded API responses: they were computed
+ * with the NOAA solar position algorithm, sampled every 5 seconds,
+ * and written in the SunriseJSON format of the sun endpoint so that
+ * they are parsed by the same code as downloaded data. Times are
+ * given to the minute, elevations to a hundredth of a degree. The
+ * moon is not covered, as there is no reference for it yet.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <glib.h>
+
+#include "weather-parsers.h"
+#include "weather-astro.h"
+
+/* the times in the reference files are local to this zone */
+#define TEST_TZ "Europe/Oslo"
+
+/* accuracy promised by weather-astro.c */
+#define TIME_TOLERANCE (120)
+#define ELEVATION_TOLERANCE (0.2)
+
+
+static void
+test_sun(gconstpointer user_data)
+{
+    const gchar *name = user_data;
+    json_object *tree, *jgeometry, *jcoords;
+    GArray *astrodata;
+    xml_astro *ref, *calc;
+    gchar *filename, *contents;
+    gsize len;
+    gdouble lat, lon;
+
+    filename = g_test_build_filename(G_TEST_DIST, "data", name, NULL);
+    g_assert_true(g_file_get_contents(filename, &contents, &len, NULL));
+    g_free(filename);
+
+    tree = get_json_tree(contents, len);
+    g_free(contents);
+    g_assert_nonnull(tree);
+
+    jgeometry = json_object_object_get(tree, "geometry");
+    g_assert_nonnull(jgeometry);
+    jcoords = json_object_object_get(jgeometry, "coordinates");
+    g_assert_nonnull(jcoords);
+    lon = json_object_get_double(json_object_array_get_idx(jcoords, 0));
+    lat = json_object_get_double(json_object_array_get_idx(jcoords, 1));
+
+    astrodata = g_array_sized_new(FALSE, TRUE, sizeof(xml_astro *), 1);
+    g_assert_true(parse_astrodata_sun(tree, astrodata));
+    json_object_put(tree);
+    g_assert_cmpuint(astrodata->len, ==, 1);
+    ref = g_array_index(astrodata, xml_astro *, 0);
+
+    calc = calc_astro_data(ref->day, lat, lon);
+    g_assert_nonnull(calc);
+    g_assert_cmpint(calc->day, ==, ref->day);
+
+    g_assert_cmpint(calc->sun_never_rises, ==, ref->sun_never_rises);
+    g_assert_cmpint(calc->sun_never_sets, ==, ref->sun_never_sets);
+    if (!ref->sun_never_rises)
+        g_assert_cmpint(ABS(calc->sunrise - ref->sunrise), <=,
+                        TIME_TOLERANCE);
+    if (!ref->sun_never_sets)
+        g_assert_cmpint(ABS(calc->sunset - ref->sunset), <=,
+                        TIME_TOLERANCE);
+
+    g_assert_cmpfloat_with_epsilon(calc->solarnoon_elevation,
+                                   ref->solarnoon_elevation,
+                                   ELEVATION_TOLERANCE);
+    g_assert_cmpfloat_with_epsilon(calc->solarmidnight_elevation,
+                                   ref->solarmidnight_elevation,
+                                   ELEVATION_TOLERANCE);
+
+    xml_astro_free(calc);
+    astrodata_free(astrodata);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    g_setenv("TZ", TEST_TZ, TRUE);
+    tzset();
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_data_func("/astro/oslo/equinox",
+                         "noaa-sun-oslo-2024-03-20.json", test_sun);
+    g_test_add_data_func("/astro/oslo/winter",
+                         "noaa-sun-oslo-2024-12-21.json", test_sun);
+    /* Tromsø has midnight sun in summer and polar night in winter */
+    g_test_add_data_func("/astro/tromso/polar-day",
+                         "noaa-sun-tromso-2024-06-21.json", test_sun);
+    g_test_add_data_func("/astro/tromso/equinox",
+                         "noaa-sun-tromso-2024-09-22.json", test_sun);
+    g_test_add_data_func("/astro/tromso/polar-night",
+                         "noaa-sun-tromso-2024-12-21.json", test_sun);
+
+    return g_test_run();
+}
@@ -0,0 +1,195 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Drive the retry policy and circuit breaker through a series of
+ * failures, the breaker opening, a failed and a successful probe, and
+ * check that every delay stays between the base and the cap of its
+ * policy.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "weather-backoff.h"
+
+#define TEST_ROUNDS (1000)
+#define TEST_NOW ((time_t) 1700000000)
+
+
+static void
+test_classify(void)
+{
+    g_assert_cmpint(weather_backoff_classify(429), ==,
+                    WEATHER_FAILURE_RATE_LIMITED);
+    g_assert_cmpint(weather_backoff_classify(500), ==,
+                    WEATHER_FAILURE_SERVER);
+    g_assert_cmpint(weather_backoff_classify(503), ==,
+                    WEATHER_FAILURE_SERVER);
+    g_assert_cmpint(weather_backoff_classify(404), ==,
+                    WEATHER_FAILURE_PERMANENT);
+    g_assert_cmpint(weather_backoff_classify(408), ==,
+                    WEATHER_FAILURE_TRANSIENT);
+    /* transport errors have no HTTP status */
+    g_assert_cmpint(weather_backoff_classify(0), ==,
+                    WEATHER_FAILURE_TRANSIENT);
+    g_assert_cmpint(weather_backoff_classify(200), ==,
+                    WEATHER_FAILURE_TRANSIENT);
+}
+
+
+static void
+test_jitter(void)
+{
+    guint i, delay = 0, previous;
+
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        previous = delay;
+        delay = weather_backoff_jitter(BACKOFF_TRANSIENT_BASE,
+                                       BACKOFF_TRANSIENT_CAP, previous);
+        g_assert_cmpuint(delay, >=, BACKOFF_TRANSIENT_BASE);
+        g_assert_cmpuint(delay, <=, BACKOFF_TRANSIENT_CAP);
+        g_assert_cmpuint(delay, <=, MAX(previous, BACKOFF_TRANSIENT_BASE) * 3);
+    }
+
+    /* a base above the cap yields the cap */
+    g_assert_cmpuint(weather_backoff_jitter(100, 50, 0), ==, 50);
+}
+
+
+/* check the breaker is open until now_t plus its interval */
+static void
+assert_open(const weather_backoff *backoff,
+            time_t now_t)
+{
+    g_assert_cmpint(backoff->breaker, ==, WEATHER_BREAKER_OPEN);
+    g_assert_cmpuint(backoff->open_interval, >=, BACKOFF_BREAKER_OPEN);
+    g_assert_cmpuint(backoff->open_interval, <=, BACKOFF_BREAKER_MAX_OPEN);
+    g_assert_cmpint(backoff->open_until, ==,
+                    now_t + (time_t) backoff->open_interval);
+}
+
+
+static void
+test_breaker(void)
+{
+    weather_backoff backoff;
+    time_t now_t = TEST_NOW, next_t;
+    guint i;
+
+    memset(&backoff, 0, sizeof(backoff));
+    g_assert_true(weather_backoff_allow(&backoff, now_t));
+
+    /* failures below the threshold only delay the next request */
+    for (i = 1; i < BACKOFF_BREAKER_THRESHOLD; i++) {
+        weather_backoff_failed(&backoff, 0, now_t);
+        g_assert_cmpuint(backoff.failures, ==, i);
+        g_assert_cmpint(backoff.breaker, ==, WEATHER_BREAKER_CLOSED);
+        g_assert_cmpuint(backoff.delay, >=, BACKOFF_TRANSIENT_BASE);
+        g_assert_cmpuint(backoff.delay, <=, BACKOFF_TRANSIENT_CAP);
+        next_t = weather_backoff_next(&backoff, now_t, G_MAXUINT);
+        g_assert_cmpint(next_t, ==, now_t + (time_t) backoff.delay);
+        g_assert_true(weather_backoff_allow(&backoff, next_t));
+        now_t = next_t;
+    }
+
+    /* the next one opens the breaker, blocking requests until it
+       times out */
+    weather_backoff_failed(&backoff, 0, now_t);
+    assert_open(&backoff, now_t);
+    g_assert_false(weather_backoff_allow(&backoff, now_t));
+    g_assert_false(weather_backoff_allow(&backoff,
+                                         backoff.open_until - 1));
+    g_assert_cmpint(weather_backoff_next(&backoff, now_t, G_MAXUINT), ==,
+                    backoff.open_until);
+
+    /* after that, a probe is let through, which fails */
+    now_t = backoff.open_until;
+    g_assert_true(weather_backoff_allow(&backoff, now_t));
+    g_assert_cmpint(backoff.breaker, ==, WEATHER_BREAKER_HALF_OPEN);
+    weather_backoff_failed(&backoff, 503, now_t);
+    g_assert_cmpint(backoff.failure, ==, WEATHER_FAILURE_SERVER);
+    assert_open(&backoff, now_t);
+    g_assert_false(weather_backoff_allow(&backoff, now_t));
+
+    /* the next probe succeeds and closes the breaker */
+    now_t = backoff.open_until;
+    g_assert_true(weather_backoff_allow(&backoff, now_t));
+    g_assert_cmpint(backoff.breaker, ==, WEATHER_BREAKER_HALF_OPEN);
+    weather_backoff_succeeded(&backoff);
+    g_assert_cmpint(backoff.breaker, ==, WEATHER_BREAKER_CLOSED);
+    g_assert_cmpuint(backoff.failures, ==, 0);
+    g_assert_cmpuint(backoff.delay, ==, 0);
+    g_assert_true(weather_backoff_allow(&backoff, now_t));
+}
+
+
+static void
+test_permanent(void)
+{
+    weather_backoff backoff;
+    guint i;
+
+    /* retrying will not help, so the breaker opens right away */
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        memset(&backoff, 0, sizeof(backoff));
+        weather_backoff_failed(&backoff, 404, TEST_NOW);
+        g_assert_cmpint(backoff.failure, ==, WEATHER_FAILURE_PERMANENT);
+        g_assert_cmpuint(backoff.delay, >=, BACKOFF_PERMANENT_BASE);
+        g_assert_cmpuint(backoff.delay, <=, BACKOFF_PERMANENT_CAP);
+        assert_open(&backoff, TEST_NOW);
+    }
+}
+
+
+static void
+test_open_interval(void)
+{
+    weather_backoff backoff;
+    time_t now_t = TEST_NOW;
+    guint i;
+
+    /* failed probes keep the breaker open for longer, up to the cap */
+    memset(&backoff, 0, sizeof(backoff));
+    for (i = 0; i < TEST_ROUNDS; i++) {
+        if (weather_backoff_allow(&backoff, now_t))
+            weather_backoff_failed(&backoff, 0, now_t);
+        g_assert_cmpuint(backoff.delay, >=, BACKOFF_TRANSIENT_BASE);
+        g_assert_cmpuint(backoff.delay, <=, BACKOFF_TRANSIENT_CAP);
+        if (backoff.breaker == WEATHER_BREAKER_OPEN) {
+            g_assert_cmpuint(backoff.open_interval, >=, BACKOFF_BREAKER_OPEN);
+            g_assert_cmpuint(backoff.open_interval, <=,
+                             BACKOFF_BREAKER_MAX_OPEN);
+        }
+        now_t = weather_backoff_next(&backoff, now_t, BACKOFF_TRANSIENT_CAP);
+    }
+}
+
+
+int
+main(int argc,
+     char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/backoff/classify", test_classify);
+    g_test_add_func("/backoff/jitter", test_jitter);
+    g_test_add_func("/backoff/breaker", test_breaker);
+    g_test_add_func("/backoff/permanent", test_permanent);
+    g_test_add_func("/backoff/open-interval", test_open_interval);
+    return g_test_run();
+}
@@ -0,0 +1,246 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Run the request scheduler on a made-up clock: a burst of requests
+ * and the refill of the token bucket, the order of the priorities,
+ * the stricter limit of Nominatim, hosts blocked by Retry-After and
+ * cancelled requests, which are never held back.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "weather-scheduler.h"
+
+#define TEST_START ((gint64) 1000 * G_USEC_PER_SEC)
+#define TEST_BURST ((guint) SCHEDULER_BURST)
+#define TEST_INTERVAL ((gint64) (G_USEC_PER_SEC / SCHEDULER_RATE))
+
+/* user data of the requests that have been sent, in order */
+static GPtrArray *sent = NULL;
+
+
+static void
+cb_send(gpointer user_data)
+{
+    g_ptr_array_add(sent, user_data);
+}
+
+
+static void
+add_request(const gchar *uri,
+            weather_schedule_priority priority,
+            GCancellable *cancellable,
+            const gchar *name,
+            gint64 now)
+{
+    weather_scheduler_add(uri, priority, cancellable, cb_send,
+                          (gpointer) name, now);
+}
+
+
+static void
+test_burst(void)
+{
+    const gchar *uri = "https://burst.example.org/";
+    gint64 now = TEST_START;
+    guint i;
+
+    g_ptr_array_set_size(sent, 0);
+    for (i = 0; i < TEST_BURST; i++) {
+        add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "burst", now);
+        g_assert_cmpuint(sent->len, ==, i + 1);
+    }
+
+    /* the bucket is empty now and refills at the rate */
+    add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "refill", now);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST);
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, now + TEST_INTERVAL);
+    g_assert_cmpint(weather_scheduler_dispatch(now + TEST_INTERVAL / 2), ==,
+                    now + TEST_INTERVAL);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST);
+    now += TEST_INTERVAL;
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, 0);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST + 1);
+    g_assert_cmpstr(g_ptr_array_index(sent, TEST_BURST), ==, "refill");
+
+    /* after a long pause, the bucket holds no more than a burst */
+    now += (gint64) 3600 * G_USEC_PER_SEC;
+    g_ptr_array_set_size(sent, 0);
+    for (i = 0; i <= TEST_BURST; i++)
+        add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "burst", now);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST);
+    g_assert_cmpint(weather_scheduler_dispatch(now + TEST_INTERVAL), ==, 0);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST + 1);
+}
+
+
+static void
+test_priority(void)
+{
+    const gchar *uri = "https://priority.example.org/";
+    gint64 now = TEST_START;
+    guint i;
+
+    g_ptr_array_set_size(sent, 0);
+    for (i = 0; i < TEST_BURST; i++)
+        add_request(uri, WEATHER_SCHEDULE_ASTRO, NULL, "burst", now);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST);
+
+    /* queued in the reverse order of their priorities */
+    add_request(uri, WEATHER_SCHEDULE_ASTRO, NULL, "astro", now);
+    add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "forecast", now);
+    add_request(uri, WEATHER_SCHEDULE_INTERACTIVE, NULL, "interactive", now);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST);
+
+    /* one token is only enough for the most important request */
+    now += TEST_INTERVAL;
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, now + TEST_INTERVAL);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST + 1);
+    now += 2 * TEST_INTERVAL;
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, 0);
+    g_assert_cmpuint(sent->len, ==, TEST_BURST + 3);
+    g_assert_cmpstr(g_ptr_array_index(sent, TEST_BURST), ==,
+                    "interactive");
+    g_assert_cmpstr(g_ptr_array_index(sent, TEST_BURST + 1), ==,
+                    "forecast");
+    g_assert_cmpstr(g_ptr_array_index(sent, TEST_BURST + 2), ==,
+                    "astro");
+}
+
+
+static void
+test_nominatim(void)
+{
+    const gchar *uri = "https://nominatim.openstreetmap.org/search?q=Oslo";
+    gint64 now = TEST_START;
+
+    /* the usage policy allows one request per second at most */
+    g_ptr_array_set_size(sent, 0);
+    add_request(uri, WEATHER_SCHEDULE_INTERACTIVE, NULL, "first", now);
+    add_request(uri, WEATHER_SCHEDULE_INTERACTIVE, NULL, "second", now);
+    g_assert_cmpuint(sent->len, ==, 1);
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==,
+                    now + G_USEC_PER_SEC);
+    g_assert_cmpint(weather_scheduler_dispatch(now + G_USEC_PER_SEC / 2), ==,
+                    now + G_USEC_PER_SEC);
+    g_assert_cmpuint(sent->len, ==, 1);
+    g_assert_cmpint(weather_scheduler_dispatch(now + G_USEC_PER_SEC), ==, 0);
+    g_assert_cmpuint(sent->len, ==, 2);
+    g_assert_cmpstr(g_ptr_array_index(sent, 1), ==, "second");
+}
+
+
+static void
+test_retry_after(void)
+{
+    const gchar *uri = "https://retry.example.org/";
+    gint64 now = TEST_START, until;
+
+    g_ptr_array_set_size(sent, 0);
+    weather_scheduler_retry_after(uri, 30, now);
+    add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "blocked", now);
+    until = now + (gint64) 30 * G_USEC_PER_SEC;
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, until);
+    g_assert_cmpint(weather_scheduler_dispatch(until - 1), ==, until);
+    g_assert_cmpuint(sent->len, ==, 0);
+
+    /* other hosts are not affected */
+    add_request("https://other.example.org/", WEATHER_SCHEDULE_FORECAST,
+                NULL, "other", now);
+    g_assert_cmpuint(sent->len, ==, 1);
+    g_assert_cmpstr(g_ptr_array_index(sent, 0), ==, "other");
+
+    g_assert_cmpint(weather_scheduler_dispatch(until), ==, 0);
+    g_assert_cmpuint(sent->len, ==, 2);
+    g_assert_cmpstr(g_ptr_array_index(sent, 1), ==, "blocked");
+
+    /* a longer block is cut to the maximum */
+    now = until;
+    weather_scheduler_retry_after(uri, 24 * 3600, now);
+    add_request(uri, WEATHER_SCHEDULE_FORECAST, NULL, "capped", now);
+    until = now + (gint64) SCHEDULER_MAX_RETRY_AFTER * G_USEC_PER_SEC;
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, until);
+    g_assert_cmpint(weather_scheduler_dispatch(until), ==, 0);
+    g_assert_cmpuint(sent->len, ==, 3);
+}
+
+
+static void
+test_cancelled(void)
+{
+    const gchar *uri = "https://cancel.example.org/";
+    GCancellable *cancellable;
+    gint64 now = TEST_START;
+
+    g_ptr_array_set_size(sent, 0);
+    weather_scheduler_retry_after(uri, 60, now);
+
+    /* already cancelled, so not even queued */
+    cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    add_request(uri, WEATHER_SCHEDULE_ASTRO, cancellable, "cancelled", now);
+    g_assert_cmpuint(sent->len, ==, 1);
+    g_object_unref(cancellable);
+
+    /* cancelled while waiting for the host */
+    cancellable = g_cancellable_new();
+    add_request(uri, WEATHER_SCHEDULE_ASTRO, cancellable, "waiting", now);
+    g_assert_cmpuint(sent->len, ==, 1);
+    g_cancellable_cancel(cancellable);
+    g_assert_cmpint(weather_scheduler_dispatch(now), ==, 0);
+    g_assert_cmpuint(sent->len, ==, 2);
+    g_assert_cmpstr(g_ptr_array_index(sent, 1), ==, "waiting");
+    g_object_unref(cancellable);
+}
+
+
+static void
+test_host(void)
+{
+    gchar *host;
+
+    host = weather_scheduler_get_host("https://api.met.no/weatherapi/");
+    g_assert_cmpstr(host, ==, "api.met.no");
+    g_free(host);
+
+    /* URIs without a host share one token bucket */
+    host = weather_scheduler_get_host("file:///tmp/forecast.xml");
+    g_assert_cmpstr(host, ==, "");
+    g_free(host);
+    host = weather_scheduler_get_host("not a uri");
+    g_assert_cmpstr(host, ==, "");
+    g_free(host);
+}
+
+
+int
+main(int argc,
+     char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    sent = g_ptr_array_new();
+    g_test_add_func("/scheduler/host", test_host);
+    g_test_add_func("/scheduler/burst", test_burst);
+    g_test_add_func("/scheduler/priority", test_priority);
+    g_test_add_func("/scheduler/nominatim", test_nominatim);
+    g_test_add_func("/scheduler/retry-after", test_retry_after);
+    g_test_add_func("/scheduler/cancelled", test_cancelled);
+    return g_test_run();
+}
@@ -0,0 +1,776 @@
+/*  Copyright (c) 2003-2014 Xfce Development Team
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+ * Download weather data from a local server standing in for met.no:
+ * a conditional request answered with 304 Not Modified, scheduling by
+ * the Expires header, two plugin instances sharing one download via
+ * the cache, and a host asking to be left alone with Retry-After.
+ *
+ * The server runs in a thread with its own main context, so that the
+ * weather data can be read synchronously in the callbacks.
+ */
+
+#include <string.h>
+#include <time.h>
+#include <utime.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+
+#include "weather-parsers.h"
+#include "weather-cache.h"
+#include "weather.h"
+
+#define TEST_LAT "59.9139"
+#define TEST_LON "10.7522"
+#define TEST_OFFSET "+00:00"
+#define TEST_ETAG "\"forecast-1\""
+#define TEST_HOURS (6)                  /* timeslices in the forecast */
+#define TEST_EXPIRES (2 * 3600)         /* of the first response */
+#define TEST_NOT_MODIFIED_EXPIRES (3 * 3600)
+#define TEST_RETRY_AFTER (3600)
+#define TEST_WAIT (1500)                /* ms to wait for a request */
+
+typedef struct {
+    GMutex mutex;
+    GMainLoop *loop;
+    gchar *uri;                     /* with a trailing slash */
+    guint requests;
+    guint not_modified;
+} test_server;
+
+typedef struct {
+    GMainLoop *loop;
+    SoupMessage *msg;               /* NULL if nothing was sent */
+    GBytes *body;
+    gboolean cancelled;
+} test_response;
+
+static test_server server;
+
+
+static gchar *
+make_http_date(time_t t)
+{
+    gchar *str;
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    GDateTime *date;
+
+    date = g_date_time_new_from_unix_utc(t);
+    str = soup_date_time_to_string(date, SOUP_DATE_HTTP);
+    g_date_time_unref(date);
+#else
+    SoupDate *date;
+
+    date = soup_date_new_from_time_t(t);
+    str = soup_date_to_string(date, SOUP_DATE_HTTP);
+    soup_date_free(date);
+#endif
+    return str;
+}
+
+
+/* hourly point data starting at the next full hour */
+static gchar *
+make_forecast(time_t now_t)
+{
+    GString *xml;
+    GDateTime *date;
+    gchar *ts;
+    time_t t;
+    guint i;
+
+    xml = g_string_new("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+                       "<weatherdata>\n<product class=\"pointData\">\n");
+    t = now_t - now_t % 3600 + 3600;
+    for (i = 0; i < TEST_HOURS; i++, t += 3600) {
+        date = g_date_time_new_from_unix_utc(t);
+        ts = g_date_time_format(date, "%Y-%m-%dT%H:%M:%SZ");
+        g_date_time_unref(date);
+        g_string_append_printf(xml,
+                               "<time datatype=\"forecast\" from=\"%s\" "
+                               "to=\"%s\">\n<location altitude=\"23\" "
+                               "latitude=\"%s\" longitude=\"%s\">\n"
+                               "<temperature unit=\"celsius\" "
+                               "value=\"%u.0\"/>\n</location>\n</time>\n",
+                               ts, ts, TEST_LAT, TEST_LON, i);
+        g_free(ts);
+    }
+    g_string_append(xml, "</product>\n</weatherdata>\n");
+    return g_string_free(xml, FALSE);
+}
+
+
+/* answer a request like met.no, returns the status */
+static guint
+server_respond(const gchar *path,
+               SoupMessageHeaders *request,
+               SoupMessageHeaders *response,
+               gchar **body)
+{
+    const gchar *etag;
+    gchar *date;
+    time_t now_t = time(NULL);
+
+    g_mutex_lock(&server.mutex);
+    server.requests++;
+    g_mutex_unlock(&server.mutex);
+
+    if (strcmp(path, "/busy") == 0) {
+        date = g_strdup_printf("%d", TEST_RETRY_AFTER);
+        soup_message_headers_replace(response, "Retry-After", date);
+        g_free(date);
+        return 429;
+    }
+
+    etag = soup_message_headers_get_one(request, "If-None-Match");
+    if (g_strcmp0(etag, TEST_ETAG) == 0) {
+        g_mutex_lock(&server.mutex);
+        server.not_modified++;
+        g_mutex_unlock(&server.mutex);
+        date = make_http_date(now_t + TEST_NOT_MODIFIED_EXPIRES);
+        soup_message_headers_replace(response, "Expires", date);
+        g_free(date);
+        return SOUP_STATUS_NOT_MODIFIED;
+    }
+
+    soup_message_headers_replace(response, "ETag", TEST_ETAG);
+    date = make_http_date(now_t);
+    soup_message_headers_replace(response, "Last-Modified", date);
+    g_free(date);
+    date = make_http_date(now_t + TEST_EXPIRES);
+    soup_message_headers_replace(response, "Expires", date);
+    g_free(date);
+    *body = make_forecast(now_t);
+    return SOUP_STATUS_OK;
+}
+
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+server_handler(SoupServer *soup_server,
+               SoupServerMessage *msg,
+               const char *path,
+               GHashTable *query,
+               gpointer user_data)
+{
+    gchar *body = NULL;
+    guint status;
+
+    status = server_respond(path,
+                            soup_server_message_get_request_headers(msg),
+                            soup_server_message_get_response_headers(msg),
+                            &body);
+    soup_server_message_set_status(msg, status, NULL);
+    if (body)
+        soup_server_message_set_response(msg, "application/xml",
+                                         SOUP_MEMORY_TAKE,
+                                         body, strlen(body));
+}
+#else
+static void
+server_handler(SoupServer *soup_server,
+               SoupMessage *msg,
+               const char *path,
+               GHashTable *query,
+               SoupClientContext *client,
+               gpointer user_data)
+{
+    gchar *body = NULL;
+    guint status;
+
+    status = server_respond(path, msg->request_headers,
+                            msg->response_headers, &body);
+    soup_message_set_status(msg, status);
+    if (body)
+        soup_message_set_response(msg, "application/xml",
+                                  SOUP_MEMORY_TAKE, body, strlen(body));
+}
+#endif
+
+
+static gpointer
+server_thread(gpointer user_data)
+{
+    GAsyncQueue *ready = user_data;
+    GMainContext *context;
+    SoupServer *soup_server;
+    GSList *uris;
+    GError *error = NULL;
+    guint port;
+
+    context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+    server.loop = g_main_loop_new(context, FALSE);
+
+    soup_server = soup_server_new(NULL);
+    soup_server_add_handler(soup_server, NULL, server_handler, NULL, NULL);
+    if (!soup_server_listen_local(soup_server, 0,
+                                  SOUP_SERVER_LISTEN_IPV4_ONLY, &error))
+        g_error("Cannot start server: %s", error->message);
+
+    uris = soup_server_get_uris(soup_server);
+    g_assert_nonnull(uris);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    port = g_uri_get_port(uris->data);
+    g_slist_free_full(uris, (GDestroyNotify) g_uri_unref);
+#else
+    port = ((SoupURI *) uris->data)->port;
+    g_slist_free_full(uris, (GDestroyNotify) soup_uri_free);
+#endif
+    server.uri = g_strdup_printf("http://127.0.0.1:%u/", port);
+    g_async_queue_push(ready, server.uri);
+
+    g_main_loop_run(server.loop);
+
+    g_object_unref(soup_server);
+    g_main_loop_unref(server.loop);
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+    return NULL;
+}
+
+
+static guint
+server_get_count(const guint *count)
+{
+    guint value;
+
+    g_mutex_lock(&server.mutex);
+    value = *count;
+    g_mutex_unlock(&server.mutex);
+    return value;
+}
+
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+cb_response(GObject *source,
+            GAsyncResult *result,
+            gpointer user_data)
+{
+    test_response *resp = user_data;
+    GInputStream *stream;
+    GOutputStream *out;
+    GError *error = NULL;
+
+    stream = soup_session_send_finish(SOUP_SESSION(source), result, &error);
+    if (stream) {
+        resp->msg = g_object_ref
+            (soup_session_get_async_result_message(SOUP_SESSION(source),
+                                                   result));
+        out = g_memory_output_stream_new_resizable();
+        g_output_stream_splice(out, stream,
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                               NULL, NULL);
+        resp->body = g_memory_output_stream_steal_as_bytes
+            (G_MEMORY_OUTPUT_STREAM(out));
+        g_object_unref(out);
+        g_object_unref(stream);
+    } else {
+        resp->cancelled =
+            g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+        g_error_free(error);
+    }
+    g_main_loop_quit(resp->loop);
+}
+#else
+static void
+cb_response(SoupSession *session,
+            SoupMessage *msg,
+            gpointer user_data)
+{
+    test_response *resp = user_data;
+
+    if (msg->status_code == SOUP_STATUS_CANCELLED)
+        resp->cancelled = TRUE;
+    else {
+        resp->msg = g_object_ref(msg);
+        if (msg->response_body && msg->response_body->length)
+            resp->body = g_bytes_new(msg->response_body->data,
+                                     msg->response_body->length);
+    }
+    g_main_loop_quit(resp->loop);
+}
+#endif
+
+
+static guint
+response_get_status(const test_response *resp)
+{
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    return soup_message_get_status(resp->msg);
+#else
+    return resp->msg->status_code;
+#endif
+}
+
+
+static SoupMessageHeaders *
+response_get_headers(const test_response *resp)
+{
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    return soup_message_get_response_headers(resp->msg);
+#else
+    return resp->msg->response_headers;
+#endif
+}
+
+
+static gboolean
+cb_cancel(gpointer user_data)
+{
+    g_cancellable_cancel(user_data);
+    return G_SOURCE_REMOVE;
+}
+
+
+/* send a request the way the plugin does and wait for the response */
+static void
+request(SoupSession *session,
+        const gchar *path,
+        const update_info *upi,
+        GCancellable *cancellable,
+        test_response *resp)
+{
+    gchar *uri;
+
+    memset(resp, 0, sizeof(test_response));
+    resp->loop = g_main_loop_new(NULL, FALSE);
+    uri = g_strconcat(server.uri, path, NULL);
+    weather_http_queue_conditional_request(session, uri, upi,
+                                           WEATHER_SCHEDULE_FORECAST,
+                                           cancellable, cb_response, resp);
+    g_free(uri);
+    g_main_loop_run(resp->loop);
+}
+
+
+static void
+response_clear(test_response *resp)
+{
+    g_main_loop_unref(resp->loop);
+    if (resp->msg)
+        g_object_unref(resp->msg);
+    if (resp->body)
+        g_bytes_unref(resp->body);
+}
+
+
+static xml_weather *
+parse_forecast(GBytes *body)
+{
+    weather_parser *parser;
+    xml_weather *wd;
+    gconstpointer buf;
+    gsize len;
+
+    g_assert_nonnull(body);
+    buf = g_bytes_get_data(body, &len);
+    wd = make_weather_data();
+    parser = weather_parser_new(wd);
+    g_assert_true(weather_parser_feed(parser, buf, len));
+    g_assert_true(weather_parser_finish(parser));
+    weather_parser_free(parser);
+    g_assert_cmpuint(wd->timeslices->len, ==, TEST_HOURS);
+    return wd;
+}
+
+
+/*
+ * Download the data like an update of the plugin and keep the
+ * validators as if it had been parsed successfully.
+ */
+static xml_weather *
+download_forecast(SoupSession *session,
+                  update_info *upi)
+{
+    test_response resp;
+    xml_weather *wd;
+    SoupMessageHeaders *headers;
+    time_t before_t, after_t;
+
+    before_t = time(NULL);
+    request(session, "forecast", upi, NULL, &resp);
+    after_t = time(NULL);
+    g_assert_nonnull(resp.msg);
+    g_assert_cmpuint(response_get_status(&resp), ==, SOUP_STATUS_OK);
+
+    headers = response_get_headers(&resp);
+    g_assert_cmpint(update_info_handle_response(upi, SOUP_STATUS_OK,
+                                                headers, TEST_LAT,
+                                                TEST_LON),
+                    ==, WEATHER_RESPONSE_NEW_DATA);
+    g_assert_cmpint(upi->expires, >=, before_t + TEST_EXPIRES - 1);
+    g_assert_cmpint(upi->expires, <=,
+                    after_t + TEST_EXPIRES + EXPIRES_MAX_JITTER);
+
+    wd = parse_forecast(resp.body);
+    update_info_set_validators
+        (upi,
+         g_strdup(soup_message_headers_get_one(headers, "ETag")),
+         g_strdup(soup_message_headers_get_one(headers, "Last-Modified")));
+    upi->attempt = 0;
+    upi->last = after_t;
+    response_clear(&resp);
+    return wd;
+}
+
+
+static void
+test_not_modified(void)
+{
+    SoupSession *session;
+    update_info *upi;
+    test_response resp;
+    xml_weather *wd;
+    guint requests;
+    time_t before_t, after_t;
+
+    session = soup_session_new();
+    upi = make_update_info(3600);
+    requests = server_get_count(&server.requests);
+
+    wd = download_forecast(session, upi);
+    xml_weather_unref(wd);
+    g_assert_cmpstr(upi->etag, ==, TEST_ETAG);
+    g_assert_nonnull(upi->last_modified);
+
+    /* the data has not changed, so there is no body this time */
+    before_t = time(NULL);
+    request(session, "forecast", upi, NULL, &resp);
+    after_t = time(NULL);
+    g_assert_nonnull(resp.msg);
+    g_assert_cmpuint(response_get_status(&resp), ==,
+                     SOUP_STATUS_NOT_MODIFIED);
+    g_assert_cmpint(update_info_handle_response(upi,
+                                                response_get_status(&resp),
+                                                response_get_headers(&resp),
+                                                TEST_LAT, TEST_LON),
+                    ==, WEATHER_RESPONSE_NOT_MODIFIED);
+    response_clear(&resp);
+
+    /* the validators are kept for the next request, and the new
+       expiry time is used */
+    g_assert_cmpstr(upi->etag, ==, TEST_ETAG);
+    g_assert_cmpint(upi->expires, >=,
+                    before_t + TEST_NOT_MODIFIED_EXPIRES - 1);
+    g_assert_cmpint(upi->expires, <=,
+                    after_t + TEST_NOT_MODIFIED_EXPIRES + EXPIRES_MAX_JITTER);
+    g_assert_cmpuint(server_get_count(&server.requests) - requests, ==, 2);
+    g_assert_cmpuint(server_get_count(&server.not_modified), ==, 1);
+
+    update_info_free(upi);
+    g_object_unref(session);
+}
+
+
+static void
+test_expires(void)
+{
+    SoupMessageHeaders *headers;
+    update_info *upi;
+    gchar *date;
+    time_t now_t = time(NULL), expires_t;
+
+    headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+    g_assert_cmpint(get_response_expiry(headers, TEST_LAT, TEST_LON), ==, 0);
+    soup_message_headers_replace(headers, "Expires", "soon");
+    g_assert_cmpint(get_response_expiry(headers, TEST_LAT, TEST_LON), ==, 0);
+
+    /* the jitter is the same for every response of a location */
+    date = make_http_date(now_t + 3600);
+    soup_message_headers_replace(headers, "Expires", date);
+    g_free(date);
+    expires_t = get_response_expiry(headers, TEST_LAT, TEST_LON);
+    g_assert_cmpint(expires_t, >=, now_t + 3600);
+    g_assert_cmpint(expires_t, <=, now_t + 3600 + EXPIRES_MAX_JITTER);
+    g_assert_cmpint(get_response_expiry(headers, TEST_LAT, TEST_LON),
+                    ==, expires_t);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    soup_message_headers_unref(headers);
+#else
+    soup_message_headers_free(headers);
+#endif
+
+    upi = make_update_info(3600);
+    g_assert_cmpint(calc_next_download_time(upi, now_t), ==, now_t + 3600);
+    upi->expires = now_t + 2 * 3600;
+    g_assert_cmpint(calc_next_download_time(upi, now_t), ==,
+                    now_t + 2 * 3600);
+
+    /* expiry times that are way off are not trusted */
+    upi->expires = now_t + 30;
+    g_assert_cmpint(calc_next_download_time(upi, now_t), ==,
+                    now_t + EXPIRES_MIN_INTERVAL);
+    upi->expires = now_t - 3600;
+    g_assert_cmpint(calc_next_download_time(upi, now_t), ==,
+                    now_t + EXPIRES_MIN_INTERVAL);
+    upi->expires = now_t + 48 * 3600;
+    g_assert_cmpint(calc_next_download_time(upi, now_t), ==,
+                    now_t + EXPIRES_MAX_INTERVAL);
+
+    /* a failed download is retried by the backoff policy instead,
+       but not later than the regular check */
+    upi->attempt = 1;
+    weather_backoff_failed(&upi->backoff, 503, now_t);
+    g_assert_cmpint(calc_next_download_time(upi, now_t), >, now_t);
+    g_assert_cmpint(calc_next_download_time(upi, now_t), <=,
+                    now_t + upi->check_interval);
+    update_info_free(upi);
+}
+
+
+/*
+ * After a restart, the update times are restored from the cache, and
+ * the weather data is only downloaded right away if it has expired.
+ */
+static void
+test_restart(void)
+{
+    update_info *weather_update, *astro_update;
+    time_t now_t = time(NULL);
+
+    weather_update = make_update_info(3600);
+    astro_update = make_update_info(24 * 3600);
+
+    restore_cached_update_times(weather_update, astro_update,
+                                now_t - 600, now_t + 3000,
+                                now_t - 3600, now_t);
+    g_assert_cmpint(weather_update->last, ==, now_t - 600);
+    g_assert_cmpint(weather_update->expires, ==, now_t + 3000);
+    g_assert_cmpint(weather_update->next, ==, now_t + 3000);
+    g_assert_cmpint(astro_update->last, ==, now_t - 3600);
+    g_assert_cmpint(astro_update->next, ==, now_t - 3600 + 24 * 3600);
+
+    /* expired data is downloaded again right away */
+    restore_cached_update_times(weather_update, astro_update,
+                                now_t - 7200, now_t - 60,
+                                now_t - 3600, now_t);
+    g_assert_cmpint(weather_update->next, ==, now_t);
+
+    /* and so is data without an expiry time */
+    restore_cached_update_times(weather_update, astro_update,
+                                now_t - 600, 0, now_t - 3600, now_t);
+    g_assert_cmpint(weather_update->next, ==, now_t);
+
+    update_info_free(weather_update);
+    update_info_free(astro_update);
+}
+
+
+static void
+remove_dir(const gchar *path)
+{
+    GDir *dir;
+    const gchar *name;
+    gchar *file;
+
+    dir = g_dir_open(path, 0, NULL);
+    g_assert_nonnull(dir);
+    while ((name = g_dir_read_name(dir))) {
+        file = g_build_filename(path, name, NULL);
+        g_unlink(file);
+        g_free(file);
+    }
+    g_dir_close(dir);
+    g_rmdir(path);
+}
+
+
+/*
+ * Two plugin instances show the same place. The first one takes the
+ * lease, downloads the data and writes it to the cache, while the
+ * second one waits and then uses the cached data without a download
+ * of its own.
+ */
+static void
+test_shared(void)
+{
+    SoupSession *session;
+    weather_cache_store *store1, *store2;
+    weather_cache_writer *writer;
+    weather_cache *cache;
+    weather_cache_info want, info;
+    const weather_cache_info *shared;
+    update_info *upi;
+    xml_weather *wd, *wd2;
+    struct utimbuf times;
+    gchar *dir, *key, *lease;
+    guint requests;
+    time_t now_t = time(NULL);
+
+    dir = g_dir_make_tmp("weather-test-XXXXXX", NULL);
+    g_assert_nonnull(dir);
+    store1 = weather_cache_store_new(dir, 1024 * 1024);
+    store2 = weather_cache_store_new(dir, 1024 * 1024);
+    key = weather_cache_store_make_key(g_ascii_strtod(TEST_LAT, NULL),
+                                       g_ascii_strtod(TEST_LON, NULL));
+
+    memset(&want, 0, sizeof(want));
+    want.lat = TEST_LAT;
+    want.lon = TEST_LON;
+    want.offset = TEST_OFFSET;
+    want.msl = 23;
+
+    /* nothing has been downloaded yet, the first instance does it */
+    g_assert_null(weather_cache_open_shared(store1, key, &want, now_t));
+    g_assert_true(weather_cache_store_take_lease(store1, key,
+                                                 SHARED_DOWNLOAD_LEASE));
+    g_assert_null(weather_cache_open_shared(store2, key, &want, now_t));
+    g_assert_false(weather_cache_store_take_lease(store2, key,
+                                                  SHARED_DOWNLOAD_LEASE));
+
+    /* a lease that is refreshed is not taken as abandoned */
+    lease = weather_cache_store_get_filename(store1, key,
+                                             WEATHER_CACHE_LEASE_SUFFIX);
+    times.actime = times.modtime = now_t - SHARED_DOWNLOAD_LEASE;
+    g_assert_cmpint(g_utime(lease, &times), ==, 0);
+    weather_cache_store_refresh_lease(store1, key);
+    g_assert_false(weather_cache_store_take_lease(store2, key,
+                                                  SHARED_DOWNLOAD_LEASE));
+    g_free(lease);
+
+    session = soup_session_new();
+    upi = make_update_info(3600);
+    requests = server_get_count(&server.requests);
+    wd = download_forecast(session, upi);
+
+    info = want;
+    info.location_name = "Oslo";
+    info.etag = upi->etag;
+    info.last_modified = upi->last_modified;
+    info.cache_date = upi->last;
+    info.last_weather_download = upi->last;
+    info.weather_expires = upi->expires;
+    writer = weather_cache_writer_new(store1);
+    weather_cache_write_async(writer, key, NULL, &info, wd, NULL);
+    weather_cache_writer_free(writer);
+    weather_cache_store_release_lease(store1, key);
+
+    /* the second instance finds the data of the first one */
+    cache = weather_cache_open_shared(store2, key, &want, time(NULL));
+    g_assert_nonnull(cache);
+    shared = weather_cache_get_info(cache);
+    g_assert_cmpstr(shared->etag, ==, TEST_ETAG);
+    g_assert_cmpint(shared->weather_expires, ==, upi->expires);
+    wd2 = make_weather_data();
+    weather_cache_load_weatherdata(cache, wd2);
+    g_assert_cmpuint(wd2->timeslices->len, ==, wd->timeslices->len);
+    xml_weather_unref(wd2);
+    weather_cache_close(cache);
+    g_assert_cmpuint(server_get_count(&server.requests) - requests, ==, 1);
+
+    /* data that is not newer than ours is of no use */
+    want.last_weather_download = upi->last;
+    g_assert_null(weather_cache_open_shared(store2, key, &want,
+                                            time(NULL)));
+
+    /* neither is data of another place in the same cell */
+    want.last_weather_download = 0;
+    want.msl = 100;
+    g_assert_null(weather_cache_open_shared(store2, key, &want,
+                                            time(NULL)));
+
+    xml_weather_unref(wd);
+    update_info_free(upi);
+    g_object_unref(session);
+    g_free(key);
+    weather_cache_store_unref(store1);
+    weather_cache_store_unref(store2);
+    remove_dir(dir);
+    g_free(dir);
+}
+
+
+/*
+ * A host answering with Retry-After gets no requests until then. This
+ * blocks the test server for the rest of the run, so it comes last.
+ */
+static void
+test_retry_after(void)
+{
+    SoupSession *session;
+    GCancellable *cancellable;
+    update_info *upi;
+    test_response resp;
+    guint requests;
+
+    session = soup_session_new();
+    upi = make_update_info(3600);
+
+    request(session, "busy", upi, NULL, &resp);
+    g_assert_nonnull(resp.msg);
+    g_assert_cmpuint(response_get_status(&resp), ==, 429);
+    g_assert_cmpint(update_info_handle_response(upi, 429,
+                                                response_get_headers(&resp),
+                                                TEST_LAT, TEST_LON),
+                    ==, WEATHER_RESPONSE_FAILED);
+    g_assert_cmpuint(upi->http_status_code, ==, 429);
+    response_clear(&resp);
+
+    /* the next request waits in the scheduler until it is cancelled */
+    requests = server_get_count(&server.requests);
+    cancellable = g_cancellable_new();
+    g_timeout_add(TEST_WAIT, cb_cancel, cancellable);
+    request(session, "forecast", upi, cancellable, &resp);
+    g_assert_true(resp.cancelled);
+    g_assert_null(resp.msg);
+    g_assert_cmpuint(server_get_count(&server.requests), ==, requests);
+    response_clear(&resp);
+
+    g_object_unref(cancellable);
+    update_info_free(upi);
+    g_object_unref(session);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    GAsyncQueue *ready;
+    GThread *thread;
+    gint result;
+
+    /* download times are calculated in local time */
+    g_setenv("TZ", "UTC", TRUE);
+    tzset();
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_mutex_init(&server.mutex);
+    ready = g_async_queue_new();
+    thread = g_thread_new("server", server_thread, ready);
+    g_async_queue_pop(ready);
+    g_async_queue_unref(ready);
+
+    g_test_add_func("/update/not-modified", test_not_modified);
+    g_test_add_func("/update/expires", test_expires);
+    g_test_add_func("/update/restart", test_restart);
+    g_test_add_func("/update/shared", test_shared);
+    g_test_add_func("/update/retry-after", test_retry_after);
+    result = g_test_run();
+
+    g_main_loop_quit(server.loop);
+    g_thread_join(thread);
+    g_free(server.uri);
+    g_mutex_clear(&server.mutex);
+    return result;
+}